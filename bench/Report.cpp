@@ -0,0 +1,228 @@
+#include "Report.hpp"
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+
+namespace {
+
+// Just enough of a JSON reader for the files writeReport produces: objects, arrays,
+// strings without escapes beyond \" and \\, numbers, true / false / null.
+struct JsonValue {
+    enum class Type { Null, Bool, Number, String, Array, Object } type = Type::Null;
+    double number = 0.0;
+    std::string string;
+    std::vector<JsonValue> array;
+    std::map<std::string, JsonValue> object;
+
+    const JsonValue* find(const std::string& key) const {
+        auto it = object.find(key);
+        return it == object.end() ? nullptr : &it->second;
+    }
+};
+
+class JsonParser {
+public:
+    explicit JsonParser(const std::string& text) : text(text) {}
+
+    JsonValue parse() {
+        JsonValue value = parseValue();
+        skipSpace();
+        if (pos != text.size()) fail("trailing characters");
+        return value;
+    }
+
+private:
+    const std::string& text;
+    size_t pos = 0;
+
+    [[noreturn]] void fail(const char* what) {
+        throw std::runtime_error("Malformed benchmark report at offset " + std::to_string(pos) + ": " + what);
+    }
+
+    void skipSpace() {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos]))) ++pos;
+    }
+
+    bool consume(char c) {
+        skipSpace();
+        if (pos < text.size() && text[pos] == c) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c) {
+        if (!consume(c)) fail("unexpected character");
+    }
+
+    std::string parseString() {
+        expect('"');
+        std::string result;
+        while (pos < text.size() && text[pos] != '"') {
+            if (text[pos] == '\\' && pos + 1 < text.size()) ++pos;
+            result += text[pos++];
+        }
+        if (pos >= text.size()) fail("unterminated string");
+        ++pos;
+        return result;
+    }
+
+    JsonValue parseValue() {
+        skipSpace();
+        if (pos >= text.size()) fail("unexpected end");
+        JsonValue value;
+        char c = text[pos];
+        if (c == '{') {
+            ++pos;
+            value.type = JsonValue::Type::Object;
+            if (consume('}')) return value;
+            do {
+                skipSpace();
+                std::string key = parseString();
+                expect(':');
+                value.object[key] = parseValue();
+            } while (consume(','));
+            expect('}');
+        } else if (c == '[') {
+            ++pos;
+            value.type = JsonValue::Type::Array;
+            if (consume(']')) return value;
+            do {
+                value.array.push_back(parseValue());
+            } while (consume(','));
+            expect(']');
+        } else if (c == '"') {
+            value.type = JsonValue::Type::String;
+            value.string = parseString();
+        } else if (text.compare(pos, 4, "true") == 0 || text.compare(pos, 5, "false") == 0) {
+            value.type = JsonValue::Type::Bool;
+            value.number = text[pos] == 't' ? 1.0 : 0.0;
+            pos += text[pos] == 't' ? 4 : 5;
+        } else if (text.compare(pos, 4, "null") == 0) {
+            pos += 4;
+        } else {
+            size_t end = pos;
+            while (end < text.size() && (std::isdigit(static_cast<unsigned char>(text[end])) ||
+                                         std::strchr("+-.eE", text[end]))) {
+                ++end;
+            }
+            if (end == pos) fail("unexpected character");
+            value.type = JsonValue::Type::Number;
+            value.number = std::stod(text.substr(pos, end - pos));
+            pos = end;
+        }
+        return value;
+    }
+};
+
+double numberField(const JsonValue& object, const char* key) {
+    const JsonValue* value = object.find(key);
+    if (!value || value->type != JsonValue::Type::Number) {
+        throw std::runtime_error(std::string("Benchmark report is missing number field '") + key + "'");
+    }
+    return value->number;
+}
+
+std::string stringField(const JsonValue& object, const char* key) {
+    const JsonValue* value = object.find(key);
+    if (!value || value->type != JsonValue::Type::String) {
+        throw std::runtime_error(std::string("Benchmark report is missing string field '") + key + "'");
+    }
+    return value->string;
+}
+
+using CaseKey = std::tuple<std::string, size_t, float>;
+
+CaseKey keyOf(const BenchResult& result) {
+    return { result.name, result.particles, result.radius };
+}
+
+} // namespace
+
+void writeReport(const BenchReport& report, const std::string& path) {
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("Cannot write benchmark report " + path);
+    }
+    out.precision(17);
+    out << "{\n  \"version\": 1,\n"
+        << "  \"simd\": \"" << report.simd << "\",\n"
+        << "  \"threads\": " << report.threads << ",\n"
+        << "  \"results\": [";
+    for (size_t i = 0; i < report.results.size(); ++i) {
+        const BenchResult& r = report.results[i];
+        out << (i ? ",\n" : "\n")
+            << "    {\"name\": \"" << r.name << "\", \"particles\": " << r.particles
+            << ", \"radius\": " << r.radius << ", \"iterations\": " << r.iterations
+            << ", \"ns_per_iteration\": " << r.nsPerIteration
+            << ", \"ns_per_particle\": " << r.nsPerParticle
+            << ", \"particles_per_second\": " << r.particlesPerSecond << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+BenchReport readReport(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Cannot read benchmark report " + path);
+    }
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string text = buffer.str();
+    JsonValue root = JsonParser(text).parse();
+
+    BenchReport report;
+    report.simd = stringField(root, "simd");
+    report.threads = static_cast<unsigned>(numberField(root, "threads"));
+    const JsonValue* results = root.find("results");
+    if (!results || results->type != JsonValue::Type::Array) {
+        throw std::runtime_error("Benchmark report has no results array");
+    }
+    for (const JsonValue& entry : results->array) {
+        BenchResult r;
+        r.name = stringField(entry, "name");
+        r.particles = static_cast<size_t>(numberField(entry, "particles"));
+        r.radius = static_cast<float>(numberField(entry, "radius"));
+        r.iterations = static_cast<int>(numberField(entry, "iterations"));
+        r.nsPerIteration = numberField(entry, "ns_per_iteration");
+        r.nsPerParticle = numberField(entry, "ns_per_particle");
+        r.particlesPerSecond = numberField(entry, "particles_per_second");
+        report.results.push_back(r);
+    }
+    return report;
+}
+
+int compareReports(const BenchReport& baseline, const BenchReport& current, double threshold) {
+    std::map<CaseKey, const BenchResult*> previous;
+    for (const BenchResult& r : baseline.results) {
+        previous[keyOf(r)] = &r;
+    }
+
+    if (baseline.simd != current.simd || baseline.threads != current.threads) {
+        std::cout << "Note: baseline ran with " << baseline.simd << " x" << baseline.threads
+                  << " threads, this run with " << current.simd << " x" << current.threads << "\n";
+    }
+
+    int regressions = 0;
+    for (const BenchResult& r : current.results) {
+        auto it = previous.find(keyOf(r));
+        if (it == previous.end() || it->second->nsPerParticle <= 0.0) continue;
+        double change = r.nsPerParticle / it->second->nsPerParticle - 1.0;
+        bool regressed = change > threshold;
+        regressions += regressed;
+        char line[160];
+        std::snprintf(line, sizeof(line), "%-22s %9zu %6.0f  %10.3f -> %10.3f ns/particle  %+7.1f%%%s",
+                      r.name.c_str(), r.particles, r.radius, it->second->nsPerParticle, r.nsPerParticle,
+                      change * 100.0, regressed ? "  REGRESSION" : "");
+        std::cout << line << "\n";
+    }
+    return regressions;
+}
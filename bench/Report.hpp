@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// One measured case. A case is identified by its name, particle count and radius
+// (0 where the radius does not apply).
+struct BenchResult {
+    std::string name;
+    size_t particles = 0;
+    float radius = 0.0f;
+    int iterations = 0;
+    double nsPerIteration = 0.0; // Median over the iterations
+    double nsPerParticle = 0.0;
+    double particlesPerSecond = 0.0;
+};
+
+struct BenchReport {
+    std::string simd;
+    unsigned threads = 0;
+    std::vector<BenchResult> results;
+};
+
+void writeReport(const BenchReport& report, const std::string& path);
+
+// Reads a file written by writeReport; throws std::runtime_error on malformed input.
+BenchReport readReport(const std::string& path);
+
+// Prints the cases present in both reports and returns the number of regressions,
+// i.e. cases whose per-particle cost grew by more than threshold (0.1 = 10 %).
+int compareReports(const BenchReport& baseline, const BenchReport& current, double threshold);
@@ -0,0 +1,453 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../libfluid/core/FluidSimulator.hpp"
+#include "../libfluid/core/RenderData.hpp"
+#include "../libfluid/core/SoftwareRenderer.hpp"
+#include "../libfluid/core/TrajectoryRecorder.hpp"
+#include "Report.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+
+// Every case runs on a 1920x1080 scene; the particle count is reached by shrinking the
+// lattice spacing, so the actual count is within a few percent of the requested one.
+static constexpr int sceneWidth = 1920;
+static constexpr int sceneHeight = 1080;
+static constexpr float benchDt = 0.016f;
+
+struct BenchOptions {
+    std::vector<size_t> counts = { 10000, 40000, 160000, 640000, 2560000, 4000000 };
+    std::vector<float> radii = { 10.0f, 30.0f, 100.0f, 300.0f, 500.0f };
+    std::string filter;
+    std::string output;
+    std::string baseline;
+    double threshold = 0.10;
+    double minTime = 0.5;   // Seconds spent per case, at least minIterations runs
+    double maxPairs = 2e8;  // Estimated neighbour pairs per step above which a case is skipped
+    unsigned threads = 0;
+};
+
+static constexpr int minIterations = 3;
+
+
+static void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --counts A,B,...   particle counts (default 10000,...,4000000)\n"
+              << "  --radii A,B,...    interaction radii in pixels (default 10,30,100,300,500)\n"
+              << "  --filter TEXT      only run cases whose name contains TEXT\n"
+              << "  --min-time F       seconds per case (default 0.5)\n"
+              << "  --max-pairs F      skip cases above this many neighbour pairs per step (default 2e8)\n"
+              << "  --threads N        worker threads including the main one, 0 = all (default 0)\n"
+              << "  --output FILE      write the results as JSON\n"
+              << "  --baseline FILE    compare against a saved JSON report, exit 1 on regression\n"
+              << "  --threshold F      allowed per-particle slowdown before flagging (default 0.10)\n";
+}
+
+
+template<typename T>
+static std::vector<T> parseList(const std::string& text)
+{
+    std::vector<T> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        double value = std::atof(item.c_str());
+        if (value > 0.0) values.push_back(static_cast<T>(value));
+    }
+    return values;
+}
+
+
+// CPU time of the calling thread, which leaves out the time spent blocked and the
+// work handed to other threads
+struct ThreadCpuClock {
+    using duration = std::chrono::nanoseconds;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<ThreadCpuClock>;
+    static constexpr bool is_steady = true;
+
+    static time_point now()
+    {
+#ifdef _WIN32
+        FILETIME creation, exit, kernel, user;
+        GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+        auto ticks = [](const FILETIME& t) { return (static_cast<rep>(t.dwHighDateTime) << 32) | t.dwLowDateTime; };
+        return time_point(duration((ticks(kernel) + ticks(user)) * 100));
+#else
+        timespec t;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+        return time_point(duration(static_cast<rep>(t.tv_sec) * 1000000000 + t.tv_nsec));
+#endif
+    }
+};
+
+
+// Runs fn until both minTime and minIterations are reached and returns the median
+// duration of one call in nanoseconds, as measured by Clock. minTime is wall-clock time.
+template<typename Clock = std::chrono::steady_clock, typename Fn>
+static double measure(Fn&& fn, double minTime, int& iterations)
+{
+    std::vector<double> samples;
+    auto begin = std::chrono::steady_clock::now();
+    while (std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() < minTime ||
+           static_cast<int>(samples.size()) < minIterations) {
+        auto start = Clock::now();
+        fn();
+        samples.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    iterations = static_cast<int>(samples.size());
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return samples[samples.size() / 2] * 1e9;
+}
+
+
+class BenchRunner {
+public:
+    explicit BenchRunner(const BenchOptions& options) : options(options) {}
+
+    BenchReport run() {
+        for (size_t count : options.counts) {
+            runCount(count);
+        }
+        return report;
+    }
+
+private:
+    const BenchOptions& options;
+    BenchReport report;
+
+    bool selected(const std::string& name) const {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    }
+
+    bool tooExpensive(size_t count, float radius) const {
+        double n = static_cast<double>(count);
+        double pairs = n * n * 3.14159265 * radius * radius / (static_cast<double>(sceneWidth) * sceneHeight);
+        return pairs > options.maxPairs;
+    }
+
+    void record(const std::string& name, size_t particles, float radius, double nsPerIteration, int iterations) {
+        BenchResult r;
+        r.name = name;
+        r.particles = particles;
+        r.radius = radius;
+        r.iterations = iterations;
+        r.nsPerIteration = nsPerIteration;
+        r.nsPerParticle = particles ? nsPerIteration / static_cast<double>(particles) : 0.0;
+        r.particlesPerSecond = nsPerIteration > 0.0 ? particles * 1e9 / nsPerIteration : 0.0;
+        report.results.push_back(r);
+
+        std::printf("%-22s %9zu %6.0f  %6d it  %12.3f us/it  %8.3f ns/particle  %10.3g particles/s\n",
+                    name.c_str(), particles, radius, iterations, nsPerIteration / 1000.0,
+                    r.nsPerParticle, r.particlesPerSecond);
+        std::fflush(stdout);
+    }
+
+    void skip(const std::string& name, size_t particles, float radius) {
+        std::printf("%-22s %9zu %6.0f  skipped (above --max-pairs)\n", name.c_str(), particles, radius);
+    }
+
+    void runCount(size_t requested) {
+        SimulatorConfig config;
+        config.threadCount = options.threads;
+        config.particleSpacing = std::sqrt(static_cast<float>(sceneWidth) * sceneHeight / static_cast<float>(requested));
+        FluidSimulator simulator(sceneWidth, sceneHeight, config);
+        simulator.cflNumber = 0.0f; // Cases time one step per update, whatever the speeds
+        size_t count = simulator.getParticles().size();
+        if (report.simd.empty()) {
+            report.simd = simdLevelName(simulator.simdLevel);
+            report.threads = simulator.getThreadCount();
+        }
+
+        // One step so the velocities, and with them max-speed and upload, are not all zero
+        simulator.update(benchDt);
+        int iterations = 0;
+
+        if (selected("integrate")) {
+            simulator.interactionsEnabled = false;
+            double ns = measure([&] { simulator.update(benchDt); }, options.minTime, iterations);
+            record("integrate", count, 0.0f, ns, iterations);
+            simulator.interactionsEnabled = true;
+        }
+
+        // Integration kernels alone on one thread, each specialized combination against
+        // the kernel that switches on the same choices inside its loop
+        for (Integrator integrator : { Integrator::ExplicitEuler, Integrator::SemiImplicitEuler, Integrator::VelocityVerlet }) {
+            for (Boundary boundary : { Boundary::Reflect, Boundary::Clamp, Boundary::Wrap, Boundary::Open }) {
+                std::string name = std::string("kernel-") + integratorName(integrator) + "-" + boundaryName(boundary);
+                if (!selected(name)) continue;
+                ParticleView view = simulator.getParticles();
+                AlignedVector<float> x(view.x, view.x + count), y(view.y, view.y + count);
+                AlignedVector<float> vx(view.vx, view.vx + count), vy(view.vy, view.vy + count);
+                AlignedVector<float> forceX(count, 1.0f), forceY(count, -1.0f);
+                IntegrateParams params{ benchDt, simulator.damping, simulator.gravity, static_cast<float>(sceneWidth),
+                                        static_cast<float>(sceneHeight), integrator, boundary };
+                // Only read and written by verlet
+                AlignedVector<float> lastForceX(count, 0.0f), lastForceY(count, 0.0f);
+                params.lastForceX = lastForceX.data();
+                params.lastForceY = lastForceY.data();
+                params.lastDt = benchDt;
+                IntegrateKernel kernels[2] = {
+                    getIntegrateKernel(simulator.simdLevel, integrator, boundary, ForceSet::FieldAndParticle),
+                    getSwitchIntegrateKernel(simulator.simdLevel),
+                };
+                for (int k = 0; k < 2; ++k) {
+                    double ns = measure([&] {
+                        kernels[k](params, x.data(), y.data(), vx.data(), vy.data(), forceX.data(), forceY.data(), 0,
+                                   count, nullptr);
+                    }, options.minTime, iterations);
+                    record(k == 0 ? name : name + "-switch", count, 0.0f, ns, iterations);
+                }
+            }
+        }
+
+        if (selected("max-speed")) {
+            double ns = measure([&] {
+                volatile float maxSpeed = computeMaxSpeed(simulator.getParticles());
+                (void)maxSpeed;
+            }, options.minTime, iterations);
+            record("max-speed", count, 0.0f, ns, iterations);
+        }
+
+        if (selected("upload")) {
+            std::unique_ptr<float[]> buffer(new float[4 * count]);
+            void* arrays[4] = { buffer.get(), buffer.get() + count, buffer.get() + 2 * count, buffer.get() + 3 * count };
+            double ns = measure([&] { writeVertexData(simulator.getParticles(), arrays); }, options.minTime, iterations);
+            record("upload", count, 0.0f, ns, iterations);
+        }
+
+        // Packing into the compact vertex formats, what the renderer writes instead of upload
+        for (VertexFormat format : { VertexFormat::Compact16, VertexFormat::Compact8 }) {
+            const char* name = format == VertexFormat::Compact16 ? "pack-compact16" : "pack-compact8";
+            if (!selected(name)) continue;
+            std::unique_ptr<uint32_t[]> positions(new uint32_t[count]);
+            std::unique_ptr<uint16_t[]> speeds(new uint16_t[count]);
+            CompactPackKernel pack = getCompactPackKernel(format, simulator.simdLevel);
+            CompactPackParams params{ static_cast<float>(sceneWidth), static_cast<float>(sceneHeight),
+                                      std::max(simulator.getStats().maxSpeed, 1e-5f) };
+            double ns = measure([&] { pack(simulator.getParticles(), params, positions.get(), speeds.get(), 0, count); },
+                                options.minTime, iterations);
+            record(name, count, 0.0f, ns, iterations);
+        }
+
+        // Headless frame output, without the image encoding
+        for (bool smoke : { false, true }) {
+            const char* name = smoke ? "rasterize-smoke" : "rasterize";
+            if (!selected(name)) continue;
+            SoftwareRenderer renderer(sceneWidth, sceneHeight, options.threads);
+            renderer.smoke = smoke;
+            double ns = measure([&] { renderer.render(simulator.getParticles(), simulator.getStats()); },
+                                options.minTime, iterations);
+            record(name, count, 0.0f, ns, iterations);
+        }
+
+        if (selected("population")) {
+            // Integration with 1% of the particles spawned and removed per step: the emitter
+            // sits inside a drain, which takes its particles again the step after
+            SimulatorConfig churnConfig = config;
+            churnConfig.particleCapacity = count + count / 50;
+            FluidSimulator churn(sceneWidth, sceneHeight, churnConfig);
+            churn.interactionsEnabled = false;
+            float radius = 0.1f * sceneHeight;
+            churn.emitters.push_back({ sceneWidth * 0.5f, sceneHeight * 0.5f, radius, 0.01f * count / benchDt });
+            churn.drains.push_back({ sceneWidth * 0.5f, sceneHeight * 0.5f, radius });
+            churn.update(benchDt);
+            double ns = measure([&] { churn.update(benchDt); }, options.minTime, iterations);
+            record("population", churn.getParticles().size(), 0.0f, ns, iterations);
+        }
+
+        if (selected("record")) {
+            // What recording one trajectory frame costs the simulation thread: record()
+            // copies the particles itself, recordBorrowed() lends a copy that is kept
+            // anyway to the recorder's copy thread. Both queue every frame, so the
+            // time blocked on the writer is left out by timing the thread's CPU time.
+            ParticleStorage snapshot;
+            snapshot.reserve(count);
+            ParticleView view = simulator.getParticles();
+            for (size_t i = 0; i < count; ++i) snapshot.push_back(view[i]);
+            std::string path = options.output.empty() ? "bench-trajectory.tmp" : options.output + ".trajectory.tmp";
+            for (bool borrowed : { false, true }) {
+                const char* name = borrowed ? "record-borrowed" : "record-copy";
+                if (!selected(name)) continue;
+                uint64_t step = 0;
+                {
+                    TrajectoryRecorder recorder(path, sceneWidth, sceneHeight);
+                    double ns = measure<ThreadCpuClock>([&] {
+                        ++step;
+                        if (borrowed) {
+                            recorder.waitForCopy();
+                            recorder.recordBorrowed(snapshot.view(), step, step * benchDt);
+                        } else {
+                            recorder.record(view, step, step * benchDt);
+                        }
+                    }, options.minTime, iterations);
+                    record(name, count, 0.0f, ns, iterations);
+                }
+                std::remove(path.c_str());
+            }
+        }
+
+        if (selected("reorder")) {
+            double ns = measure([&] { simulator.reorderParticles(); }, options.minTime, iterations);
+            record("reorder", count, 0.0f, ns, iterations);
+        }
+
+        if (selected("obstacle")) {
+            // A 16x9 lattice of circles over the scene, each one lookup per particle
+            // however many there are. Moving one rebakes only the samples around it.
+            std::vector<Obstacle> obstacles;
+            for (int j = 0; j < 9; ++j) {
+                for (int i = 0; i < 16; ++i) {
+                    Obstacle circle;
+                    circle.x = (i + 0.5f) * sceneWidth / 16.0f;
+                    circle.y = (j + 0.5f) * sceneHeight / 9.0f;
+                    circle.radius = 0.15f * sceneHeight / 9.0f;
+                    obstacles.push_back(circle);
+                }
+            }
+            ThreadPool pool(options.threads);
+            ObstacleField field(sceneWidth, sceneHeight, obstacles, pool);
+            ParticleView view = simulator.getParticles();
+            ParticleStorage particles;
+            particles.reserve(count);
+            for (size_t i = 0; i < count; ++i) particles.push_back(view[i]);
+            if (selected("obstacle-collide")) {
+                double ns = measure([&] { field.collide(particles, count, 0.0f, pool); }, options.minTime, iterations);
+                record("obstacle-collide", count, 0.0f, ns, iterations);
+            }
+            if (selected("obstacle-move")) {
+                float offset = 0.0f;
+                double ns = measure([&] {
+                    offset = 4.0f - offset;
+                    field.move(0, obstacles[0].x + offset, obstacles[0].y, pool);
+                }, options.minTime, iterations);
+                record("obstacle-move", field.getLastRebakedSamples(), 0.0f, ns, iterations);
+            }
+        }
+
+        for (float radius : options.radii) {
+            bool expensive = tooExpensive(count, radius);
+
+            if (selected("perturbation")) {
+                if (expensive) {
+                    skip("perturbation", count, radius);
+                } else {
+                    // Alternate the sign so repeated pushes do not drain the region
+                    float strength = 50.0f;
+                    double ns = measure([&] {
+                        simulator.addPerturbation(sceneWidth * 0.5f + 0.25f, sceneHeight * 0.5f + 0.25f, radius, strength);
+                        simulator.applyPerturbations();
+                        strength = -strength;
+                    }, options.minTime, iterations);
+                    record("perturbation", count, radius, ns, iterations);
+                }
+            }
+
+            if (selected("perturbation-batch")) {
+                if (expensive) {
+                    skip("perturbation-batch", count, radius);
+                } else {
+                    // A scripted scene's worth of emitters on a 16x16 lattice, applied as one batch
+                    std::vector<Perturbation> batch;
+                    for (int j = 0; j < 16; ++j) {
+                        for (int i = 0; i < 16; ++i) {
+                            batch.push_back({ (i + 0.5f) * sceneWidth / 16.0f, (j + 0.5f) * sceneHeight / 16.0f,
+                                              radius, 50.0f, 1.0f });
+                        }
+                    }
+                    double ns = measure([&] {
+                        simulator.addPerturbations(batch.data(), batch.size());
+                        simulator.applyPerturbations();
+                        for (Perturbation& p : batch) p.strength = -p.strength;
+                    }, options.minTime, iterations);
+                    record("perturbation-batch", count, radius, ns, iterations);
+                }
+            }
+
+            if (selected("update")) {
+                if (expensive) {
+                    skip("update", count, radius);
+                    continue;
+                }
+                simulator.interactionRadius = radius;
+                simulator.update(benchDt); // Rebuilds the grid for the new cell size
+                double ns = measure([&] { simulator.update(benchDt); }, options.minTime, iterations);
+                record("update", count, radius, ns, iterations);
+            }
+        }
+    }
+};
+
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        const char* value = argv[++i];
+        if (arg == "--counts") options.counts = parseList<size_t>(value);
+        else if (arg == "--radii") options.radii = parseList<float>(value);
+        else if (arg == "--filter") options.filter = value;
+        else if (arg == "--min-time") options.minTime = std::atof(value);
+        else if (arg == "--max-pairs") options.maxPairs = std::atof(value);
+        else if (arg == "--threads") options.threads = static_cast<unsigned>(std::atoi(value));
+        else if (arg == "--output") options.output = value;
+        else if (arg == "--baseline") options.baseline = value;
+        else if (arg == "--threshold") options.threshold = std::atof(value);
+        else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (options.counts.empty() || options.radii.empty()) {
+        std::cerr << "Particle counts and radii must be positive" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        BenchReport report = BenchRunner(options).run();
+        if (!options.output.empty()) {
+            writeReport(report, options.output);
+        }
+        if (!options.baseline.empty()) {
+            std::cout << "\nComparison with " << options.baseline << ":\n";
+            int regressions = compareReports(readReport(options.baseline), report, options.threshold);
+            if (regressions > 0) {
+                std::cout << regressions << " case(s) regressed by more than "
+                          << options.threshold * 100.0 << "%" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,401 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "libfluid/core/AllocationAudit.hpp"
+#include "libfluid/core/FluidSimulator.hpp"
+#include "libfluid/core/Profiler.hpp"
+#include "libfluid/core/SoftwareRenderer.hpp"
+#include "libfluid/core/TrajectoryRecorder.hpp"
+
+
+static void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --width N       scene width in pixels (default 1920)\n"
+              << "  --height N      scene height in pixels (default 1080)\n"
+              << "  --spacing F     initial particle spacing in pixels (default 5)\n"
+              << "  --lattice on|off        start from the particle lattice or from an empty scene (default on)\n"
+              << "  --capacity N            particle storage reserved up front (default the initial lattice)\n"
+              << "  --emitter X,Y,R,RATE[,VX,VY,LIFE]  spawn RATE particles per second within R of (X, Y), repeatable\n"
+              << "  --drain X,Y,R           remove the particles within R of (X, Y), repeatable\n"
+              << "  --sleep-speed F         particles slower than F for --sleep-steps steps fall asleep, 0 = never (default 0)\n"
+              << "  --sleep-steps N         steps below the sleep speed before a particle sleeps (default 30)\n"
+              << "  --obstacles FILE        circles and polygons the particles collide with, one per line\n"
+              << "  --restitution F         share of the speed into an obstacle bounced back (default 0)\n"
+              << "  --frames N      number of steps to run (default 600)\n"
+              << "  --dt F          time step in seconds, 0 = as long as --cfl allows (default 0.016)\n"
+              << "  --cfl F                 max distance per substep in interaction radii, 0 = no substeps (default 0.5, none in grid mode)\n"
+              << "  --max-substeps N        substeps per step at most (default 8)\n"
+              << "  --max-dt F              longest step with --dt 0 (default 0.0333)\n"
+              << "  --mode NAME     particles, sph or grid (default particles)\n"
+              << "  --threads N     worker threads including the main one, 0 = all (default 0)\n"
+              << "  --integrator NAME       euler, semi-implicit or verlet (default euler, semi-implicit for sph)\n"
+              << "  --boundary NAME         reflect, clamp, wrap or open (default reflect, clamp for sph)\n"
+              << "  --trace FILE    write a Chrome trace of the run (profiling builds only)\n"
+              << "  --audit-from N          abort if step N or a later one allocates (allocation audit builds only, default 10)\n"
+              << "  --check F               fail once a particle moves faster than F or leaves the domain by more than\n"
+              << "                          an interaction radius\n"
+              << "  --checkpoint FILE       start from a saved state instead of a new lattice\n"
+              << "  --save-checkpoint FILE  save the state after the last step\n"
+              << "  --reorder-every N       sort particle storage along a Z-order curve every N steps (default 0 = off)\n"
+              << "  --reorder-threshold F   also sort once the grid's storage scatter exceeds F (default 0.5, 0 = off)\n"
+              << "  --record FILE           record every step to a trajectory file\n"
+              << "  --record-policy NAME    block or drop frames when the writer falls behind (default block)\n"
+              << "  --render FILE           render frames to FILE.png or FILE.ppm, numbered before the extension\n"
+              << "  --render-every N        render every Nth step (default 1)\n"
+              << "  --render-style NAME     points or smoke (default points)\n"
+              << "  --bloom-levels N        bloom pyramid levels, 0 to 6, as in the windowed renderer (default 3)\n"
+              << "  --bloom-strength F      bloom added to the scene (default 0.5)\n";
+}
+
+
+static bool parseMode(const std::string& name, SolverMode& mode)
+{
+    if (name == "particles") mode = SolverMode::Particles;
+    else if (name == "sph") mode = SolverMode::SPH;
+    else if (name == "grid") mode = SolverMode::Grid;
+    else return false;
+    return true;
+}
+
+
+// frame.png -> frame000042.png
+static std::string numberedPath(const std::string& path, int frame)
+{
+    std::string number = std::to_string(frame);
+    number.insert(0, number.size() < 6 ? 6 - number.size() : 0, '0');
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return path + number;
+    return path.substr(0, dot) + number + path.substr(dot);
+}
+
+
+// "1,2.5,3" -> up to maxCount floats, returns how many were read
+static int parseFloats(const char* value, float* out, int maxCount)
+{
+    int count = 0;
+    int consumed = 0;
+    while (count < maxCount && std::sscanf(value, count == 0 ? "%f%n" : ",%f%n", &out[count], &consumed) == 1) {
+        value += consumed;
+        ++count;
+    }
+    return *value == '\0' ? count : -1;
+}
+
+
+static bool parseIntegrator(const std::string& name, Integrator& integrator)
+{
+    for (Integrator candidate : { Integrator::ExplicitEuler, Integrator::SemiImplicitEuler, Integrator::VelocityVerlet }) {
+        if (name == integratorName(candidate)) {
+            integrator = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static bool parseBoundary(const std::string& name, Boundary& boundary)
+{
+    for (Boundary candidate : { Boundary::Reflect, Boundary::Clamp, Boundary::Wrap, Boundary::Open }) {
+        if (name == boundaryName(candidate)) {
+            boundary = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static const char* modeName(SolverMode mode)
+{
+    switch (mode) {
+    case SolverMode::SPH: return "sph";
+    case SolverMode::Grid: return "grid";
+    default: return "particles";
+    }
+}
+
+
+int main(int argc, char** argv) {
+    int width = 1920, height = 1080;
+    int frames = 600;
+    float dt = 0.016f;
+    std::optional<float> cflNumber, maxTimeStep, checkSpeed;
+    std::optional<int> maxSubsteps;
+    SimulatorConfig config;
+    std::string tracePath, checkpointPath, saveCheckpointPath, recordPath;
+    TrajectoryOptions recordOptions;
+    std::string renderPath, obstaclePath;
+    float restitution = 0.0f;
+    float sleepSpeed = 0.0f;
+    int sleepSteps = 30;
+    int renderEvery = 1;
+    int auditFrom = 10;
+    int reorderInterval = 0;
+    float reorderThreshold = 0.5f;
+    BloomSettings bloom;
+    bool smoke = false;
+    std::vector<Emitter> emitters;
+    std::vector<Drain> drains;
+    std::optional<Integrator> integrator;
+    std::optional<Boundary> boundary;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        const char* value = argv[++i];
+        if (arg == "--width") width = std::atoi(value);
+        else if (arg == "--height") height = std::atoi(value);
+        else if (arg == "--spacing") config.particleSpacing = static_cast<float>(std::atof(value));
+        else if (arg == "--capacity") config.particleCapacity = static_cast<size_t>(std::atoll(value));
+        else if (arg == "--lattice") config.initialLattice = std::string(value) != "off";
+        else if (arg == "--emitter") {
+            float v[7] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+            int count = parseFloats(value, v, 7);
+            if (count != 4 && count != 6 && count != 7) {
+                std::cerr << "Emitter needs X,Y,R,RATE[,VX,VY[,LIFE]]: " << value << std::endl;
+                return EXIT_FAILURE;
+            }
+            emitters.push_back({ v[0], v[1], v[2], v[3], v[4], v[5], v[6] });
+        }
+        else if (arg == "--drain") {
+            float v[3];
+            if (parseFloats(value, v, 3) != 3) {
+                std::cerr << "Drain needs X,Y,R: " << value << std::endl;
+                return EXIT_FAILURE;
+            }
+            drains.push_back({ v[0], v[1], v[2] });
+        }
+        else if (arg == "--obstacles") obstaclePath = value;
+        else if (arg == "--sleep-speed") sleepSpeed = static_cast<float>(std::atof(value));
+        else if (arg == "--sleep-steps") sleepSteps = std::atoi(value);
+        else if (arg == "--restitution") restitution = static_cast<float>(std::atof(value));
+        else if (arg == "--frames") frames = std::atoi(value);
+        else if (arg == "--dt") dt = static_cast<float>(std::atof(value));
+        else if (arg == "--cfl") cflNumber = static_cast<float>(std::atof(value));
+        else if (arg == "--max-substeps") maxSubsteps = std::atoi(value);
+        else if (arg == "--max-dt") maxTimeStep = static_cast<float>(std::atof(value));
+        else if (arg == "--threads") config.threadCount = static_cast<unsigned>(std::atoi(value));
+        else if (arg == "--reorder-every") reorderInterval = std::atoi(value);
+        else if (arg == "--reorder-threshold") reorderThreshold = static_cast<float>(std::atof(value));
+        else if (arg == "--trace") tracePath = value;
+        else if (arg == "--audit-from") auditFrom = std::atoi(value);
+        else if (arg == "--check") checkSpeed = static_cast<float>(std::atof(value));
+        else if (arg == "--checkpoint") checkpointPath = value;
+        else if (arg == "--save-checkpoint") saveCheckpointPath = value;
+        else if (arg == "--record") recordPath = value;
+        else if (arg == "--record-policy") {
+            std::string name = value;
+            if (name == "block") recordOptions.backpressure = TrajectoryOptions::Backpressure::Block;
+            else if (name == "drop") recordOptions.backpressure = TrajectoryOptions::Backpressure::Drop;
+            else {
+                std::cerr << "Unknown record policy: " << value << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (arg == "--render") renderPath = value;
+        else if (arg == "--render-every") renderEvery = std::atoi(value);
+        else if (arg == "--bloom-levels") bloom.levels = std::atoi(value);
+        else if (arg == "--bloom-strength") bloom.strength = static_cast<float>(std::atof(value));
+        else if (arg == "--render-style") {
+            std::string name = value;
+            if (name == "points") smoke = false;
+            else if (name == "smoke") smoke = true;
+            else {
+                std::cerr << "Unknown render style: " << value << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (arg == "--integrator") {
+            Integrator parsed;
+            if (!parseIntegrator(value, parsed)) {
+                std::cerr << "Unknown integrator: " << value << std::endl;
+                return EXIT_FAILURE;
+            }
+            integrator = parsed;
+        }
+        else if (arg == "--boundary") {
+            Boundary parsed;
+            if (!parseBoundary(value, parsed)) {
+                std::cerr << "Unknown boundary: " << value << std::endl;
+                return EXIT_FAILURE;
+            }
+            boundary = parsed;
+        }
+        else if (arg == "--mode") {
+            if (!parseMode(value, config.mode)) {
+                std::cerr << "Unknown mode: " << value << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (width <= 0 || height <= 0 || frames <= 0 || !(dt >= 0.0f) || renderEvery <= 0) {
+        std::cerr << "Scene size, frame count and render interval must be positive, dt not negative" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        FluidSimulator simulator = checkpointPath.empty() ? FluidSimulator(width, height, config)
+                                                          : FluidSimulator::loadCheckpoint(checkpointPath, config.threadCount);
+        width = simulator.getWidth();
+        height = simulator.getHeight();
+        simulator.reorderInterval = reorderInterval;
+        simulator.reorderThreshold = reorderThreshold;
+        if (integrator) simulator.integrator = *integrator;
+        if (boundary) simulator.boundary = *boundary;
+        if (cflNumber) simulator.cflNumber = *cflNumber;
+        if (maxSubsteps) simulator.maxSubsteps = *maxSubsteps;
+        if (maxTimeStep) simulator.maxTimeStep = *maxTimeStep;
+        simulator.emitters = emitters;
+        simulator.drains = drains;
+        if (!obstaclePath.empty()) simulator.setObstacles(loadObstacles(obstaclePath));
+        simulator.obstacleRestitution = restitution;
+        simulator.sleepSpeed = sleepSpeed;
+        simulator.sleepSteps = sleepSteps;
+        size_t particleCount = simulator.getParticles().size();
+        std::cout << "Scene " << width << "x" << height;
+        if (checkpointPath.empty()) std::cout << ", spacing " << config.particleSpacing;
+        else std::cout << ", from " << checkpointPath;
+        std::cout << ", " << particleCount << " particles, mode " << modeName(simulator.getMode())
+                  << ", " << simulator.getThreadCount() << " threads, "
+                  << simdLevelName(simulator.simdLevel) << ", " << integratorName(simulator.integrator) << " / "
+                  << boundaryName(simulator.boundary);
+        if (const ObstacleField* obstacles = simulator.getObstacleField()) {
+            std::cout << ", " << obstacles->getObstacles().size() << " obstacles";
+        }
+        std::cout << std::endl;
+
+        std::optional<TrajectoryRecorder> recorder;
+        if (!recordPath.empty()) {
+            recorder.emplace(recordPath, static_cast<float>(width), static_cast<float>(height), recordOptions);
+            recorder->reserve(simulator.getParticleCapacity());
+        }
+
+        std::optional<SoftwareRenderer> renderer;
+        if (!renderPath.empty()) {
+            renderer.emplace(width, height, config.threadCount);
+            renderer->smoke = smoke;
+            renderer->bloom = bloom;
+        }
+
+        Profiler::setThreadName("main");
+        // Rendering is timed on its own so the step throughput stays comparable
+        double renderSeconds = 0.0;
+        int renderedFrames = 0;
+        auto start = std::chrono::steady_clock::now();
+        double particleSteps = 0.0, simulatedTime = 0.0;
+        int maxFrameSubsteps = 0;
+        for (int frame = 0; frame < frames; ++frame) {
+            // Past the first steps, and the first rendered frame, every buffer has grown to
+            // its working size. Writing the image out is left outside, as file output is
+            // not part of the loop.
+            std::optional<NoAllocationScope> audit;
+            if (frame + 1 >= auditFrom && (!renderer || renderedFrames > 0)) audit.emplace();
+            float frameDt = dt > 0.0f ? dt : simulator.frameTimeStep();
+            simulator.update(frameDt);
+            simulatedTime += frameDt;
+            // Per substep, which is what the work scales with
+            particleSteps += static_cast<double>(simulator.getParticles().size()) * simulator.getStats().substeps;
+            maxFrameSubsteps = std::max(maxFrameSubsteps, simulator.getStats().substeps);
+            if (checkSpeed) {
+                // Reflect lets a particle overshoot an edge by a step's travel before it turns
+                const StepStats& stats = simulator.getStats();
+                float margin = simulator.interactionRadius;
+                bool bounded = stats.maxSpeed <= *checkSpeed && stats.minX >= -margin && stats.minY >= -margin &&
+                               stats.maxX <= width + margin && stats.maxY <= height + margin;
+                if (stats.count > 0 && !bounded) {
+                    audit.reset();
+                    std::cerr << "Check failed after step " << frame + 1 << ": max speed " << stats.maxSpeed
+                              << ", particles within [" << stats.minX << ", " << stats.maxX << "] x ["
+                              << stats.minY << ", " << stats.maxY << "]" << std::endl;
+                    return EXIT_FAILURE;
+                }
+            }
+            if (recorder) {
+                recorder->record(simulator.getParticles(), frame + 1, simulatedTime,
+                                 simulator.getParticleSlots(), simulator.getParticleIdCount());
+            }
+            if (renderer && (frame + 1) % renderEvery == 0) {
+                auto renderStart = std::chrono::steady_clock::now();
+                renderer->render(simulator.getParticles(), simulator.getStats());
+                audit.reset();
+                renderer->writeImage(numberedPath(renderPath, frame + 1));
+                renderSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+                ++renderedFrames;
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() - renderSeconds;
+
+        double stepsPerSecond = frames / seconds;
+        double nsPerParticleStep = particleSteps > 0.0 ? seconds * 1e9 / particleSteps : 0.0;
+        std::cout << frames << " steps in " << seconds << " s: " << stepsPerSecond << " steps/s, "
+                  << nsPerParticleStep << " ns/particle/step" << std::endl;
+        std::cout << simulator.getSubstepCount() << " substeps (" << static_cast<double>(simulator.getSubstepCount()) / frames
+                  << " per step, at most " << maxFrameSubsteps << "), " << simulatedTime << " s simulated" << std::endl;
+        if (simulator.getUnstableUpdateCount() > 0) {
+            std::cout << simulator.getUnstableUpdateCount() << " steps needed more than --max-substeps "
+                      << simulator.maxSubsteps << " to stay within SPH's stability limit" << std::endl;
+        }
+        if (simulator.getSpawnedCount() > 0 || simulator.getRemovedCount() > 0) {
+            std::cout << simulator.getSpawnedCount() << " particles spawned (" << simulator.getDroppedSpawns()
+                      << " dropped at capacity " << simulator.getParticleCapacity() << "), "
+                      << simulator.getRemovedCount() << " removed, " << simulator.getParticles().size() << " left"
+                      << std::endl;
+        }
+        if (simulator.getAwakeCount() < simulator.getParticles().size()) {
+            std::cout << simulator.getParticles().size() - simulator.getAwakeCount() << " of "
+                      << simulator.getParticles().size() << " particles asleep" << std::endl;
+        }
+        const FrameArena& arena = simulator.getFrameArena();
+        std::cout << "Scratch arena peak " << arena.getPeak() / 1024 << " of " << arena.getCapacity() / 1024 << " KB";
+        if (arena.getSpillCount() > 0) std::cout << ", spilled " << arena.getSpillCount() << " times";
+        std::cout << std::endl;
+        if (simulator.getReorderCount() > 0) {
+            std::cout << simulator.getReorderCount() << " storage reorders" << std::endl;
+        }
+
+        if (renderedFrames > 0) {
+            std::cout << renderedFrames << " frames rendered in " << renderSeconds << " s: "
+                      << renderSeconds * 1e3 / renderedFrames << " ms/frame" << std::endl;
+        }
+        if (recorder) {
+            recorder->close();
+            std::cout << recorder->getRecordedFrames() << " frames recorded, "
+                      << recorder->getDroppedFrames() << " dropped" << std::endl;
+        }
+        if (!saveCheckpointPath.empty()) {
+            simulator.saveCheckpoint(saveCheckpointPath);
+        }
+
+        if (profilingEnabled) {
+            Profiler::printSummary(std::cout, seconds + 1.0);
+            if (!tracePath.empty()) Profiler::writeChromeTrace(tracePath);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
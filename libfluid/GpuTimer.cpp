@@ -0,0 +1,89 @@
+#include "GpuTimer.hpp"
+
+GpuTimer::GpuTimer() {
+    if (!profilingEnabled || !GLEW_ARB_timer_query) return;
+    enabled = true;
+    for (Frame& frame : frames) {
+        for (Pass& pass : frame.passes) {
+            glGenQueries(2, pass.queries);
+        }
+    }
+    track = &Profiler::namedTrack("GPU");
+    calibrate();
+}
+
+GpuTimer::~GpuTimer() {
+    if (!enabled) return;
+    for (Frame& frame : frames) {
+        for (Pass& pass : frame.passes) {
+            glDeleteQueries(2, pass.queries);
+        }
+    }
+}
+
+void GpuTimer::calibrate() {
+    GLint64 gpuNow = 0;
+    glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+    clockOffset = static_cast<int64_t>(Profiler::now()) - static_cast<int64_t>(gpuNow);
+    framesSinceCalibration = 0;
+}
+
+void GpuTimer::collect(Frame& frame) {
+    if (frame.count == 0) return;
+    GLint available = 0;
+    glGetQueryObjectiv(frame.passes[frame.count - 1].queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+        for (int i = 0; i < frame.count; ++i) {
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(frame.passes[i].queries[0], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(frame.passes[i].queries[1], GL_QUERY_RESULT, &end);
+            int64_t mappedStart = static_cast<int64_t>(start) + clockOffset;
+            if (mappedStart < 0 || end < start) continue;
+            track->record(frame.passes[i].name, static_cast<uint64_t>(mappedStart),
+                          static_cast<uint64_t>(mappedStart) + (end - start));
+        }
+    }
+    frame.count = 0;
+}
+
+void GpuTimer::beginFrame() {
+    if (!enabled) return;
+    currentFrame = (currentFrame + 1) % framesInFlight;
+    // Results are only read once, just before the slot's queries are reused
+    collect(frames[currentFrame]);
+    openCount = 0;
+    overflowDepth = 0;
+    if (++framesSinceCalibration >= recalibrateInterval) {
+        calibrate();
+    }
+}
+
+void GpuTimer::begin(const char* name) {
+    if (!enabled || currentFrame < 0) return;
+    Frame& frame = frames[currentFrame];
+    if (openCount == maxPasses) {
+        ++overflowDepth; // Nested too deep, its end() must not close an outer pass
+        return;
+    }
+    if (frame.count == maxPasses) {
+        openPasses[openCount++] = -1; // Out of queries, keep begin / end balanced
+        return;
+    }
+    Pass& pass = frame.passes[frame.count];
+    pass.name = name;
+    glQueryCounter(pass.queries[0], GL_TIMESTAMP);
+    openPasses[openCount++] = frame.count++;
+}
+
+void GpuTimer::end() {
+    if (!enabled || currentFrame < 0) return;
+    if (overflowDepth > 0) {
+        --overflowDepth;
+        return;
+    }
+    if (openCount == 0) return;
+    int pass = openPasses[--openCount];
+    if (pass >= 0) {
+        glQueryCounter(frames[currentFrame].passes[pass].queries[1], GL_TIMESTAMP);
+    }
+}
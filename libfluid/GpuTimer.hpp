@@ -0,0 +1,72 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstdint>
+
+#include "core/Profiler.hpp"
+
+// GPU durations of the render passes, recorded into the "GPU" profiler track. Each
+// pass is bracketed by two GL_TIMESTAMP queries that are read back a few frames
+// later, so the CPU never waits for the GPU; frames whose results are still not in
+// when their queries come round again are dropped. Needs ARB_timer_query and does
+// nothing without it or when profiling is compiled out.
+class GpuTimer {
+public:
+    GpuTimer();
+    ~GpuTimer();
+
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    // Publishes the oldest frame's results and starts recording a new frame
+    void beginFrame();
+    void begin(const char* name);
+    void end();
+
+private:
+    static constexpr int framesInFlight = 4;
+    static constexpr int maxPasses = 16;
+    static constexpr int recalibrateInterval = 256; // Frames between GPU / CPU clock syncs
+
+    struct Pass {
+        const char* name = nullptr;
+        GLuint queries[2] = { 0, 0 }; // Start and end timestamp
+    };
+
+    struct Frame {
+        Pass passes[maxPasses];
+        int count = 0;
+    };
+
+    bool enabled = false;
+    Frame frames[framesInFlight];
+    int currentFrame = -1;
+    int openPasses[maxPasses];
+    int openCount = 0;
+    int overflowDepth = 0; // Passes begun while openPasses was full, ended without a query
+    int framesSinceCalibration = 0;
+    int64_t clockOffset = 0; // Profiler clock minus GPU clock, in nanoseconds
+    ProfileTrack* track = nullptr;
+
+    void calibrate();
+    void collect(Frame& frame);
+};
+
+class GpuScope {
+public:
+    GpuScope(GpuTimer& timer, const char* name) : timer(timer) { timer.begin(name); }
+    ~GpuScope() { timer.end(); }
+
+    GpuScope(const GpuScope&) = delete;
+    GpuScope& operator=(const GpuScope&) = delete;
+
+private:
+    GpuTimer& timer;
+};
+
+#ifdef FLUID_PROFILING
+#define FLUID_GPU_PROFILE_SCOPE(timer, name) GpuScope FLUID_PROFILE_CONCAT(gpuScope, __LINE__)(timer, name)
+#else
+#define FLUID_GPU_PROFILE_SCOPE(timer, name) ((void)0)
+#endif
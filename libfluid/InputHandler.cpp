@@ -1,7 +1,19 @@
 #include "InputHandler.hpp"
+#include "core/Profiler.hpp"
 
-InputHandler::InputHandler(GLFWwindow* window, FluidSimulator& simulator)
-    : window(window), simulator(simulator) {
+#include <algorithm>
+
+namespace {
+
+// Speed a held button adds per second, what it used to add per frame at 60 FPS
+constexpr float pushRate = 300.0f * 60.0f;
+// Longest stretch of holding one frame's push covers, so a stall does not end in a blast
+constexpr double maxPushInterval = 0.1;
+
+} // namespace
+
+InputHandler::InputHandler(GLFWwindow* window, SimulationThread& simulation)
+    : window(window), simulation(simulation), lastInputTime(glfwGetTime()) {
     glfwSetWindowUserPointer(window, this);
 
     // Set up mouse button callback
@@ -24,16 +36,25 @@ InputHandler::InputHandler(GLFWwindow* window, FluidSimulator& simulator)
 
 
 void InputHandler::processInput() {
+    FLUID_PROFILE_SCOPE("input");
     int width, height;
     glfwGetWindowSize(window, &width, &height); // Get the window dimensions
 
     float correctedY = static_cast<float>(height) - static_cast<float>(mouseY); // Invert y-coordinate
 
-    if (isLeftClickActive) {
-        simulator.addPerturbation(static_cast<float>(mouseX), correctedY, 300.0f, -300.0f); // Attract
-    }
-    if (isRightClickActive) {
-        simulator.addPerturbation(static_cast<float>(mouseX), correctedY, 300.0f, 300.0f); // Repel
+    // A held button pushes for the time since the last frame, so the push per second
+    // is the same however many frames arrive per simulation step; the simulation sums
+    // what was queued since its last step. Pushes the queue has no room for are
+    // carried over to the next frame instead of being lost.
+    double now = glfwGetTime();
+    float elapsed = static_cast<float>(std::min(now - lastInputTime, maxPushInterval));
+    lastInputTime = now;
+    float direction = (isRightClickActive ? 1.0f : 0.0f) - (isLeftClickActive ? 1.0f : 0.0f); // Repel, attract
+    float maxStrength = static_cast<float>(pushRate * maxPushInterval);
+    float strength = std::clamp(unsentStrength + direction * pushRate * elapsed, -maxStrength, maxStrength);
+    unsentStrength = 0.0f;
+    if (strength != 0.0f && !simulation.addPerturbation(static_cast<float>(mouseX), correctedY, 300.0f, strength)) {
+        unsentStrength = strength;
     }
 
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
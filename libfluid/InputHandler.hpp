@@ -4,18 +4,20 @@
 #include <GLFW/glfw3.h>
 
 #include "Renderer.hpp"
-#include "FluidSimulator.hpp"
+#include "core/SimulationThread.hpp"
 
 
 class InputHandler {
 public:
-    InputHandler(GLFWwindow* window, FluidSimulator& simulator);
+    InputHandler(GLFWwindow* window, SimulationThread& simulation);
     void processInput();
 
 private:
     GLFWwindow* window;
-    FluidSimulator& simulator;
+    SimulationThread& simulation;
     bool isLeftClickActive = false;
     bool isRightClickActive = false;
     double mouseX = 0.0, mouseY = 0.0;
+    double lastInputTime;        // glfwGetTime() of the last processInput()
+    float unsentStrength = 0.0f; // Push the full input queue turned away, sent with the next one
 };
@@ -1,10 +1,15 @@
 #include "Renderer.hpp"
 
+#include <algorithm>
+
 const char* vertexShaderSource = R"(
 #version 330 core
 
-layout(location = 0) in vec2 aPosition;
-layout(location = 1) in vec2 aVelocity;
+// Particles are uploaded as separate x / y / vx / vy arrays
+layout(location = 0) in float aPositionX;
+layout(location = 1) in float aPositionY;
+layout(location = 2) in float aVelocityX;
+layout(location = 3) in float aVelocityY;
 
 out float velocityMagnitude;
 
@@ -12,8 +17,31 @@ uniform mat4 uProjection; // Projection matrix
 uniform float uParticleSize; // Particle size (radius)
 
 void main() {
+    vec2 aPosition = vec2(aPositionX, aPositionY);
     gl_Position = uProjection * vec4(aPosition, 0.0, 1.0);
-    velocityMagnitude = length(aVelocity);
+    velocityMagnitude = length(vec2(aVelocityX, aVelocityY));
+    gl_PointSize = uParticleSize; // Scale the point size (to simulate the radius of a circle)
+}
+)";
+
+// Compact vertex format: positions as 16-bit fractions of the domain and the speed
+// already divided by the maximum, both read back normalized to [0, 1]
+const char* compactVertexShaderSource = R"(
+#version 330 core
+
+layout(location = 0) in vec2 aPosition;
+layout(location = 1) in float aSpeed;
+
+out float velocityMagnitude;
+
+uniform mat4 uProjection; // Projection matrix
+uniform float uParticleSize; // Particle size (radius)
+uniform vec2 uDomainSize; // Domain the positions are fractions of
+uniform float uMaxVelocity; // Speed the codes are fractions of
+
+void main() {
+    gl_Position = uProjection * vec4(aPosition * uDomainSize, 0.0, 1.0);
+    velocityMagnitude = aSpeed * uMaxVelocity;
     gl_PointSize = uParticleSize; // Scale the point size (to simulate the radius of a circle)
 }
 )";
@@ -112,8 +140,11 @@ void main(void) {
 /* ----- Improved Smoke-like ----- */
 const char* smokeLikeVertexSource = R"(
 #version 330 core
-layout(location = 0) in vec2 aPosition;
-layout(location = 1) in vec2 aVelocity;
+// Particles are uploaded as separate x / y / vx / vy arrays
+layout(location = 0) in float aPositionX;
+layout(location = 1) in float aPositionY;
+layout(location = 2) in float aVelocityX;
+layout(location = 3) in float aVelocityY;
 
 out float velocityMagnitude;
 out vec2 particlePos;
@@ -122,13 +153,37 @@ uniform mat4 uProjection;
 uniform float uParticleSize;
 
 void main() {
+    vec2 aPosition = vec2(aPositionX, aPositionY);
     gl_Position = uProjection * vec4(aPosition, 0.0, 1.0);
-    velocityMagnitude = length(aVelocity);
+    velocityMagnitude = length(vec2(aVelocityX, aVelocityY));
     particlePos = aPosition;
     gl_PointSize = uParticleSize * 2.0; // Increased size for more overlap
 }
 )";
 
+const char* compactSmokeLikeVertexSource = R"(
+#version 330 core
+// Compact vertex format, see compactVertexShaderSource
+layout(location = 0) in vec2 aPosition;
+layout(location = 1) in float aSpeed;
+
+out float velocityMagnitude;
+out vec2 particlePos;
+
+uniform mat4 uProjection;
+uniform float uParticleSize;
+uniform vec2 uDomainSize;
+uniform float uMaxVelocity;
+
+void main() {
+    vec2 position = aPosition * uDomainSize;
+    gl_Position = uProjection * vec4(position, 0.0, 1.0);
+    velocityMagnitude = aSpeed * uMaxVelocity;
+    particlePos = position;
+    gl_PointSize = uParticleSize * 2.0; // Increased size for more overlap
+}
+)";
+
 const char* smokeLikeFragmentSource = R"(
 #version 330 core
 in float velocityMagnitude;
@@ -232,7 +287,91 @@ void main() {
 }
 )";
 
-Renderer::Renderer(int width, int height) : width(width), height(height) {
+/* ----- Bloom chain, all drawn with blurVertexSource2 ----- */
+// Dual-Kawase downsample into a target of half the source size. The centre tap
+// averages the 2x2 source block under the pixel, the diagonal ones the blocks around it.
+const char* kawaseDownFragmentSource = R"(
+#version 330 core
+uniform sampler2D image;
+out vec4 FragColor;
+
+in vec2 TexCoord;
+
+void main() {
+    vec2 texel = 1.0 / textureSize(image, 0);
+    vec4 sum = texture(image, TexCoord) * 4.0;
+    sum += texture(image, TexCoord + vec2(-texel.x, -texel.y));
+    sum += texture(image, TexCoord + vec2( texel.x, -texel.y));
+    sum += texture(image, TexCoord + vec2(-texel.x,  texel.y));
+    sum += texture(image, TexCoord + vec2( texel.x,  texel.y));
+    FragColor = sum * 0.125;
+}
+)";
+
+// Dual-Kawase upsample into a target of twice the source size
+const char* kawaseUpFragmentSource = R"(
+#version 330 core
+uniform sampler2D image;
+out vec4 FragColor;
+
+in vec2 TexCoord;
+
+void main() {
+    vec2 texel = 1.0 / textureSize(image, 0);
+    vec4 sum = texture(image, TexCoord + vec2(-texel.x, 0.0));
+    sum += texture(image, TexCoord + vec2(texel.x, 0.0));
+    sum += texture(image, TexCoord + vec2(0.0, -texel.y));
+    sum += texture(image, TexCoord + vec2(0.0, texel.y));
+    sum += texture(image, TexCoord + vec2(-0.5, -0.5) * texel) * 2.0;
+    sum += texture(image, TexCoord + vec2( 0.5, -0.5) * texel) * 2.0;
+    sum += texture(image, TexCoord + vec2(-0.5,  0.5) * texel) * 2.0;
+    sum += texture(image, TexCoord + vec2( 0.5,  0.5) * texel) * 2.0;
+    FragColor = sum / 12.0;
+}
+)";
+
+// One direction of the 9-tap Gaussian of blurFragmentSource. Each pair of
+// neighbouring taps is merged into one bilinear fetch between them, so 5 fetches do.
+const char* separableBlurFragmentSource = R"(
+#version 330 core
+uniform sampler2D image;
+uniform vec2 uDirection; // (1, 0) or (0, 1)
+out vec4 FragColor;
+
+in vec2 TexCoord;
+
+const float offset[3] = float[](0.0, 1.3846153846, 3.2307692308);
+const float weight[3] = float[](0.2270270270, 0.3162162162, 0.0702702703);
+
+void main() {
+    vec2 step = uDirection / textureSize(image, 0);
+    vec4 result = texture(image, TexCoord) * weight[0];
+    for (int i = 1; i < 3; ++i) {
+        result += texture(image, TexCoord + step * offset[i]) * weight[i];
+        result += texture(image, TexCoord - step * offset[i]) * weight[i];
+    }
+    FragColor = result;
+}
+)";
+
+// Adds the bloom to the scene and composites the result over the black screen
+const char* bloomCompositeFragmentSource = R"(
+#version 330 core
+uniform sampler2D scene;
+uniform sampler2D bloom;
+uniform float uBloomStrength;
+out vec4 FragColor;
+
+in vec2 TexCoord;
+
+void main() {
+    vec4 color = min(texture(scene, TexCoord) + texture(bloom, TexCoord) * uBloomStrength, vec4(1.0));
+    FragColor = vec4(color.rgb * color.a, 1.0);
+}
+)";
+
+Renderer::Renderer(int width, int height, VertexFormat vertexFormat, const std::string& shaderCacheDirectory)
+    : width(width), height(height), vertexFormat(vertexFormat) {
     window = glfwCreateWindow(width, height, "Fluid Simulation", nullptr, nullptr);
     if (!window) {
         throw std::runtime_error("Failed to create GLFW window");
@@ -240,6 +379,8 @@ Renderer::Renderer(int width, int height) : width(width), height(height) {
     glfwMakeContextCurrent(window);
     if (glewInit() != GLEW_OK)
         throw std::runtime_error("Failed to initialize GLEW");
+    gpuTimer.emplace();
+    shaderCache.emplace(shaderCacheDirectory);
     glViewport(0, 0, width, height);
 
     glEnable(GL_PROGRAM_POINT_SIZE);
@@ -247,20 +388,36 @@ Renderer::Renderer(int width, int height) : width(width), height(height) {
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     // Create shaders and program
-    shaderProgram = createProgram(vertexShaderSource, fragmentShaderSource);
-    // shaderProgram = createProgram(smokeLikeVertexSource, smokeLikeFragmentSource);
+    bool compact = vertexFormat != VertexFormat::Float32;
+    shaderProgram = shaderCache->createProgram(compact ? compactVertexShaderSource : vertexShaderSource,
+                                               fragmentShaderSource);
+    // shaderProgram = shaderCache->createProgram(compact ? compactSmokeLikeVertexSource : smokeLikeVertexSource, smokeLikeFragmentSource);
+    if (compact) {
+        packKernel = getCompactPackKernel(vertexFormat, detectSimdLevel());
+    }
+    compositeShader = shaderCache->createProgram(blurVertexSource2, bloomCompositeFragmentSource);
 
-    // gaussianBlurShader = createProgram(blurVertexSource, blurFragmentSource);
-    // gaussianBlurShader = createProgram(blurVertexSource, blurSmokeLikeFragmentSource);
-    gaussianBlurShader = createProgram(blurVertexSource2, blurFragmentSource2);
+    // Uniforms that never change are set once, the rest is looked up once
+    float particleSize = 10.0f; // Increased particle size for more overlap
+    glm::mat4 projection = glm::ortho(0.0f, (float)width, 0.0f, (float)height);
+    glUseProgram(shaderProgram);
+    glUniform1f(glGetUniformLocation(shaderProgram, "uParticleSize"), particleSize);
+    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "uProjection"), 1, GL_FALSE, &projection[0][0]);
+    glUniform2f(glGetUniformLocation(shaderProgram, "uDomainSize"), (float)width, (float)height);
+    maxVelocityLoc = glGetUniformLocation(shaderProgram, "uMaxVelocity");
+    glUseProgram(compositeShader);
+    glUniform1i(glGetUniformLocation(compositeShader, "scene"), 0);
+    glUniform1i(glGetUniformLocation(compositeShader, "bloom"), 1);
+    bloomStrengthLoc = glGetUniformLocation(compositeShader, "uBloomStrength");
+    glUseProgram(0);
 
-    // Set up VAO and VBO
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
+    // Set up the streamed particle buffer
+    particleBuffer.emplace(vertexFormat);
 
     // Set up FBO
     // initFBO();
-    initPingPongFBO();
+    initSceneFBO();
+    initBloomPyramid();
 
     initFullscreenQuad();
 
@@ -300,13 +457,25 @@ Renderer::Renderer(int width, int height) : width(width), height(height) {
 }
 
 Renderer::~Renderer() {
-    glDeleteBuffers(1, &vbo);
-    glDeleteVertexArrays(1, &vao);
+    gpuTimer.reset();
+    particleBuffer.reset();
+    for (int level = 0; level < maxBloomLevels; ++level) {
+        for (const BloomTarget& target : { bloomLevels[level], bloomScratch[level] }) {
+            glDeleteFramebuffers(1, &target.fbo);
+            glDeleteTextures(1, &target.texture);
+        }
+    }
+    for (GLuint program : { kawaseDownShader, kawaseUpShader, separableBlurShader, compositeShader }) {
+        glDeleteProgram(program);
+    }
     glDeleteProgram(shaderProgram);
     glfwDestroyWindow(window);
 }
 
-void Renderer::render(const FluidSimulator& simulator) {
+void Renderer::render(const ParticleView& particles, const StepStats& stats) {
+    FLUID_PROFILE_SCOPE("render");
+    gpuTimer->beginFrame();
+
     // First clear the screen
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
@@ -319,75 +488,91 @@ void Renderer::render(const FluidSimulator& simulator) {
 
     // Render particles
     glUseProgram(shaderProgram);
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
-    // Set up uniforms
-    float particleSize = 10.0f; // Increased particle size for more overlap
-    GLuint particleSizeLoc = glGetUniformLocation(shaderProgram, "uParticleSize");
-    glUniform1f(particleSizeLoc, particleSize);
+    // The simulator gathered the maximum speed during its step, no extra pass here
+    float maxVelocity = std::max(stats.maxSpeed, 1e-5f);
+    glUniform1f(maxVelocityLoc, maxVelocity);
 
-    glm::mat4 projection = glm::ortho(0.0f, (float)width, 0.0f, (float)height);
-    GLuint projectionLoc = glGetUniformLocation(shaderProgram, "uProjection");
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, &projection[0][0]);
-
-    const std::vector<Particle>& particles = simulator.getParticles();
-    float maxVelocity = 0.0f;
-    for (const auto& particle : particles) {
-        float speed = std::sqrt(particle.vx * particle.vx + particle.vy * particle.vy);
-        maxVelocity = std::max(maxVelocity, speed);
+    GLint firstVertex;
+    {
+        FLUID_PROFILE_SCOPE("upload");
+        void* const* arrays = particleBuffer->beginUpload(particles.size());
+        if (packKernel && !particles.empty()) {
+            CompactPackParams params{ (float)width, (float)height, maxVelocity };
+            packKernel(particles, params, static_cast<uint32_t*>(arrays[0]), arrays[1], 0, particles.size());
+        } else if (!particles.empty()) {
+            writeVertexData(particles, arrays);
+        }
+        firstVertex = particleBuffer->endUpload();
     }
-    maxVelocity = std::max(maxVelocity, 1e-5f);
-    GLuint maxVelocityLoc = glGetUniformLocation(shaderProgram, "uMaxVelocity");
-    glUniform1f(maxVelocityLoc, maxVelocity);
 
-    glBufferData(GL_ARRAY_BUFFER, particles.size() * sizeof(Particle), particles.data(), GL_DYNAMIC_DRAW);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, x));
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Particle), (void*)offsetof(Particle, vx));
-    glEnableVertexAttribArray(1);
-    
     // Draw particles multiple times with slight offsets for more volume
     // for(int i = 0; i < 3; i++) {
     //     glDrawArrays(GL_POINTS, 0, particles.size());
     // }
-    glDrawArrays(GL_POINTS, 0, particles.size());
+    {
+        FLUID_PROFILE_SCOPE("draw particles");
+        FLUID_GPU_PROFILE_SCOPE(*gpuTimer, "gpu particles");
+        glDrawArrays(GL_POINTS, firstVertex, particles.size());
+    }
+    particleBuffer->fence();
 
-    // 2. Apply multiple blur passes
-    glUseProgram(gaussianBlurShader);
+    // 2. Bloom: halve the scene down the pyramid, blur the smallest level in two
+    // separable passes, then upsample back to the first level. Every pass replaces
+    // its target, so blending stays off until the next frame's particles.
+    glDisable(GL_BLEND);
     glBindVertexArray(quadVAO);
+    const int levels = std::clamp(bloom.levels, 0, maxBloomLevels);
+    {
+        FLUID_PROFILE_SCOPE("bloom");
+        FLUID_GPU_PROFILE_SCOPE(*gpuTimer, "gpu bloom");
+        if (levels > 0) {
+            if (!kawaseDownShader) createBloomPrograms();
+            glUseProgram(kawaseDownShader);
+            GLuint source = fboTexture1;
+            for (int level = 0; level < levels; ++level) {
+                drawBloomPass(bloomLevels[level], source);
+                source = bloomLevels[level].texture;
+            }
+
+            glUseProgram(separableBlurShader);
+            glUniform2f(blurDirectionLoc, 1.0f, 0.0f);
+            drawBloomPass(bloomScratch[levels - 1], bloomLevels[levels - 1].texture);
+            glUniform2f(blurDirectionLoc, 0.0f, 1.0f);
+            drawBloomPass(bloomLevels[levels - 1], bloomScratch[levels - 1].texture);
+
+            glUseProgram(kawaseUpShader);
+            for (int level = levels - 2; level >= 0; --level) {
+                drawBloomPass(bloomLevels[level], bloomLevels[level + 1].texture);
+            }
+        }
+    }
 
-    const int blurPasses = 0; // Increased blur passes
-    GLuint currentFBO = fbo2;
-    GLuint currentTexture = fboTexture1;
-
-    for (int i = 0; i < blurPasses * 2; i++) {
-        glBindFramebuffer(GL_FRAMEBUFFER, currentFBO);
-
-        glUniform1i(glGetUniformLocation(gaussianBlurShader, "image"), 0);
+    // 3. Final render to screen
+    {
+        FLUID_PROFILE_SCOPE("composite");
+        FLUID_GPU_PROFILE_SCOPE(*gpuTimer, "gpu composite");
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, width, height);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        glUseProgram(compositeShader);
+        glUniform1f(bloomStrengthLoc, levels > 0 ? bloom.strength : 0.0f);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, levels > 0 ? bloomLevels[0].texture : fboTexture1);
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, currentTexture);
-
+        glBindTexture(GL_TEXTURE_2D, fboTexture1);
         glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-        // Swap FBOs and textures
-        currentFBO = (currentFBO == fbo2) ? fbo1 : fbo2;
-        currentTexture = (currentTexture == fboTexture1) ? fboTexture2 : fboTexture1;
     }
 
-    // 3. Final render to screen
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glClear(GL_COLOR_BUFFER_BIT);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, currentTexture);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
     // Cleanup
     glBindVertexArray(0);
     glUseProgram(0);
 
-    glfwSwapBuffers(window);
+    {
+        FLUID_PROFILE_SCOPE("swap");
+        glfwSwapBuffers(window);
+    }
     glfwPollEvents();
 }
 
@@ -395,43 +580,15 @@ GLFWwindow* Renderer::getWindow() const {
     return window;
 }
 
-GLuint Renderer::createShader(const char* source, GLenum type) {
-    GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, &source, nullptr);
-    glCompileShader(shader);
-
-    GLint success;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        char infoLog[512];
-        glGetShaderInfoLog(shader, 512, nullptr, infoLog);
-        throw std::runtime_error("Shader compilation failed: " + std::string(infoLog));
-    }
-
-    return shader;
-}
-
-GLuint Renderer::createProgram(const char* vertexSrc, const char* fragmentSrc) {
-    GLuint vertexShader = createShader(vertexSrc, GL_VERTEX_SHADER);
-    GLuint fragmentShader = createShader(fragmentSrc, GL_FRAGMENT_SHADER);
-
-    GLuint program = glCreateProgram();
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
-    glLinkProgram(program);
-
-    GLint success;
-    glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if (!success) {
-        char infoLog[512];
-        glGetProgramInfoLog(program, 512, nullptr, infoLog);
-        throw std::runtime_error("Shader program linking failed: " + std::string(infoLog));
+void Renderer::createBloomPrograms() {
+    kawaseDownShader = shaderCache->createProgram(blurVertexSource2, kawaseDownFragmentSource);
+    kawaseUpShader = shaderCache->createProgram(blurVertexSource2, kawaseUpFragmentSource);
+    separableBlurShader = shaderCache->createProgram(blurVertexSource2, separableBlurFragmentSource);
+    for (GLuint program : { kawaseDownShader, kawaseUpShader, separableBlurShader }) {
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "image"), 0);
     }
-
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
-
-    return program;
+    blurDirectionLoc = glGetUniformLocation(separableBlurShader, "uDirection");
 }
 
 void Renderer::initFBO() {
@@ -468,8 +625,7 @@ void Renderer::initFBO() {
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void Renderer::initPingPongFBO() {
-    /* ----- FBO 1 ----- */
+void Renderer::initSceneFBO() {
     // Generate and bind FBO
     glGenFramebuffers(1, &fbo1);
     glBindFramebuffer(GL_FRAMEBUFFER, fbo1);
@@ -488,26 +644,49 @@ void Renderer::initPingPongFBO() {
     // Attach the texture to the FBO as the color attachment
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fboTexture1, 0);
 
-    /* ----- FBO 2 ----- */
-    // Generate and bind FBO
-    glGenFramebuffers(1, &fbo2);
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo2);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-    // Generate and bind texture
-    glGenTextures(1, &fboTexture2);
-    glBindTexture(GL_TEXTURE_2D, fboTexture2);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+void Renderer::initBloomPyramid() {
+    // Every level is allocated so bloom.levels can change between frames. Together
+    // the levels have a third as many pixels as the screen, and as many again for scratch.
+    for (int level = 0; level < maxBloomLevels; ++level) {
+        int levelWidth = bloomLevelSize(width, level), levelHeight = bloomLevelSize(height, level);
+        bloomLevels[level] = createBloomTarget(levelWidth, levelHeight);
+        bloomScratch[level] = createBloomTarget(levelWidth, levelHeight);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-    // Set texture parameters
+Renderer::BloomTarget Renderer::createBloomTarget(int targetWidth, int targetHeight) {
+    BloomTarget target;
+    target.width = targetWidth;
+    target.height = targetHeight;
+
+    // Half floats, so the faint tails of the blur do not band
+    glGenTextures(1, &target.texture);
+    glBindTexture(GL_TEXTURE_2D, target.texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, targetWidth, targetHeight, 0, GL_RGBA, GL_FLOAT, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-    // Attach the texture to the FBO as the color attachment
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fboTexture2, 0);
+    glGenFramebuffers(1, &target.fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        throw std::runtime_error("Bloom framebuffer is not complete");
+    }
+    return target;
+}
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+void Renderer::drawBloomPass(const BloomTarget& target, GLuint sourceTexture) {
+    glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+    glViewport(0, 0, target.width, target.height);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, sourceTexture);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 }
 
 void Renderer::initFullscreenQuad() {
@@ -8,34 +8,67 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <optional>
 #include <stdexcept>
+#include <string>
 
-#include "FluidSimulator.hpp"
+#include "core/ParticleStorage.hpp"
+#include "core/StepStats.hpp"
+#include "core/RenderData.hpp"
+#include "GpuTimer.hpp"
+#include "ShaderCache.hpp"
+#include "StreamingVertexBuffer.hpp"
 
 
 class Renderer {
 public:
-    Renderer(int width, int height);
+    // Compact vertex formats upload 5 or 6 bytes per particle instead of 16. Linked
+    // shader programs are cached in shaderCacheDirectory, none when empty.
+    Renderer(int width, int height, VertexFormat vertexFormat = VertexFormat::Float32,
+             const std::string& shaderCacheDirectory = "");
     ~Renderer();
-    void render(const FluidSimulator& simulator);
+    // stats must describe particles; the colour ramp is normalised by its maximum speed
+    void render(const ParticleView& particles, const StepStats& stats);
     GLFWwindow* getWindow() const;
+    const ShaderCache& getShaderCache() const { return *shaderCache; }
+
+    BloomSettings bloom;
 
 private:
+    struct BloomTarget {
+        GLuint fbo = 0, texture = 0;
+        int width = 0, height = 0;
+    };
+
     GLFWwindow* window;
     int width, height;
 
+    std::optional<ShaderCache> shaderCache; // Needs the GL context, created in the constructor
     GLuint shaderProgram;
-    GLuint vao, vbo;
+    GLint maxVelocityLoc;
+    VertexFormat vertexFormat;
+    CompactPackKernel packKernel = nullptr;
+    std::optional<StreamingVertexBuffer> particleBuffer;
 
     GLuint fbo, fboTexture, rbo;
-    GLuint fbo1, fboTexture1, fbo2, fboTexture2; // for multiple blur per frame
+    GLuint fbo1, fboTexture1; // The particles are drawn here
     GLuint quadVAO, quadVBO;
-    GLuint gaussianBlurShader;
+
+    // Bloom pyramid, level 0 at half resolution, each with a same-sized target for
+    // the first direction of the separable blur. Its programs are only built by the
+    // first frame with bloom on.
+    BloomTarget bloomLevels[maxBloomLevels], bloomScratch[maxBloomLevels];
+    GLuint kawaseDownShader = 0, kawaseUpShader = 0, separableBlurShader = 0;
+    GLuint compositeShader;
+    GLint blurDirectionLoc, bloomStrengthLoc;
+
+    std::optional<GpuTimer> gpuTimer; // Needs the GL context, created in the constructor
 
     void initFBO();
-    void initPingPongFBO(); // for multiple blur per frame
+    void initSceneFBO();
+    void initBloomPyramid();
     void initFullscreenQuad();
-
-    GLuint createShader(const char* source, GLenum type);
-    GLuint createProgram(const char* vertexSrc, const char* fragmentSrc);
+    BloomTarget createBloomTarget(int targetWidth, int targetHeight);
+    void drawBloomPass(const BloomTarget& target, GLuint sourceTexture);
+    void createBloomPrograms();
 };
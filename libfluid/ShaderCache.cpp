@@ -0,0 +1,189 @@
+#include "ShaderCache.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr char cacheMagic[4] = { 'F', 'L', 'S', 'P' };
+constexpr uint32_t cacheVersion = 1;
+
+struct CacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t key;        // Also the file name, guards against a renamed or truncated file
+    uint32_t format;     // binaryFormat of glGetProgramBinary
+    uint32_t length;     // Bytes of binary that follow
+};
+
+// FNV-1a, continuing from hash; the terminating zero is included so that
+// concatenated strings cannot alias
+uint64_t hashString(uint64_t hash, const char* text) {
+    if (!text) text = "";
+    do {
+        hash ^= static_cast<unsigned char>(*text);
+        hash *= 0x100000001B3ull;
+    } while (*text++);
+    return hash;
+}
+
+// Unique to this process and store, so writers filling the same cache never share one
+std::string temporaryPath(const std::string& path) {
+    static std::atomic<uint32_t> sequence{ 0 };
+#ifdef _WIN32
+    long long processId = _getpid();
+#else
+    long long processId = getpid();
+#endif
+    return path + "." + std::to_string(processId) + "." + std::to_string(sequence++) + ".tmp";
+}
+
+GLuint compileShader(const char* source, GLenum type) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+
+    GLint success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        char infoLog[512];
+        glGetShaderInfoLog(shader, 512, nullptr, infoLog);
+        glDeleteShader(shader);
+        throw std::runtime_error("Shader compilation failed: " + std::string(infoLog));
+    }
+    return shader;
+}
+
+} // namespace
+
+ShaderCache::ShaderCache(std::string directory) : directory(std::move(directory)) {
+    GLint formats = 0;
+    if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    }
+    enabled = formats > 0 && !this->directory.empty();
+
+    driverHash = 0xCBF29CE484222325ull;
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+        driverHash = hashString(driverHash, reinterpret_cast<const char*>(glGetString(name)));
+    }
+}
+
+std::string ShaderCache::pathFor(uint64_t key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(key));
+    return (std::filesystem::path(directory) / name).string();
+}
+
+GLuint ShaderCache::createProgram(const char* vertexSource, const char* fragmentSource) {
+    uint64_t key = hashString(hashString(driverHash, vertexSource), fragmentSource);
+    std::string path = enabled ? pathFor(key) : std::string();
+    if (enabled) {
+        if (GLuint program = load(path, key)) {
+            ++hits;
+            return program;
+        }
+        ++misses;
+    }
+
+    GLuint vertexShader = compileShader(vertexSource, GL_VERTEX_SHADER);
+    GLuint fragmentShader;
+    try {
+        fragmentShader = compileShader(fragmentSource, GL_FRAGMENT_SHADER);
+    } catch (...) {
+        glDeleteShader(vertexShader);
+        throw;
+    }
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    if (enabled) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    GLint success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        char infoLog[512];
+        glGetProgramInfoLog(program, 512, nullptr, infoLog);
+        glDeleteProgram(program);
+        throw std::runtime_error("Shader program linking failed: " + std::string(infoLog));
+    }
+
+    if (enabled) store(program, path, key);
+    return program;
+}
+
+GLuint ShaderCache::load(const std::string& path, uint64_t key) const {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) return 0;
+    CacheHeader header{};
+    std::vector<unsigned char> binary;
+    bool valid = std::fread(&header, sizeof(header), 1, file) == 1 &&
+                 std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) == 0 &&
+                 header.version == cacheVersion && header.key == key && header.length > 0;
+    if (valid) {
+        binary.resize(header.length);
+        valid = std::fread(binary.data(), 1, binary.size(), file) == binary.size();
+    }
+    std::fclose(file);
+    if (!valid) return 0;
+
+    // A driver may still refuse a binary it wrote, after an update that kept its
+    // version string; that shows as a failed link
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.format, binary.data(), static_cast<GLsizei>(binary.size()));
+    GLint success = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+void ShaderCache::store(GLuint program, const std::string& path, uint64_t key) const {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+    std::vector<unsigned char> binary(static_cast<size_t>(length));
+    GLenum format = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &format, binary.data());
+    if (written <= 0) return;
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) return;
+
+    // Written under a temporary name first, so another instance never reads half a file
+    CacheHeader header{};
+    std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = cacheVersion;
+    header.key = key;
+    header.format = format;
+    header.length = static_cast<uint32_t>(written);
+    std::string temporary = temporaryPath(path);
+    std::FILE* file = std::fopen(temporary.c_str(), "wb");
+    if (!file) return;
+    bool complete = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                    std::fwrite(binary.data(), 1, static_cast<size_t>(written), file) == static_cast<size_t>(written);
+    complete = std::fclose(file) == 0 && complete;
+    if (complete) std::filesystem::rename(temporary, path, error);
+    if (!complete || error) std::remove(temporary.c_str());
+}
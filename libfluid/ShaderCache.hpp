@@ -0,0 +1,37 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstdint>
+#include <string>
+
+// Linked shader programs kept on disk as glGetProgramBinary blobs, so that later
+// launches skip compiling and linking. A program's file is named by a hash of its two
+// sources and the GL vendor, renderer and version strings, so an edited shader or a
+// driver update looks for another file; a binary the driver still rejects is compiled
+// from source again and overwritten. Reading or writing the cache never fails a
+// program, and files are replaced atomically. Needs ARB_get_program_binary and at
+// least one binary format, and only compiles without them or without a directory.
+class ShaderCache {
+public:
+    // Needs a current GL context. The directory is created on the first store.
+    explicit ShaderCache(std::string directory);
+
+    // Linked program of the two sources, loaded or compiled. Throws std::runtime_error
+    // with the driver's log when compiling or linking fails.
+    GLuint createProgram(const char* vertexSource, const char* fragmentSource);
+
+    bool isEnabled() const { return enabled; }
+    int getHits() const { return hits; }     // Programs loaded from disk
+    int getMisses() const { return misses; } // Programs compiled, with the cache enabled
+
+private:
+    std::string directory;
+    bool enabled = false;
+    uint64_t driverHash = 0;
+    int hits = 0, misses = 0;
+
+    std::string pathFor(uint64_t key) const;
+    GLuint load(const std::string& path, uint64_t key) const;
+    void store(GLuint program, const std::string& path, uint64_t key) const;
+};
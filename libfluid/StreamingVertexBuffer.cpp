@@ -0,0 +1,147 @@
+#include "StreamingVertexBuffer.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+constexpr GLbitfield persistentFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+constexpr GLuint64 fenceTimeout = 1000000000; // One second, in nanoseconds
+constexpr size_t arrayAlignment = 256;
+
+} // namespace
+
+StreamingVertexBuffer::StreamingVertexBuffer(VertexFormat format)
+    : format(format), persistent(GLEW_ARB_buffer_storage) {
+    glGenVertexArrays(1, &vao);
+}
+
+StreamingVertexBuffer::~StreamingVertexBuffer() {
+    for (int i = 0; i < regionCount; ++i) {
+        if (fences[i]) glDeleteSync(fences[i]);
+    }
+    if (vbo) {
+        if (mapped) {
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+        }
+        glDeleteBuffers(1, &vbo);
+    }
+    glDeleteVertexArrays(1, &vao);
+}
+
+void StreamingVertexBuffer::waitForRegion(int index) {
+    if (!fences[index]) return;
+    while (true) {
+        GLenum result = glClientWaitSync(fences[index], GL_SYNC_FLUSH_COMMANDS_BIT, fenceTimeout);
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) break;
+        if (result == GL_WAIT_FAILED) {
+            throw std::runtime_error("Waiting for a vertex buffer fence failed");
+        }
+    }
+    glDeleteSync(fences[index]);
+    fences[index] = nullptr;
+}
+
+void StreamingVertexBuffer::setAttributes() {
+    if (format == VertexFormat::Float32) {
+        for (GLuint a = 0; a < 4; ++a) {
+            glVertexAttribPointer(a, 1, GL_FLOAT, GL_FALSE, 0, (void*)arrayOffsets[a]);
+            glEnableVertexAttribArray(a);
+        }
+        return;
+    }
+    // Packed 16-bit x / y, then the speed code; both read back as [0, 1]
+    GLenum speedType = format == VertexFormat::Compact16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+    glVertexAttribPointer(0, 2, GL_UNSIGNED_SHORT, GL_TRUE, 0, (void*)arrayOffsets[0]);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 1, speedType, GL_TRUE, 0, (void*)arrayOffsets[1]);
+    glEnableVertexAttribArray(1);
+}
+
+void StreamingVertexBuffer::reallocate(size_t count) {
+    // Grow by half again so a slowly rising particle count does not reallocate every frame
+    capacity = std::max(count, capacity + capacity / 2);
+
+    if (vbo) {
+        for (int i = 0; i < regionCount; ++i) {
+            waitForRegion(i);
+        }
+        if (mapped) {
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            mapped = nullptr;
+        }
+        glDeleteBuffers(1, &vbo);
+    }
+
+    size_t slots = persistent ? regionCount : 1;
+    bufferBytes = 0;
+    for (size_t a = 0; a < vertexArrayCount(format); ++a) {
+        arrayOffsets[a] = bufferBytes;
+        size_t bytes = slots * capacity * vertexElementBytes(format, a);
+        bufferBytes += (bytes + arrayAlignment - 1) / arrayAlignment * arrayAlignment;
+    }
+
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    if (persistent) {
+        glBufferStorage(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(bufferBytes), nullptr, persistentFlags);
+        mapped = static_cast<unsigned char*>(
+            glMapBufferRange(GL_ARRAY_BUFFER, 0, static_cast<GLsizeiptr>(bufferBytes), persistentFlags));
+        if (!mapped) {
+            throw std::runtime_error("Failed to map the particle vertex buffer");
+        }
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(bufferBytes), nullptr, GL_STREAM_DRAW);
+        staging.resize(bufferBytes);
+    }
+
+    // Attribute pointers only change with the buffer itself
+    setAttributes();
+}
+
+void* const* StreamingVertexBuffer::beginUpload(size_t count) {
+    glBindVertexArray(vao);
+    uploadCount = count;
+    if (count == 0) return destinations;
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    if (count > capacity) {
+        reallocate(count);
+    }
+
+    unsigned char* base = staging.data();
+    size_t first = 0;
+    if (persistent) {
+        region = (region + 1) % regionCount;
+        waitForRegion(region);
+        base = mapped;
+        first = region * capacity;
+    }
+    for (size_t a = 0; a < vertexArrayCount(format); ++a) {
+        destinations[a] = base + arrayOffsets[a] + first * vertexElementBytes(format, a);
+    }
+    return destinations;
+}
+
+GLint StreamingVertexBuffer::endUpload() {
+    if (uploadCount == 0) return 0;
+    if (persistent) {
+        // Coherent mapping, the writes are visible to the next draw as they are
+        return static_cast<GLint>(region * capacity);
+    }
+
+    // Orphan, so the driver can hand out fresh storage while the GPU reads the old one
+    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(bufferBytes), nullptr, GL_STREAM_DRAW);
+    for (size_t a = 0; a < vertexArrayCount(format); ++a) {
+        glBufferSubData(GL_ARRAY_BUFFER, static_cast<GLintptr>(arrayOffsets[a]),
+                        static_cast<GLsizeiptr>(uploadCount * vertexElementBytes(format, a)),
+                        staging.data() + arrayOffsets[a]);
+    }
+    return 0;
+}
+
+void StreamingVertexBuffer::fence() {
+    if (!persistent || uploadCount == 0) return;
+    if (fences[region]) glDeleteSync(fences[region]);
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <vector>
+
+#include "core/RenderData.hpp"
+
+// Particle vertex buffer streamed anew every frame. With ARB_buffer_storage it is a
+// ring of regions in one persistently mapped buffer: each frame writes the next
+// region straight into the mapping and fences it after the draw, so the CPU only
+// waits if the GPU is still reading that region from regionCount frames ago.
+// Without it, vertices are written to a staging copy and a single region is orphaned
+// and refilled with glBufferSubData.
+//
+// Each vertex array of the format owns one contiguous block spanning all regions,
+// so the attribute pointers are fixed for a given capacity and a region is selected
+// through the first vertex of the draw call.
+class StreamingVertexBuffer {
+public:
+    static constexpr int regionCount = 3;
+
+    explicit StreamingVertexBuffer(VertexFormat format);
+    ~StreamingVertexBuffer();
+
+    StreamingVertexBuffer(const StreamingVertexBuffer&) = delete;
+    StreamingVertexBuffer& operator=(const StreamingVertexBuffer&) = delete;
+
+    // Binds the VAO and returns where this frame's count vertices go, one pointer per
+    // vertex array of the format. Fill them, then call endUpload.
+    void* const* beginUpload(size_t count);
+
+    // Returns the first vertex to pass to glDrawArrays
+    GLint endUpload();
+
+    // Call after the draw calls reading the last upload
+    void fence();
+
+    VertexFormat getFormat() const { return format; }
+    bool isPersistent() const { return persistent; }
+
+private:
+    VertexFormat format;
+    GLuint vao = 0, vbo = 0;
+    bool persistent;
+    size_t capacity = 0; // Vertices per region
+    size_t arrayOffsets[maxVertexArrays] = {};
+    size_t bufferBytes = 0;
+    unsigned char* mapped = nullptr;
+    std::vector<unsigned char> staging; // Fallback path only
+    void* destinations[maxVertexArrays] = {};
+    size_t uploadCount = 0;
+    GLsync fences[regionCount] = {};
+    int region = 0;
+
+    void reallocate(size_t count);
+    void waitForRegion(int index);
+    void setAttributes();
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+
+// Debug check that the steady-state frame loop leaves the heap alone. Built with
+// FLUID_ALLOCATION_AUDIT defined, the library replaces the global operator new and
+// delete: every allocation is counted, and one made on a thread inside a
+// NoAllocationScope prints its size and aborts, so a debugger or core dump shows the
+// stack that allocated. ThreadPool carries the scope over to the workers running the
+// loops of a thread inside one. Without the define the scope does nothing and the
+// count stays 0.
+#ifdef FLUID_ALLOCATION_AUDIT
+constexpr bool allocationAuditEnabled = true;
+#else
+constexpr bool allocationAuditEnabled = false;
+#endif
+
+class AllocationAudit {
+public:
+    // Calls of operator new so far, on every thread
+    static uint64_t allocationCount();
+    // Whether the calling thread is inside a NoAllocationScope
+    static bool forbidden();
+
+private:
+    static void enter();
+    static void leave();
+
+    friend class NoAllocationScope;
+};
+
+class NoAllocationScope {
+public:
+    explicit NoAllocationScope(bool active = true) : active(allocationAuditEnabled && active) {
+        if (this->active) AllocationAudit::enter();
+    }
+    ~NoAllocationScope() {
+        if (active) AllocationAudit::leave();
+    }
+
+    NoAllocationScope(const NoAllocationScope&) = delete;
+    NoAllocationScope& operator=(const NoAllocationScope&) = delete;
+
+private:
+    bool active;
+};
+
+#ifndef FLUID_ALLOCATION_AUDIT
+inline uint64_t AllocationAudit::allocationCount() { return 0; }
+inline bool AllocationAudit::forbidden() { return false; }
+inline void AllocationAudit::enter() {}
+inline void AllocationAudit::leave() {}
+#endif
@@ -0,0 +1,227 @@
+#include "Checkpoint.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <type_traits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static_assert(std::is_trivially_copyable_v<CheckpointHeader>, "The header is written and mapped as raw bytes");
+
+namespace {
+
+constexpr size_t sectionAlignment = 64;
+
+size_t alignUp(size_t value) {
+    return (value + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+}
+
+void writeAll(std::FILE* file, const void* data, size_t bytes, const std::string& path) {
+    if (bytes && std::fwrite(data, 1, bytes, file) != bytes) {
+        throw std::runtime_error("Failed to write checkpoint " + path);
+    }
+}
+
+} // namespace
+
+Checkpoint::Checkpoint(const std::string& path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Cannot open checkpoint " + path);
+    }
+    fileHandle = file;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(CheckpointHeader))) {
+        CloseHandle(file);
+        throw std::runtime_error("Checkpoint " + path + " is too small");
+    }
+    size = static_cast<size_t>(fileSize.QuadPart);
+    mappingHandle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    data = mappingHandle ? MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!data) {
+        if (mappingHandle) CloseHandle(mappingHandle);
+        CloseHandle(file);
+        throw std::runtime_error("Cannot map checkpoint " + path);
+    }
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open checkpoint " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(CheckpointHeader)) {
+        close(fd);
+        throw std::runtime_error("Checkpoint " + path + " is too small");
+    }
+    size = static_cast<size_t>(info.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file alive
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Cannot map checkpoint " + path);
+    }
+    // The arrays are read front to back exactly once, start reading ahead right away
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    madvise(mapping, size, MADV_WILLNEED);
+    data = mapping;
+#endif
+
+    try {
+        validate(path);
+    } catch (...) {
+        unmap();
+        throw;
+    }
+}
+
+Checkpoint::~Checkpoint() {
+    unmap();
+}
+
+void Checkpoint::unmap() {
+    if (!data) return;
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle(mappingHandle);
+    CloseHandle(fileHandle);
+#else
+    munmap(const_cast<void*>(data), size);
+#endif
+    data = nullptr;
+}
+
+void Checkpoint::validate(const std::string& path) const {
+    const CheckpointHeader& header = getHeader();
+    const CheckpointHeader reference;
+    if (std::memcmp(header.magic, reference.magic, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(path + " is not a checkpoint file");
+    }
+    if (header.byteOrder != reference.byteOrder) {
+        throw std::runtime_error("Checkpoint " + path + " was written with a different byte order");
+    }
+    if (header.version != checkpointVersion || header.headerBytes != sizeof(CheckpointHeader)) {
+        throw std::runtime_error("Checkpoint " + path + " has unsupported version " + std::to_string(header.version));
+    }
+    if (header.fileBytes != size) {
+        throw std::runtime_error("Checkpoint " + path + " is truncated");
+    }
+    for (const CheckpointSectionEntry& section : header.sections) {
+        if (section.id == 0) continue;
+        if (section.offset % sectionAlignment != 0 || section.offset > size || section.bytes > size - section.offset) {
+            throw std::runtime_error("Checkpoint " + path + " has a corrupt section table");
+        }
+    }
+}
+
+const void* Checkpoint::findBytes(CheckpointSection id, size_t& bytes) const {
+    for (const CheckpointSectionEntry& section : getHeader().sections) {
+        if (section.id == static_cast<uint32_t>(id)) {
+            bytes = static_cast<size_t>(section.bytes);
+            return static_cast<const char*>(data) + section.offset;
+        }
+    }
+    bytes = 0;
+    return nullptr;
+}
+
+const float* Checkpoint::findSection(CheckpointSection id, size_t& count) const {
+    size_t bytes = 0;
+    const void* payload = findBytes(id, bytes);
+    count = bytes / sizeof(float);
+    return static_cast<const float*>(payload);
+}
+
+const uint32_t* Checkpoint::findIndexSection(CheckpointSection id, size_t& count) const {
+    size_t bytes = 0;
+    const void* payload = findBytes(id, bytes);
+    count = bytes / sizeof(uint32_t);
+    return static_cast<const uint32_t*>(payload);
+}
+
+void Checkpoint::write(const std::string& path, CheckpointHeader header, const std::vector<Payload>& payloads) {
+    if (payloads.size() > CheckpointHeader::maxSections) {
+        throw std::invalid_argument("Too many checkpoint sections");
+    }
+
+    size_t offset = alignUp(sizeof(CheckpointHeader));
+    for (size_t i = 0; i < CheckpointHeader::maxSections; ++i) {
+        header.sections[i] = {};
+        if (i >= payloads.size()) continue;
+        header.sections[i].id = static_cast<uint32_t>(payloads[i].id);
+        header.sections[i].offset = offset;
+        header.sections[i].bytes = payloads[i].bytes;
+        offset = alignUp(offset + payloads[i].bytes);
+    }
+    header.fileBytes = offset;
+
+    std::string temporary = path + ".tmp";
+    std::FILE* file = std::fopen(temporary.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("Cannot create checkpoint " + temporary);
+    }
+    try {
+        static const char padding[sectionAlignment] = {};
+        size_t written = 0;
+        auto pad = [&](size_t target) {
+            writeAll(file, padding, target - written, temporary);
+            written = target;
+        };
+        writeAll(file, &header, sizeof(header), temporary);
+        written = sizeof(header);
+        for (size_t i = 0; i < payloads.size(); ++i) {
+            pad(header.sections[i].offset);
+            writeAll(file, payloads[i].data, payloads[i].bytes, temporary);
+            written += payloads[i].bytes;
+        }
+        pad(header.fileBytes);
+
+        // On disk before the rename makes it visible under the real name, or the last
+        // good checkpoint is left alone
+#ifdef _WIN32
+        bool synced = std::fflush(file) == 0 && _commit(_fileno(file)) == 0;
+#else
+        bool synced = std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+#endif
+        if (!synced) {
+            throw std::runtime_error("Failed to flush checkpoint " + temporary + " to disk");
+        }
+    } catch (...) {
+        std::fclose(file);
+        std::remove(temporary.c_str());
+        throw;
+    }
+    if (std::fclose(file) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Failed to write checkpoint " + temporary);
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Cannot replace checkpoint " + path + ": " + error.message());
+    }
+#ifndef _WIN32
+    // The rename itself is only durable once the directory entry is
+    std::filesystem::path directory = std::filesystem::path(path).parent_path();
+    int directoryFd = open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY);
+    bool directorySynced = directoryFd >= 0 && fsync(directoryFd) == 0;
+    if (directoryFd >= 0) close(directoryFd);
+    if (!directorySynced) {
+        throw std::runtime_error("Failed to flush the directory of checkpoint " + path + " to disk");
+    }
+#endif
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Binary checkpoint file: a fixed header followed by raw, 64-byte aligned sections.
+// Everything is stored in the writer's native layout; the header records the byte
+// order, and a file written on a machine of the other endianness is rejected.
+// Files are written to a temporary next to the target, flushed to disk and renamed
+// over it, so a crash never leaves a half-written checkpoint behind, and a failed
+// flush throws before the last good one is replaced.
+constexpr uint32_t checkpointVersion = 4;
+
+enum class CheckpointSection : uint32_t {
+    None = 0,
+    PositionX, PositionY, VelocityX, VelocityY, // Particle arrays, one float per particle
+    GridU, GridV, GridPressure,                 // Grid mode field state
+    ParticleId,                                 // uint32_t per particle, present once storage was reordered
+    FreeParticleId,                             // IDs of removed particles, next to be reused last
+    LifeLeft,                                   // Seconds per particle, present once one has a lifetime
+};
+
+struct CheckpointSectionEntry {
+    uint32_t id = 0;      // CheckpointSection
+    uint32_t reserved = 0;
+    uint64_t offset = 0;  // From the start of the file
+    uint64_t bytes = 0;
+};
+
+struct CheckpointHeader {
+    static constexpr size_t maxSections = 16;
+
+    char magic[8] = { 'F', 'L', 'U', 'I', 'D', 'C', 'K', 'P' };
+    uint32_t version = checkpointVersion;
+    uint32_t headerBytes = sizeof(CheckpointHeader);
+    uint32_t byteOrder = 0x01020304;
+    uint32_t mode = 0; // SolverMode
+    int32_t width = 0, height = 0;
+    uint64_t particleCount = 0;
+    uint64_t particleCapacity = 0;
+    uint64_t particleIdCount = 0; // IDs handed out, of live and removed particles
+    uint64_t fileBytes = 0;
+
+    // Simulator settings
+    float interactionRadius = 0.0f, maxSpeed = 0.0f;
+    uint32_t interactionsEnabled = 0;
+    float interactionStrength = 0.0f, interactionDamping = 0.0f, maxInteractionForce = 0.0f;
+    uint32_t integrator = 0, boundary = 0; // Integrator, Boundary
+    float damping = 0.0f, gravity = 0.0f;
+    uint64_t spawnSequence = 0; // Position in the emitters' random sequence
+
+    // SphParams, with the calibrated rest density
+    float sphSmoothingLength = 0.0f, sphRestDensity = 0.0f, sphStiffness = 0.0f;
+    float sphViscosity = 0.0f, sphCourant = 0.0f, sphMass = 0.0f;
+
+    // GridParams
+    int32_t gridResolutionX = 0;
+    float gridGravity = 0.0f, gridDissipation = 0.0f;
+    int32_t gridMaxVCycles = 0;
+    float gridTolerance = 0.0f;
+    int32_t gridSmoothingSweeps = 0;
+
+    CheckpointSectionEntry sections[maxSections];
+};
+
+// Read-only memory mapping of a checkpoint file, validated on open. Mapping spares
+// the read calls and any parsing, but readers that own their arrays still copy the
+// sections out of it.
+class Checkpoint {
+public:
+    // Throws std::runtime_error if the file cannot be mapped or is not a valid checkpoint
+    explicit Checkpoint(const std::string& path);
+    ~Checkpoint();
+
+    Checkpoint(const Checkpoint&) = delete;
+    Checkpoint& operator=(const Checkpoint&) = delete;
+
+    const CheckpointHeader& getHeader() const { return *static_cast<const CheckpointHeader*>(data); }
+
+    // Float payload of a section and its element count, or null if the file has none
+    const float* findSection(CheckpointSection id, size_t& count) const;
+    // Same for sections of uint32_t
+    const uint32_t* findIndexSection(CheckpointSection id, size_t& count) const;
+
+    struct Payload {
+        CheckpointSection id;
+        const void* data;
+        size_t bytes;
+    };
+
+    // Lays the sections out behind the header, filling in its section table and size
+    static void write(const std::string& path, CheckpointHeader header, const std::vector<Payload>& payloads);
+
+private:
+    const void* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+
+    void validate(const std::string& path) const;
+    const void* findBytes(CheckpointSection id, size_t& bytes) const;
+    void unmap();
+};
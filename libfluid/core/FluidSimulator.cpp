@@ -0,0 +1,997 @@
+#include "FluidSimulator.hpp"
+#include "Profiler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+// Chunk sizes of the parallel passes. They fix the work split (and with it any
+// per-chunk result) independently of the thread count.
+constexpr size_t integrateGrain = 16384;
+constexpr size_t forceGrain = 512;
+
+constexpr float unlimitedLife = std::numeric_limits<float>::infinity();
+
+// splitmix64 finalizer, turns a counter into well mixed bits
+uint64_t mixBits(uint64_t value) {
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+}
+
+} // namespace
+
+FluidSimulator::FluidSimulator(int width, int height, const SimulatorConfig& config)
+    : width(width), height(height), mode(config.mode), pool(config.threadCount) {
+    if (mode == SolverMode::SPH) {
+        sph.emplace(config.sph);
+        integrator = Integrator::SemiImplicitEuler; // Explicit Euler gains energy on the stiff pressure response
+        boundary = Boundary::Clamp;
+        damping = 1.0f; // Viscosity does the damping
+    } else if (mode == SolverMode::Grid) {
+        gridSolver.emplace(width, height, config.grid);
+    }
+
+    // Initialize particles
+    float spacing = config.particleSpacing;
+    if (!(spacing > 0.0f)) {
+        throw std::invalid_argument("Particle spacing must be positive");
+    }
+    interactionRadius = 2.0f * spacing; // Reaches the lattice's nearest and diagonal neighbours
+    size_t columns = config.initialLattice ? static_cast<size_t>(std::ceil(width / spacing)) : 0;
+    size_t rows = config.initialLattice ? static_cast<size_t>(std::ceil(height / spacing)) : 0;
+    if (sph && rows == 0 && !(config.sph.restDensity > 0.0f)) {
+        throw std::invalid_argument("SPH needs an explicit rest density when the scene starts empty");
+    }
+    capacity = std::max(config.particleCapacity, columns * rows);
+    reserveStorage();
+    for (size_t row = 0; row < rows; ++row) {
+        for (size_t column = 0; column < columns; ++column) {
+            particles.push_back({ column * spacing, row * spacing, 0.0f, 0.0f });
+        }
+    }
+    if (!gridSolver) {
+        grid.build(particles.view(), neighborRadius(), width, height, pool);
+    }
+    if (sph) {
+        sph->calibrate(grid, pool);
+    }
+    awakeCount = particles.size();
+    collectStats();
+}
+
+void FluidSimulator::collectStats() {
+    statsCollector.setHistogram(statsHistogramBins, statsHistogramMaxSpeed);
+    statsCollector.begin(particles.size(), integrateGrain);
+    pool.parallelFor(particles.size(), integrateGrain, [&](size_t begin, size_t end) {
+        StatsPartial* partial = statsCollector.partialFor(begin);
+        for (size_t i = begin; i < end; ++i) {
+            partial->add(particles.x[i], particles.y[i], particles.vx[i], particles.vy[i]);
+        }
+    });
+    statsCollector.finish(stats);
+}
+
+FluidSimulator::FluidSimulator(const Checkpoint& checkpoint, unsigned threadCount)
+    : width(checkpoint.getHeader().width), height(checkpoint.getHeader().height),
+      mode(static_cast<SolverMode>(checkpoint.getHeader().mode)), pool(threadCount) {
+    const CheckpointHeader& header = checkpoint.getHeader();
+    if (width <= 0 || height <= 0 || header.mode > static_cast<uint32_t>(SolverMode::Grid)) {
+        throw std::runtime_error("Checkpoint describes an invalid scene");
+    }
+    interactionRadius = header.interactionRadius;
+    maxSpeed = header.maxSpeed;
+    interactionsEnabled = header.interactionsEnabled != 0;
+    interactionStrength = header.interactionStrength;
+    interactionDamping = header.interactionDamping;
+    maxInteractionForce = header.maxInteractionForce;
+    if (header.integrator > static_cast<uint32_t>(Integrator::VelocityVerlet) ||
+        header.boundary > static_cast<uint32_t>(Boundary::Open)) {
+        throw std::runtime_error("Checkpoint describes an invalid integrator");
+    }
+    integrator = static_cast<Integrator>(header.integrator);
+    boundary = static_cast<Boundary>(header.boundary);
+    damping = header.damping;
+    gravity = header.gravity;
+
+    if (mode == SolverMode::SPH) {
+        SphParams params;
+        params.smoothingLength = header.sphSmoothingLength;
+        params.restDensity = header.sphRestDensity;
+        params.stiffness = header.sphStiffness;
+        params.viscosity = header.sphViscosity;
+        params.courant = header.sphCourant;
+        params.mass = header.sphMass;
+        sph.emplace(params);
+    } else if (mode == SolverMode::Grid) {
+        GridParams params;
+        params.resolutionX = header.gridResolutionX;
+        params.gravity = header.gridGravity;
+        params.dissipation = header.gridDissipation;
+        params.maxVCycles = header.gridMaxVCycles;
+        params.tolerance = header.gridTolerance;
+        params.smoothingSweeps = header.gridSmoothingSweeps;
+        gridSolver.emplace(width, height, params);
+    }
+
+    // Straight copies out of the mapping; only the ID sections are checked per particle
+    size_t count = static_cast<size_t>(header.particleCount);
+    size_t idCount = static_cast<size_t>(header.particleIdCount);
+    capacity = std::max(static_cast<size_t>(header.particleCapacity), count);
+    if (idCount < count || idCount > capacity) {
+        throw std::runtime_error("Checkpoint particle ID count does not match its particle count");
+    }
+    spawnSequence = header.spawnSequence;
+    reserveStorage();
+    const CheckpointSection ids[4] = { CheckpointSection::PositionX, CheckpointSection::PositionY,
+                                       CheckpointSection::VelocityX, CheckpointSection::VelocityY };
+    AlignedVector<float>* arrays[4] = { &particles.x, &particles.y, &particles.vx, &particles.vy };
+    for (int a = 0; a < 4; ++a) {
+        size_t found = 0;
+        const float* data = checkpoint.findSection(ids[a], found);
+        if (!data || found != count) {
+            throw std::runtime_error("Checkpoint particle arrays do not match its particle count");
+        }
+        arrays[a]->assign(data, data + count);
+    }
+    size_t found = 0, freeCount = 0;
+    if (const uint32_t* ids = checkpoint.findIndexSection(CheckpointSection::ParticleId, found)) {
+        const uint32_t* free = checkpoint.findIndexSection(CheckpointSection::FreeParticleId, freeCount);
+        if (found != count || found + freeCount != idCount) {
+            throw std::runtime_error("Checkpoint particle IDs do not match its particle count");
+        }
+        particleIds.assign(ids, ids + count);
+        particleSlots.assign(idCount, UINT32_MAX);
+        for (size_t slot = 0; slot < count; ++slot) {
+            if (particleIds[slot] >= idCount || particleSlots[particleIds[slot]] != UINT32_MAX) {
+                throw std::runtime_error("Checkpoint particle IDs are not unique");
+            }
+            particleSlots[particleIds[slot]] = static_cast<uint32_t>(slot);
+        }
+        // Any ID neither live nor free would be a duplicate, given the counts match
+        if (freeCount) freeIds.assign(free, free + freeCount);
+        for (uint32_t id : freeIds) {
+            if (id >= idCount || particleSlots[id] != UINT32_MAX) {
+                throw std::runtime_error("Checkpoint particle IDs are not unique");
+            }
+        }
+    } else if (idCount != count) {
+        throw std::runtime_error("Checkpoint particle ID count does not match its particle count");
+    }
+    if (const float* life = checkpoint.findSection(CheckpointSection::LifeLeft, found)) {
+        if (found != count) {
+            throw std::runtime_error("Checkpoint particle lifetimes do not match its particle count");
+        }
+        lifeLeft.assign(life, life + count);
+    }
+
+    if (gridSolver) {
+        size_t uCount = 0, vCount = 0, pressureCount = 0;
+        const float* u = checkpoint.findSection(CheckpointSection::GridU, uCount);
+        const float* v = checkpoint.findSection(CheckpointSection::GridV, vCount);
+        const float* pressure = checkpoint.findSection(CheckpointSection::GridPressure, pressureCount);
+        if (!u || !v || !pressure || uCount != gridSolver->getU().size() || vCount != gridSolver->getV().size() ||
+            pressureCount != gridSolver->getPressure().size()) {
+            throw std::runtime_error("Checkpoint grid fields do not match its grid resolution");
+        }
+        gridSolver->restoreState(u, v, pressure);
+    } else {
+        grid.build(particles.view(), neighborRadius(), width, height, pool);
+    }
+    awakeCount = particles.size();
+    collectStats();
+}
+
+void FluidSimulator::saveCheckpoint(const std::string& path) const {
+    CheckpointHeader header;
+    header.mode = static_cast<uint32_t>(mode);
+    header.width = width;
+    header.height = height;
+    header.particleCount = particles.size();
+    header.particleCapacity = capacity;
+    header.particleIdCount = getParticleIdCount();
+    header.spawnSequence = spawnSequence;
+    header.interactionRadius = interactionRadius;
+    header.maxSpeed = maxSpeed;
+    header.interactionsEnabled = interactionsEnabled ? 1 : 0;
+    header.interactionStrength = interactionStrength;
+    header.interactionDamping = interactionDamping;
+    header.maxInteractionForce = maxInteractionForce;
+    header.integrator = static_cast<uint32_t>(integrator);
+    header.boundary = static_cast<uint32_t>(boundary);
+    header.damping = damping;
+    header.gravity = gravity;
+    if (sph) {
+        const SphParams& params = sph->getParams();
+        header.sphSmoothingLength = params.smoothingLength;
+        header.sphRestDensity = params.restDensity;
+        header.sphStiffness = params.stiffness;
+        header.sphViscosity = params.viscosity;
+        header.sphCourant = params.courant;
+        header.sphMass = params.mass;
+    }
+    if (gridSolver) {
+        const GridParams& params = gridSolver->getParams();
+        header.gridResolutionX = params.resolutionX;
+        header.gridGravity = params.gravity;
+        header.gridDissipation = params.dissipation;
+        header.gridMaxVCycles = params.maxVCycles;
+        header.gridTolerance = params.tolerance;
+        header.gridSmoothingSweeps = params.smoothingSweeps;
+    }
+
+    size_t bytes = particles.size() * sizeof(float);
+    std::vector<Checkpoint::Payload> payloads = {
+        { CheckpointSection::PositionX, particles.x.data(), bytes },
+        { CheckpointSection::PositionY, particles.y.data(), bytes },
+        { CheckpointSection::VelocityX, particles.vx.data(), bytes },
+        { CheckpointSection::VelocityY, particles.vy.data(), bytes },
+    };
+    if (!particleSlots.empty()) {
+        payloads.push_back({ CheckpointSection::ParticleId, particleIds.data(), particleIds.size() * sizeof(uint32_t) });
+    }
+    if (!freeIds.empty()) {
+        payloads.push_back({ CheckpointSection::FreeParticleId, freeIds.data(), freeIds.size() * sizeof(uint32_t) });
+    }
+    if (!lifeLeft.empty()) {
+        payloads.push_back({ CheckpointSection::LifeLeft, lifeLeft.data(), bytes });
+    }
+    if (gridSolver) {
+        payloads.push_back({ CheckpointSection::GridU, gridSolver->getU().data(), gridSolver->getU().size() * sizeof(float) });
+        payloads.push_back({ CheckpointSection::GridV, gridSolver->getV().data(), gridSolver->getV().size() * sizeof(float) });
+        payloads.push_back({ CheckpointSection::GridPressure, gridSolver->getPressure().data(),
+                             gridSolver->getPressure().size() * sizeof(float) });
+    }
+    Checkpoint::write(path, header, payloads);
+}
+
+float FluidSimulator::neighborRadius() const {
+    return sph ? sph->getSmoothingLength() : interactionRadius;
+}
+
+void FluidSimulator::computeInteractionForces() {
+    forceX.resize(particles.size());
+    forceY.resize(particles.size());
+
+    // Soft discs: neighbours closer than the radius push apart, harder the deeper they
+    // overlap, and the speed at which they close in on each other is damped. Both
+    // terms depend only on the pair and the cap bounds the kick per step, so unlike a
+    // repulsion scaled by the particle's own speed nothing feeds back into itself.
+    float radius = interactionRadius;
+    float invRadius = 1.0f / radius;
+    float strength = interactionStrength, damp = interactionDamping;
+    float maxForceSq = maxInteractionForce * maxInteractionForce;
+    const float* vx = particles.vx.data();
+    const float* vy = particles.vy.data();
+    // Sleepers get no force, their velocity is zero for the awake ones around them
+    pool.parallelFor(awakeCount, forceGrain, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            float fx = 0.0f, fy = 0.0f;
+            float ux = vx[i], uy = vy[i];
+            grid.forEachNeighbor(particles.x[i], particles.y[i], radius, [&](uint32_t j, float dx, float dy, float distSq) {
+                if (distSq == 0.0f) return; // Skip self-interaction (and coincident particles)
+                float distance = std::sqrt(distSq);
+                float nx = dx / distance, ny = dy / distance; // Towards the neighbour
+                float overlap = 1.0f - distance * invRadius;
+                // Positive while the pair closes in
+                float closing = (ux - vx[j]) * nx + (uy - vy[j]) * ny;
+                float push = overlap * (strength + damp * closing);
+                fx -= nx * push;
+                fy -= ny * push;
+            });
+            float forceSq = fx * fx + fy * fy;
+            if (forceSq > maxForceSq) {
+                float scale = maxInteractionForce / std::sqrt(forceSq);
+                fx *= scale;
+                fy *= scale;
+            }
+            forceX[i] = fx;
+            forceY[i] = fy;
+        }
+    });
+}
+
+void FluidSimulator::update(float dt) {
+    FLUID_PROFILE_SCOPE("update");
+    // The frame boundary, where blocks a pass spilled into are merged
+    frameArena.reset();
+    applyPerturbations();
+    if (gridSolver) {
+        updatePopulation(dt, false);
+        // Tracers first, so they see the impulses added since the last step
+        statsCollector.setHistogram(statsHistogramBins, statsHistogramMaxSpeed);
+        gridSolver->advectTracers(dt, particles, pool, &statsCollector);
+        statsCollector.finish(stats);
+        gridSolver->step(dt, pool);
+        stats.substeps = 1;
+        stats.neededSubsteps = 1;
+        stats.timeStep = dt;
+        ++substepCount;
+        ++stepsSinceReorder;
+        if (reorderDue()) reorderStorage();
+        return;
+    }
+
+    int substeps = 1;
+    float cflStep = cflTimeStep();
+    if (dt > cflStep) {
+        // Compared as floats, so a vanishing CFL step cannot overflow the count
+        float needed = std::min(std::ceil(dt / cflStep), static_cast<float>(std::max(maxSubsteps, 1)));
+        substeps = static_cast<int>(needed);
+    }
+    perturbedMaxSpeed = 0.0f;
+    // SPH has a hard stability limit from its speed of sound, split the frame to respect
+    // it within the same budget; a frame too long for that is counted, not stretched
+    int neededSubsteps = substeps;
+    if (sph) {
+        float needed = std::ceil(dt / sph->maxTimeStep());
+        neededSubsteps = needed > static_cast<float>(std::numeric_limits<int>::max())
+                             ? std::numeric_limits<int>::max()
+                             : std::max(substeps, static_cast<int>(needed));
+        substeps = std::min(neededSubsteps, std::max(maxSubsteps, 1));
+        if (neededSubsteps > substeps) ++unstableUpdateCount;
+    }
+    for (int i = 0; i < substeps; ++i) {
+        step(dt / substeps, i == substeps - 1); // Only the final state is reported
+    }
+    stats.substeps = substeps;
+    stats.neededSubsteps = neededSubsteps;
+    stats.timeStep = dt / substeps;
+    substepCount += substeps;
+}
+
+float FluidSimulator::cflTimeStep() const {
+    if (gridSolver || !(cflNumber > 0.0f)) return std::numeric_limits<float>::infinity();
+    float length = neighborRadius();
+    if (obstacleField) length = std::min(length, obstacleField->getBand());
+    float speed = std::max(stats.maxSpeed, perturbedMaxSpeed);
+    for (const Emitter& emitter : emitters) {
+        speed = std::max(speed, std::sqrt(emitter.vx * emitter.vx + emitter.vy * emitter.vy));
+    }
+    return speed > 0.0f ? cflNumber * length / speed : std::numeric_limits<float>::infinity();
+}
+
+float FluidSimulator::frameTimeStep() const {
+    float limit = cflTimeStep();
+    if (sph) limit = std::min(limit, sph->maxTimeStep());
+    return std::min(maxTimeStep, limit * static_cast<float>(std::max(maxSubsteps, 1)));
+}
+
+void FluidSimulator::step(float dt, bool reportStats) {
+    IntegrateParams params{ dt, damping, gravity, static_cast<float>(width), static_cast<float>(height),
+                            integrator, boundary };
+    bool hasForces = false;
+    wakeDisturbed();
+
+    // Forces are evaluated against the positions the grid was built from, before
+    // any particle moves, so the result does not depend on iteration order.
+    if (mode == SolverMode::SPH) {
+        FLUID_PROFILE_SCOPE("forces");
+        sph->computeAccelerations(particles, grid, pool, forceX, forceY);
+        hasForces = true;
+    } else if (interactionsEnabled) {
+        FLUID_PROFILE_SCOPE("forces");
+        computeInteractionForces();
+        hasForces = true;
+    }
+    const bool verlet = hasForces && integrator == Integrator::VelocityVerlet;
+    if (!verlet) {
+        lastForceX.clear();
+        lastForceY.clear();
+        lastForceDt = 0.0f;
+    }
+    updatePopulation(dt, hasForces);
+    if (verlet && lastForceX.size() != particles.size()) {
+        // The first step has no correction to make
+        lastForceX.assign(particles.size(), 0.0f);
+        lastForceY.assign(particles.size(), 0.0f);
+        lastForceDt = 0.0f;
+    }
+    params.lastForceX = lastForceX.data();
+    params.lastForceY = lastForceY.data();
+    params.lastDt = lastForceDt;
+
+    {
+        FLUID_PROFILE_SCOPE("integrate");
+        IntegrateKernel integrate = getIntegrateKernel(simdLevel, integrator, boundary,
+                                                       hasForces ? ForceSet::FieldAndParticle : ForceSet::Field);
+        const float* fx = hasForces ? forceX.data() : nullptr;
+        const float* fy = hasForces ? forceY.data() : nullptr;
+        if (reportStats) {
+            statsCollector.setHistogram(statsHistogramBins, statsHistogramMaxSpeed);
+            statsCollector.begin(awakeCount, integrateGrain);
+        }
+        pool.parallelFor(awakeCount, integrateGrain, [&](size_t begin, size_t end) {
+            integrate(params, particles.x.data(), particles.y.data(), particles.vx.data(), particles.vy.data(),
+                      fx, fy, begin, end, reportStats ? statsCollector.partialFor(begin) : nullptr);
+        });
+        if (verlet) lastForceDt = dt;
+    }
+    if (obstacleField) {
+        FLUID_PROFILE_SCOPE("obstacles");
+        obstacleField->collide(particles, awakeCount, obstacleRestitution, pool);
+    }
+    if (reportStats) {
+        // Particles falling asleep now keep the state they were counted with
+        if (awakeCount < particles.size()) {
+            if (restingStale) {
+                restingStats = StatsPartial{};
+                for (size_t i = awakeCount; i < particles.size(); ++i) {
+                    restingStats.add(particles.x[i], particles.y[i], 0.0f, 0.0f);
+                }
+                restingStale = false;
+            }
+            statsCollector.addResting(particles.size() - awakeCount, restingStats.minX, restingStats.minY,
+                                      restingStats.maxX, restingStats.maxY);
+        }
+        statsCollector.finish(stats);
+    }
+    sleepStill();
+
+    // Decided on the previous build, which the integration barely changed
+    ++stepsSinceReorder;
+    if (reorderDue()) reorderStorage();
+    restSleepers();
+
+    FLUID_PROFILE_SCOPE("grid build");
+    grid.build(particles.view(), neighborRadius(), width, height, pool);
+    // Sized along with the grid, so that waking never allocates
+    if (sleepingEnabled() && cellMarks.size() != grid.getCellCount()) {
+        cellMarks.assign(grid.getCellCount(), 0);
+        markedCells.reserve(grid.getCellCount());
+    }
+}
+
+void FluidSimulator::setObstacles(std::vector<Obstacle> obstacles, float cellSize) {
+    if (mode == SolverMode::Grid) {
+        throw std::invalid_argument("Obstacles are not supported in Grid mode");
+    }
+    wakeAll();
+    if (obstacles.empty()) {
+        obstacleField.reset();
+        return;
+    }
+    obstacleField.emplace(width, height, std::move(obstacles), pool, cellSize);
+}
+
+void FluidSimulator::moveObstacle(size_t index, float x, float y) {
+    if (!obstacleField) {
+        throw std::out_of_range("No obstacle " + std::to_string(index));
+    }
+    if (index < obstacleField->getObstacles().size()) {
+        const ObstacleField::Bounds& before = obstacleField->getBounds(index);
+        markDisturbed(before.minX, before.minY, before.maxX, before.maxY);
+    }
+    obstacleField->move(index, x, y, pool);
+    const ObstacleField::Bounds& after = obstacleField->getBounds(index);
+    markDisturbed(after.minX, after.minY, after.maxX, after.maxY);
+}
+
+void FluidSimulator::swapSlots(size_t a, size_t b) {
+    std::swap(particles.x[a], particles.x[b]);
+    std::swap(particles.y[a], particles.y[b]);
+    std::swap(particles.vx[a], particles.vx[b]);
+    std::swap(particles.vy[a], particles.vy[b]);
+    if (!lifeLeft.empty()) std::swap(lifeLeft[a], lifeLeft[b]);
+    if (!stillSteps.empty()) std::swap(stillSteps[a], stillSteps[b]);
+    if (!lastForceX.empty()) {
+        std::swap(lastForceX[a], lastForceX[b]);
+        std::swap(lastForceY[a], lastForceY[b]);
+    }
+    std::swap(particleIds[a], particleIds[b]);
+    particleSlots[particleIds[a]] = static_cast<uint32_t>(a);
+    particleSlots[particleIds[b]] = static_cast<uint32_t>(b);
+}
+
+void FluidSimulator::markDisturbed(float minX, float minY, float maxX, float maxY) {
+    if (!sleepingEnabled() || awakeCount == particles.size() || grid.size() != particles.size()) return;
+    if (cellMarks.size() != grid.getCellCount()) cellMarks.assign(grid.getCellCount(), 0);
+    const int columns = grid.getColumnCount();
+    uint32_t first = grid.cellIndex(minX, minY), last = grid.cellIndex(maxX, maxY);
+    for (uint32_t row = first / columns; row <= last / columns; ++row) {
+        for (uint32_t column = first % columns; column <= last % columns; ++column) {
+            uint32_t cell = row * columns + column;
+            if (cellMarks[cell] == 0) markedCells.push_back(cell);
+            cellMarks[cell] |= 1;
+        }
+    }
+}
+
+void FluidSimulator::wakeAll() {
+    if (awakeCount < particles.size()) {
+        restingStale = true;
+        grid.dropResting();
+    }
+    awakeCount = particles.size();
+    for (uint32_t cell : markedCells) cellMarks[cell] = 0;
+    markedCells.clear();
+}
+
+void FluidSimulator::wakeDisturbed() {
+    // Nothing asleep, or nothing that should be
+    if (awakeCount == particles.size() || !sleepingEnabled() || grid.size() != particles.size()) {
+        wakeAll();
+        return;
+    }
+    FLUID_PROFILE_SCOPE("wake");
+    if (cellMarks.size() != grid.getCellCount()) cellMarks.assign(grid.getCellCount(), 0);
+
+    // Cells holding a particle that was fast last step join the perturbed ones. The grid
+    // was built from the current positions, so its cells and slots are still valid.
+    for (size_t i = 0; i < awakeCount; ++i) {
+        if (stillSteps[i] != 0) continue;
+        uint32_t cell = grid.cellIndex(particles.x[i], particles.y[i]);
+        if (cellMarks[cell] == 0) markedCells.push_back(cell);
+        cellMarks[cell] |= 1;
+    }
+
+    // Sleepers in or next to a disturbed cell wake; the visited bit keeps a cell that
+    // borders several from being collected twice
+    const int columns = grid.getColumnCount(), rows = grid.getRowCount();
+    const size_t disturbed = markedCells.size();
+    wokenSlots.clear();
+    for (size_t d = 0; d < disturbed; ++d) {
+        int cx = static_cast<int>(markedCells[d] % columns), cy = static_cast<int>(markedCells[d] / columns);
+        for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, rows - 1); ++y) {
+            for (int x = std::max(cx - 1, 0); x <= std::min(cx + 1, columns - 1); ++x) {
+                uint32_t cell = static_cast<uint32_t>(y * columns + x);
+                if (cellMarks[cell] & 2) continue;
+                if (cellMarks[cell] == 0) markedCells.push_back(cell);
+                cellMarks[cell] |= 2;
+                grid.forEachInCell(cell, [&](uint32_t slot) {
+                    if (slot >= awakeCount) wokenSlots.push_back(slot);
+                });
+            }
+        }
+    }
+    for (uint32_t cell : markedCells) cellMarks[cell] = 0;
+    markedCells.clear();
+    if (wokenSlots.empty()) return;
+
+    // In ascending order each woken sleeper trades places with the first sleeper left,
+    // which is never one still waiting to wake. One in the grid's resting layer first
+    // does so with the layer's first particle, the layer starting one slot later.
+    ensureParticleIds();
+    std::sort(wokenSlots.begin(), wokenSlots.end());
+    for (uint32_t slot : wokenSlots) {
+        if (slot >= grid.getRestingBegin()) {
+            uint32_t first = grid.release(slot);
+            if (slot != first) swapSlots(slot, first);
+            slot = first;
+        }
+        if (slot != awakeCount) swapSlots(slot, awakeCount);
+        stillSteps[awakeCount] = 0;
+        ++awakeCount;
+    }
+    // The sleepers' box is left as it was, a bound on the remaining ones, and tightened
+    // when the resting layer is next filed
+}
+
+void FluidSimulator::restSleepers() {
+    // Sleepers outside the grid's resting layer are binned every step like the awake
+    // particles; once they outnumber those, or a sixteenth of all, the layer is filed
+    // anew from the current sleepers. Particles woken out of it count the same.
+    const size_t count = particles.size();
+    if (!sleepingEnabled() || awakeCount == count) return;
+    size_t restingBegin = std::min(grid.getRestingBegin(), count);
+    size_t unfiled = restingBegin - std::min(awakeCount, restingBegin) + grid.getReleasedCount();
+    if (unfiled > std::max(awakeCount, count / 16)) {
+        grid.restFrom(awakeCount);
+        restingStale = true;
+    }
+}
+
+void FluidSimulator::sleepStill() {
+    if (!sleepingEnabled() || awakeCount == 0) return;
+    FLUID_PROFILE_SCOPE("sleep");
+    const size_t count = particles.size();
+    if (stillSteps.size() != count) stillSteps.assign(count, 0);
+
+    const uint16_t limit = static_cast<uint16_t>(std::clamp(sleepSteps, 1, 0xFFFF));
+    const float thresholdSq = sleepSpeed * sleepSpeed;
+    FrameArena::Scope scratch(frameArena);
+    const size_t chunks = ThreadPool::chunkCount(awakeCount, integrateGrain);
+    uint32_t* chunkSleepers = frameArena.allocate<uint32_t>(chunks, 0u);
+    pool.parallelFor(awakeCount, integrateGrain, [&](size_t begin, size_t end) {
+        uint32_t sleepers = 0;
+        for (size_t i = begin; i < end; ++i) {
+            if (particles.vx[i] * particles.vx[i] + particles.vy[i] * particles.vy[i] < thresholdSq) {
+                stillSteps[i] += stillSteps[i] < limit;
+                sleepers += stillSteps[i] >= limit;
+            } else {
+                stillSteps[i] = 0;
+            }
+        }
+        chunkSleepers[begin / integrateGrain] = sleepers;
+    });
+    size_t sleeping = std::accumulate(chunkSleepers, chunkSleepers + chunks, size_t{ 0 });
+    if (sleeping == 0) return;
+    uint32_t* sleepingSlots = frameArena.allocate<uint32_t>(sleeping);
+    size_t found = 0;
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        if (chunkSleepers[chunk] == 0) continue;
+        size_t end = std::min(awakeCount, (chunk + 1) * integrateGrain);
+        for (size_t i = chunk * integrateGrain; i < end; ++i) {
+            if (stillSteps[i] >= limit) sleepingSlots[found++] = static_cast<uint32_t>(i);
+        }
+    }
+
+    // From the back, each new sleeper trades places with the last awake particle
+    ensureParticleIds();
+    if (awakeCount == count) restingStats = StatsPartial{};
+    for (size_t k = sleeping; k-- > 0;) {
+        size_t slot = sleepingSlots[k];
+        particles.vx[slot] = 0.0f;
+        particles.vy[slot] = 0.0f;
+        if (!lastForceX.empty()) {
+            lastForceX[slot] = 0.0f;
+            lastForceY[slot] = 0.0f;
+        }
+        restingStats.add(particles.x[slot], particles.y[slot], 0.0f, 0.0f);
+        --awakeCount;
+        if (slot != awakeCount) swapSlots(slot, awakeCount);
+    }
+}
+
+bool FluidSimulator::reorderDue() const {
+    if (reorderInterval > 0 && stepsSinceReorder >= reorderInterval) return true;
+    return !gridSolver && reorderThreshold > 0.0f && grid.getScatter() > reorderThreshold;
+}
+
+void FluidSimulator::reorderParticles() {
+    reorderStorage();
+    if (!gridSolver) {
+        grid.build(particles.view(), neighborRadius(), width, height, pool);
+    }
+}
+
+void FluidSimulator::reorderStorage() {
+    FLUID_PROFILE_SCOPE("reorder");
+    float cellSize = gridSolver ? gridSolver->getCellSize() : neighborRadius();
+    // The grid's resting particles keep their slots, so only the ones before them move
+    ParticleView sorted = particles.view();
+    sorted.count = std::min(sorted.count, grid.getRestingBegin());
+    mortonOrder.sort(sorted, cellSize, width, height, pool, frameArena);
+    if (awakeCount < particles.size()) mortonOrder.partition(static_cast<uint32_t>(awakeCount));
+    mortonOrder.apply(particles.x, reorderScratch, pool);
+    mortonOrder.apply(particles.y, reorderScratch, pool);
+    mortonOrder.apply(particles.vx, reorderScratch, pool);
+    mortonOrder.apply(particles.vy, reorderScratch, pool);
+
+    if (!lifeLeft.empty()) mortonOrder.apply(lifeLeft, reorderScratch, pool);
+    if (!stillSteps.empty()) mortonOrder.apply(stillSteps, stillScratch, pool);
+    if (!lastForceX.empty()) {
+        mortonOrder.apply(lastForceX, reorderScratch, pool);
+        mortonOrder.apply(lastForceY, reorderScratch, pool);
+    }
+    ensureParticleIds();
+    mortonOrder.apply(particleIds, idScratch, pool);
+    pool.parallelFor(sorted.count, integrateGrain, [&](size_t begin, size_t end) {
+        for (size_t slot = begin; slot < end; ++slot) {
+            particleSlots[particleIds[slot]] = static_cast<uint32_t>(slot);
+        }
+    });
+
+    stepsSinceReorder = 0;
+    ++reorderCount;
+}
+
+void FluidSimulator::reserveStorage() {
+    // Everything sized by the particle count, so that a changing population never
+    // makes a step allocate
+    particles.reserve(capacity);
+    forceX.reserve(capacity);
+    forceY.reserve(capacity);
+    lastForceX.reserve(capacity);
+    lastForceY.reserve(capacity);
+    grid.reserve(capacity);
+    if (sph) sph->reserve(capacity);
+    statsCollector.reserve(capacity, integrateGrain);
+    mortonOrder.reserve(capacity);
+    reorderScratch.reserve(capacity);
+    particleIds.reserve(capacity);
+    particleSlots.reserve(capacity);
+    idScratch.reserve(capacity);
+    freeIds.reserve(capacity);
+    lifeLeft.reserve(capacity);
+    stillSteps.reserve(capacity);
+    stillScratch.reserve(capacity);
+    wokenSlots.reserve(capacity);
+    // Sorting for a reorder takes the most scratch of any pass
+    frameArena.reserve(MortonOrder::scratchBytes(capacity));
+}
+
+void FluidSimulator::ensureParticleIds() {
+    if (!particleSlots.empty()) return;
+    particleIds.resize(particles.size());
+    std::iota(particleIds.begin(), particleIds.end(), 0u);
+    particleSlots.assign(particleIds.begin(), particleIds.end());
+}
+
+void FluidSimulator::spawnParticle(const Particle& particle, float lifetime) {
+    // Also rejects NaN, which the cell lookups cannot take
+    if (std::isfinite(particle.x) && std::isfinite(particle.y)) {
+        pendingSpawns.push_back({ particle, lifetime });
+    }
+}
+
+void FluidSimulator::removeParticle(uint32_t id) {
+    pendingRemovals.push_back(id);
+}
+
+void FluidSimulator::updatePopulation(float dt, bool hasForces) {
+    const bool ageing = !lifeLeft.empty();
+    // Grid mode keeps its tracers inside by itself
+    const bool outflow = boundary == Boundary::Open && !gridSolver;
+    if (!ageing && !outflow && drains.empty() && emitters.empty() && pendingRemovals.empty() && pendingSpawns.empty()) {
+        return;
+    }
+    FLUID_PROFILE_SCOPE("population");
+
+    FrameArena::Scope scratch(frameArena);
+    // Mark the removals, counted per chunk so that chunks without any are skipped
+    const size_t count = particles.size();
+    uint8_t* removing = frameArena.allocate<uint8_t>(count, 0);
+    uint32_t* chunkRemovals = frameArena.allocate<uint32_t>(ThreadPool::chunkCount(count, integrateGrain), 0u);
+    const float domainWidth = static_cast<float>(width), domainHeight = static_cast<float>(height);
+    if (ageing || outflow || !drains.empty()) {
+        pool.parallelFor(count, integrateGrain, [&](size_t begin, size_t end) {
+            uint32_t removals = 0;
+            for (size_t i = begin; i < end; ++i) {
+                bool remove = outflow && !(particles.x[i] >= 0.0f && particles.x[i] <= domainWidth &&
+                                           particles.y[i] >= 0.0f && particles.y[i] <= domainHeight);
+                if (ageing) {
+                    lifeLeft[i] -= dt;
+                    remove |= lifeLeft[i] <= 0.0f;
+                }
+                for (const Drain& drain : drains) {
+                    float dx = particles.x[i] - drain.x, dy = particles.y[i] - drain.y;
+                    remove |= dx * dx + dy * dy < drain.radius * drain.radius;
+                }
+                removing[i] = remove;
+                removals += remove;
+            }
+            chunkRemovals[begin / integrateGrain] = removals;
+        });
+    }
+    for (uint32_t id : pendingRemovals) {
+        size_t slot = id < getParticleIdCount() ? getParticleSlot(id) : UINT32_MAX;
+        if (slot < count && !removing[slot]) {
+            removing[slot] = 1;
+            ++chunkRemovals[slot / integrateGrain];
+        }
+    }
+    pendingRemovals.clear();
+    removeMarked(removing, chunkRemovals, hasForces);
+
+    for (const PendingSpawn& pending : pendingSpawns) {
+        spawn(pending.particle, pending.lifetime, hasForces);
+    }
+    pendingSpawns.clear();
+    emitterCarry.resize(emitters.size(), 0.0f);
+    for (size_t e = 0; e < emitters.size(); ++e) {
+        const Emitter& emitter = emitters[e];
+        for (emitterCarry[e] += emitter.rate * dt; emitterCarry[e] >= 1.0f; emitterCarry[e] -= 1.0f) {
+            // Uniform over the disc: the radius goes with the square root of the area
+            uint64_t bits = mixBits(++spawnSequence);
+            float area = static_cast<float>(bits >> 40) * 0x1p-24f;
+            float angle = static_cast<float>(bits & 0xFFFFFF) * 0x1p-24f * 6.2831853f;
+            float r = emitter.radius * std::sqrt(area);
+            spawn({ emitter.x + r * std::cos(angle), emitter.y + r * std::sin(angle), emitter.vx, emitter.vy },
+                  emitter.lifetime, hasForces);
+        }
+    }
+}
+
+void FluidSimulator::removeMarked(const uint8_t* removing, const uint32_t* chunkRemovals, bool hasForces) {
+    const size_t count = particles.size();
+    const size_t chunks = ThreadPool::chunkCount(count, integrateGrain);
+    const size_t removals = std::accumulate(chunkRemovals, chunkRemovals + chunks, size_t{ 0 });
+    if (removals == 0) return;
+    uint32_t* removedSlots = frameArena.allocate<uint32_t>(removals);
+    size_t found = 0;
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        if (chunkRemovals[chunk] == 0) continue;
+        size_t end = std::min(count, (chunk + 1) * integrateGrain);
+        for (size_t i = chunk * integrateGrain; i < end; ++i) {
+            if (removing[i]) removedSlots[found++] = static_cast<uint32_t>(i);
+        }
+    }
+
+    ensureParticleIds();
+    const size_t live = count - removals;
+    for (size_t k = 0; k < removals; ++k) {
+        particleSlots[particleIds[removedSlots[k]]] = UINT32_MAX;
+        freeIds.push_back(particleIds[removedSlots[k]]);
+    }
+    // Holes below the new end take the survivors above it, from the back. Slots are
+    // in ascending order, so every hole below the end comes before those above it.
+    size_t source = count;
+    for (size_t k = 0; k < removals; ++k) {
+        uint32_t slot = removedSlots[k];
+        if (slot >= live) break;
+        do {
+            --source;
+        } while (removing[source]);
+        particles.x[slot] = particles.x[source];
+        particles.y[slot] = particles.y[source];
+        particles.vx[slot] = particles.vx[source];
+        particles.vy[slot] = particles.vy[source];
+        if (hasForces) {
+            // Sleepers have no forces of their own; one landing among the awake
+            // particles rests this step and falls asleep again at its end
+            forceX[slot] = source < awakeCount ? forceX[source] : 0.0f;
+            forceY[slot] = source < awakeCount ? forceY[source] : 0.0f;
+        }
+        if (!lifeLeft.empty()) lifeLeft[slot] = lifeLeft[source];
+        if (!stillSteps.empty()) stillSteps[slot] = stillSteps[source];
+        if (!lastForceX.empty()) {
+            lastForceX[slot] = lastForceX[source];
+            lastForceY[slot] = lastForceY[source];
+        }
+        particleIds[slot] = particleIds[source];
+        particleSlots[particleIds[slot]] = slot;
+    }
+    particles.x.resize(live);
+    particles.y.resize(live);
+    particles.vx.resize(live);
+    particles.vy.resize(live);
+    if (hasForces) {
+        forceX.resize(live);
+        forceY.resize(live);
+    }
+    if (!lifeLeft.empty()) lifeLeft.resize(live);
+    if (!stillSteps.empty()) stillSteps.resize(live);
+    if (!lastForceX.empty()) {
+        lastForceX.resize(live);
+        lastForceY.resize(live);
+    }
+    if (awakeCount < count) {
+        restingStale = true;
+        grid.dropResting();
+    }
+    awakeCount = std::min(awakeCount, live);
+    particleIds.resize(live);
+    removedCount += removals;
+}
+
+void FluidSimulator::spawn(const Particle& particle, float lifetime, bool hasForces) {
+    if (particles.size() >= capacity) {
+        ++droppedSpawns;
+        return;
+    }
+    ensureParticleIds();
+    // Reuse the most recently freed ID; a new one only when none is free keeps the
+    // ID range within the capacity
+    uint32_t id;
+    if (freeIds.empty()) {
+        id = static_cast<uint32_t>(particleSlots.size());
+        particleSlots.push_back(0);
+    } else {
+        id = freeIds.back();
+        freeIds.pop_back();
+    }
+    particleSlots[id] = static_cast<uint32_t>(particles.size());
+    particleIds.push_back(id);
+    particles.push_back(particle);
+    if (hasForces) {
+        forceX.push_back(0.0f);
+        forceY.push_back(0.0f);
+    }
+    if (lifetime > 0.0f && lifeLeft.empty()) lifeLeft.assign(particles.size() - 1, unlimitedLife);
+    if (lifetime > 0.0f || !lifeLeft.empty()) lifeLeft.push_back(lifetime > 0.0f ? lifetime : unlimitedLife);
+    if (!stillSteps.empty()) stillSteps.push_back(0);
+    // Counted as having had no force the step before
+    if (!lastForceX.empty()) {
+        lastForceX.push_back(0.0f);
+        lastForceY.push_back(0.0f);
+    }
+    // Spawned particles are awake, so one behind the sleepers trades places with the first
+    size_t slot = particles.size() - 1;
+    if (awakeCount < slot) {
+        grid.dropResting();
+        swapSlots(awakeCount, slot);
+        if (hasForces) {
+            forceX[awakeCount] = 0.0f;
+            forceY[awakeCount] = 0.0f;
+        }
+    }
+    ++awakeCount;
+    ++spawnedCount;
+}
+
+void FluidSimulator::addPerturbation(const Perturbation& perturbation) {
+    // Also rejects NaN, which the cell lookups cannot take
+    if (perturbation.radius > 0.0f && std::isfinite(perturbation.x) && std::isfinite(perturbation.y)) {
+        pendingPerturbations.push_back(perturbation);
+    }
+}
+
+void FluidSimulator::addPerturbations(const Perturbation* perturbations, size_t count) {
+    pendingPerturbations.reserve(pendingPerturbations.size() + count);
+    for (size_t i = 0; i < count; ++i) {
+        addPerturbation(perturbations[i]);
+    }
+}
+
+void FluidSimulator::applyPerturbations() {
+    if (pendingPerturbations.empty()) return;
+    FLUID_PROFILE_SCOPE("perturbation");
+    if (gridSolver) {
+        for (const Perturbation& p : pendingPerturbations) {
+            gridSolver->addImpulse(p.x, p.y, p.radius, p.strength, p.falloff);
+        }
+        pendingPerturbations.clear();
+        return;
+    }
+    if (grid.size() == 0) {
+        pendingPerturbations.clear();
+        return;
+    }
+    for (const Perturbation& p : pendingPerturbations) {
+        markDisturbed(p.x - p.radius, p.y - p.radius, p.x + p.radius, p.y + p.radius);
+    }
+
+    // Bucket the perturbations by the cell rows they touch, in queue order. Rows
+    // partition the particles, so each row is one task, and a particle still sees
+    // the perturbations in the order they were added, whatever the thread count.
+    FrameArena::Scope scratch(frameArena);
+    const int rows = grid.getRowCount();
+    uint32_t* perturbationRowStart = frameArena.allocate<uint32_t>(static_cast<size_t>(rows) + 1, 0u);
+    for (const Perturbation& p : pendingPerturbations) {
+        auto [firstRow, rowCount] = grid.rowSpan(p.y, p.radius);
+        for (int row = firstRow; row < firstRow + rowCount; ++row) {
+            ++perturbationRowStart[row + 1];
+        }
+    }
+    uint32_t* perturbedRows = frameArena.allocate<uint32_t>(static_cast<size_t>(rows));
+    size_t perturbedRowCount = 0;
+    for (int row = 0; row < rows; ++row) {
+        if (perturbationRowStart[row + 1] != 0) perturbedRows[perturbedRowCount++] = static_cast<uint32_t>(row);
+        perturbationRowStart[row + 1] += perturbationRowStart[row];
+    }
+    uint32_t* perturbationRowCursor = frameArena.allocate<uint32_t>(static_cast<size_t>(rows));
+    std::copy_n(perturbationRowStart, rows, perturbationRowCursor);
+    uint32_t* perturbationsByRow = frameArena.allocate<uint32_t>(perturbationRowStart[rows]);
+    for (size_t k = 0; k < pendingPerturbations.size(); ++k) {
+        const Perturbation& p = pendingPerturbations[k];
+        auto [firstRow, rowCount] = grid.rowSpan(p.y, p.radius);
+        for (int row = firstRow; row < firstRow + rowCount; ++row) {
+            perturbationsByRow[perturbationRowCursor[row]++] = static_cast<uint32_t>(k);
+        }
+    }
+
+    // The fastest particle each row leaves, so the next update can size its substeps
+    float* perturbedRowSpeedSq = frameArena.allocate<float>(perturbedRowCount);
+    pool.parallelFor(perturbedRowCount, 1, [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; ++r) {
+            int row = static_cast<int>(perturbedRows[r]);
+            float rowSpeedSq = 0.0f;
+            for (uint32_t j = perturbationRowStart[row]; j < perturbationRowStart[row + 1]; ++j) {
+                const Perturbation& p = pendingPerturbations[perturbationsByRow[j]];
+                const float falloffPerDistance = p.falloff / p.radius;
+                grid.forEachNeighborInRows(p.x, p.y, p.radius, row, 1, [&](uint32_t i, float dx, float dy, float distSq) {
+                    if (distSq == 0.0f) return;
+                    float inverseDistance = reciprocalSqrt(distSq);
+                    float scale = p.strength * inverseDistance * (1.0f - falloffPerDistance * distSq * inverseDistance);
+                    particles.vx[i] += dx * scale;
+                    particles.vy[i] += dy * scale;
+                    rowSpeedSq = std::max(rowSpeedSq, particles.vx[i] * particles.vx[i] + particles.vy[i] * particles.vy[i]);
+                });
+            }
+            perturbedRowSpeedSq[r] = rowSpeedSq;
+        }
+    });
+    for (size_t r = 0; r < perturbedRowCount; ++r) {
+        perturbedMaxSpeed = std::max(perturbedMaxSpeed, std::sqrt(perturbedRowSpeedSq[r]));
+    }
+    pendingPerturbations.clear();
+}
+
+ParticleView FluidSimulator::getParticles() const {
+    return particles.view();
+}
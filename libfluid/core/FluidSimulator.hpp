@@ -0,0 +1,256 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Checkpoint.hpp"
+#include "FrameArena.hpp"
+#include "GridSolver.hpp"
+#include "IntegrateKernel.hpp"
+#include "MortonOrder.hpp"
+#include "ObstacleField.hpp"
+#include "ParticleStorage.hpp"
+#include "SpatialHash.hpp"
+#include "SphSolver.hpp"
+#include "StepStats.hpp"
+#include "ThreadPool.hpp"
+
+enum class SolverMode {
+    Particles, // Free particles under gravity and damping, with optional repulsion
+    SPH,       // Smoothed Particle Hydrodynamics
+    Grid,      // Eulerian MAC grid, particles are passive tracers
+};
+
+struct SimulatorConfig {
+    unsigned threadCount = 0; // Including the caller; 0 uses every hardware thread
+    float particleSpacing = 5.0f; // Distance between particles of the initial lattice
+    bool initialLattice = true;   // false starts empty, for scenes filled by emitters
+    size_t particleCapacity = 0;  // Particle storage reserved up front, 0 = the initial lattice
+    SolverMode mode = SolverMode::Particles;
+    SphParams sph;
+    GridParams grid;
+};
+
+// Radial velocity impulse: particles strictly within radius of (x, y) are pushed away
+// from it by strength (pulled towards it when negative), scaled by
+// 1 - falloff * distance / radius. A particle exactly at (x, y) has no direction and
+// is left alone.
+struct Perturbation {
+    float x, y, radius, strength;
+    float falloff = 0.0f; // 0 pushes evenly, 1 fades out linearly towards the radius
+};
+
+// Spawns rate particles per second, uniformly over the disc of radius around (x, y),
+// moving at (vx, vy). They live for lifetime seconds, or until drained if it is 0.
+struct Emitter {
+    float x, y, radius, rate;
+    float vx = 0.0f, vy = 0.0f;
+    float lifetime = 0.0f;
+};
+
+// Removes the particles strictly within radius of (x, y)
+struct Drain {
+    float x, y, radius;
+};
+
+class FluidSimulator {
+public:
+    FluidSimulator(int width, int height, const SimulatorConfig& config = {});
+    // Resumes the state saved in a checkpoint; only the thread count is chosen anew.
+    // The particle arrays are copied out of the mapping, as storage has to be writable
+    // and able to grow, so a restore costs a memcpy of the state rather than nothing.
+    explicit FluidSimulator(const Checkpoint& checkpoint, unsigned threadCount = 0);
+    static FluidSimulator loadCheckpoint(const std::string& path, unsigned threadCount = 0) {
+        return FluidSimulator(Checkpoint(path), threadCount);
+    }
+    // Writes the full state atomically, see Checkpoint. Not thread-safe against update().
+    void saveCheckpoint(const std::string& path) const;
+
+    // Advances by dt, in as many substeps as cflNumber and SPH's stability limit ask for,
+    // up to maxSubsteps
+    void update(float dt);
+    // Longest frame update() can cover within maxSubsteps at the current speeds and SPH's
+    // stability limit, at most maxTimeStep, which is also what it is without either. For
+    // callers that let the simulation pick its own pace.
+    float frameTimeStep() const;
+    uint64_t getSubstepCount() const { return substepCount; }
+    // SPH updates whose frame was too long for SPH's stability limit within maxSubsteps,
+    // and so ran longer substeps than it allows
+    uint64_t getUnstableUpdateCount() const { return unstableUpdateCount; }
+    // Perturbations are queued and applied together at the start of the next update(),
+    // in the order they were added. Ones with a non-positive radius are ignored.
+    // The queue is not part of checkpoints.
+    void addPerturbation(float x, float y, float radius, float strength) {
+        addPerturbation(Perturbation{ x, y, radius, strength });
+    }
+    void addPerturbation(const Perturbation& perturbation);
+    void addPerturbations(const Perturbation* perturbations, size_t count);
+    // Applies the queued perturbations now instead of at the next update()
+    void applyPerturbations();
+    size_t getPendingPerturbations() const { return pendingPerturbations.size(); }
+    // Particles are spawned and removed at the start of a step, after the forces were
+    // evaluated: queued removals, drains and expired lifetimes first, then queued
+    // spawns and the emitters. Removed slots are refilled from the end of storage, so
+    // the live particles stay in [0, size). Spawns past the capacity are dropped.
+    void spawnParticle(const Particle& particle, float lifetime = 0.0f);
+    void removeParticle(uint32_t id);
+    size_t getParticleCapacity() const { return capacity; }
+    uint64_t getSpawnedCount() const { return spawnedCount; }
+    uint64_t getRemovedCount() const { return removedCount; }
+    uint64_t getDroppedSpawns() const { return droppedSpawns; }
+    // Slots [0, getAwakeCount()) hold the awake particles, the rest are asleep
+    size_t getAwakeCount() const { return awakeCount; }
+    ParticleView getParticles() const;
+    unsigned getThreadCount() const { return pool.getThreadCount(); }
+    SolverMode getMode() const { return mode; }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    const GridSolver* getGridSolver() const { return gridSolver ? &*gridSolver : nullptr; }
+    // Bakes the obstacles into a distance field with cells of cellSize; an empty list
+    // removes them. Particles are pushed out of them after every integration. Throws
+    // std::invalid_argument in Grid mode. Scene setup, not part of checkpoints.
+    void setObstacles(std::vector<Obstacle> obstacles, float cellSize = 4.0f);
+    // Throws std::out_of_range for an index past the obstacles
+    void moveObstacle(size_t index, float x, float y);
+    const ObstacleField* getObstacleField() const { return obstacleField ? &*obstacleField : nullptr; }
+    // Aggregates of the state left by the last update, gathered during the update itself
+    const StepStats& getStats() const { return stats; }
+    // Scratch memory of the passes, released as each finishes and reset by update()
+    const FrameArena& getFrameArena() const { return frameArena; }
+
+    // Sorts the particle storage along a Z-order curve of the grid cells now; step()
+    // does so by itself per reorderInterval and reorderThreshold.
+    void reorderParticles();
+    uint64_t getReorderCount() const { return reorderCount; }
+    // Particles keep their ID, the slot they had before the first reorder or spawn,
+    // while reordering and removals move them between slots. IDs of removed particles
+    // are handed out again, and map to no slot (UINT32_MAX) until then. The slot map
+    // is null while storage is still in ID order.
+    const uint32_t* getParticleSlots() const { return particleSlots.empty() ? nullptr : particleSlots.data(); }
+    size_t getParticleIdCount() const { return particleSlots.empty() ? particles.size() : particleSlots.size(); }
+    uint32_t getParticleId(size_t slot) const {
+        return particleIds.empty() ? static_cast<uint32_t>(slot) : particleIds[slot];
+    }
+    size_t getParticleSlot(uint32_t id) const { return particleSlots.empty() ? id : particleSlots[id]; }
+
+    float maxSpeed = 10.0f;
+    // Particles mode only: a pair closer than interactionRadius is pushed apart by
+    // interactionStrength plus interactionDamping times the speed at which it closes
+    // in (negative while it separates), both scaled by 1 - distance / radius. A
+    // particle's summed force is capped at maxInteractionForce.
+    bool interactionsEnabled = true;
+    float interactionRadius = 10.0f; // Also the grid cell size; the constructor sets twice the particle spacing
+    float interactionStrength = 400.0f;
+    float interactionDamping = 5.0f;
+    float maxInteractionForce = 2000.0f;
+    SimdLevel simdLevel = detectSimdLevel(); // Instruction set of the integration kernel
+    // Integration kernel and constant forces, not used in Grid mode. SPH starts out
+    // semi-implicit with Clamp and no damping, as its stiff pressure response needs.
+    Integrator integrator = Integrator::ExplicitEuler;
+    Boundary boundary = Boundary::Reflect; // Open also removes the particles that leave
+    float damping = 0.96f;                 // Velocity kept per step, 0 < damping <= 1
+    float gravity = 5 * -9.8f;
+    float obstacleRestitution = 0.0f; // Share of the speed into an obstacle kept, bounced back
+    // update() splits its frame so no particle moves further than cflNumber interaction
+    // radii, or obstacle bands, per substep, judged by the fastest particle as the frame
+    // starts (perturbations included). A frame needing more than maxSubsteps runs longer
+    // substeps instead; so does SPH past its own limit, see getUnstableUpdateCount().
+    // 0 = one step per frame. Grid mode has no such condition.
+    float cflNumber = 0.5f;
+    int maxSubsteps = 8;
+    float maxTimeStep = 1.0f / 30.0f;
+    // Particles mode only: a particle slower than sleepSpeed for sleepSteps steps in a
+    // row falls asleep, at rest where it is. It gets no forces and is not integrated
+    // until a perturbation reaches its cell or a particle at least that fast moves
+    // within one cell of it, and it still repels awake ones. Sleepers are filed into the
+    // grid once rather than every step and reorders leave them in place, so a step costs
+    // what its awake particles do plus a pass over the grid's cells; the stats box may
+    // still include sleepers that woke, until they are next filed. 0 = never. Sleep is
+    // not part of checkpoints, a resumed run starts with every particle awake.
+    float sleepSpeed = 0.0f;
+    int sleepSteps = 30;
+    int statsHistogramBins = 0;               // Speed histogram in getStats(), 0 = off
+    float statsHistogramMaxSpeed = 500.0f;    // Upper edge of the last histogram bin
+    int reorderInterval = 0;       // Steps between storage reorders, 0 = no cadence
+    float reorderThreshold = 0.5f; // Grid scatter that triggers one, 0 = never (not in Grid mode)
+    // Scene setup, not part of checkpoints, and neither is an emitter's fraction of a
+    // particle carried over between steps
+    std::vector<Emitter> emitters;
+    std::vector<Drain> drains;
+private:
+    int width, height;
+    SolverMode mode;
+    ParticleStorage particles;
+    ThreadPool pool;
+    std::optional<SphSolver> sph;
+    std::optional<GridSolver> gridSolver;
+    std::optional<ObstacleField> obstacleField;
+
+    // Built from the current positions at the end of every step, so it is valid
+    // for both applyPerturbations and the next force pass. Unused in Grid mode.
+    SpatialHash grid;
+    AlignedVector<float> forceX, forceY;
+    // Per slot, the forces VelocityVerlet integrated the last step with, and that step's
+    // length. Empty while the last step used another integrator or no particle forces.
+    AlignedVector<float> lastForceX, lastForceY;
+    float lastForceDt = 0.0f;
+    std::vector<Perturbation> pendingPerturbations;
+    StepStatsCollector statsCollector;
+    StepStats stats;
+    float perturbedMaxSpeed = 0.0f; // Fastest particle the pending frame's perturbations left
+    uint64_t substepCount = 0;
+    uint64_t unstableUpdateCount = 0;
+    // Buffers a pass fills and drops again, sized for the largest pass up front
+    FrameArena frameArena;
+
+    MortonOrder mortonOrder;
+    AlignedVector<float> reorderScratch;
+    std::vector<uint32_t> particleIds, particleSlots, idScratch; // Empty until the first reorder or spawn
+    int stepsSinceReorder = 0;
+    uint64_t reorderCount = 0;
+
+    size_t capacity = 0;
+    std::vector<uint32_t> freeIds;    // Stack of the IDs of removed particles
+    AlignedVector<float> lifeLeft;    // Seconds per slot, empty until a particle with a lifetime spawns
+    std::vector<uint32_t> pendingRemovals;
+    struct PendingSpawn {
+        Particle particle;
+        float lifetime;
+    };
+    std::vector<PendingSpawn> pendingSpawns;
+    std::vector<float> emitterCarry;  // Fraction of a particle each emitter is owed
+    uint64_t spawnSequence = 0;       // Drives the spawn positions inside emitters
+    uint64_t spawnedCount = 0, removedCount = 0, droppedSpawns = 0;
+
+    // Awake particles are kept ahead of the sleeping ones, so the passes that skip
+    // sleepers run over a prefix of storage
+    size_t awakeCount = 0;
+    std::vector<uint16_t> stillSteps, stillScratch; // Per slot, steps in a row below sleepSpeed
+    std::vector<uint8_t> cellMarks;                 // Per grid cell, disturbed and visited bits
+    std::vector<uint32_t> markedCells, wokenSlots;
+    StatsPartial restingStats; // Count and box of the sleepers
+    bool restingStale = false; // Sleepers left or were refiled since restingStats was gathered
+
+    void computeInteractionForces();
+    bool sleepingEnabled() const { return sleepSpeed > 0.0f && mode == SolverMode::Particles; }
+    void markDisturbed(float minX, float minY, float maxX, float maxY);
+    void wakeDisturbed();
+    void sleepStill();
+    void restSleepers();
+    void wakeAll();
+    void swapSlots(size_t a, size_t b);
+    void step(float dt, bool reportStats);
+    float cflTimeStep() const;
+    void collectStats();
+    bool reorderDue() const;
+    void reorderStorage();
+    void reserveStorage();
+    void ensureParticleIds();
+    void updatePopulation(float dt, bool hasForces);
+    // removing flags the slots to remove, chunkRemovals counts them per integrate chunk
+    void removeMarked(const uint8_t* removing, const uint32_t* chunkRemovals, bool hasForces);
+    void spawn(const Particle& particle, float lifetime, bool hasForces);
+    float neighborRadius() const;
+};
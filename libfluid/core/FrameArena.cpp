@@ -0,0 +1,51 @@
+#include "FrameArena.hpp"
+
+#include <algorithm>
+
+FrameArena::FrameArena(size_t capacity) {
+    if (capacity > 0) reserve(capacity);
+}
+
+void* FrameArena::allocateBytes(size_t bytes) {
+    if (bytes == 0) return nullptr;
+    bytes = (bytes + alignment - 1) / alignment * alignment;
+    // Blocks past the current one are empty, left over from an earlier spill or Scope
+    while (block < blocks.size() && offset + bytes > blocks[block].size()) {
+        ++block;
+        offset = 0;
+    }
+    if (block == blocks.size()) {
+        blocks.emplace_back(std::max(bytes, getCapacity()));
+        ++spills;
+    }
+    void* data = blocks[block].data() + offset;
+    offset += bytes;
+    used += bytes;
+    peak = std::max(peak, used);
+    return data;
+}
+
+void FrameArena::reset() {
+    block = 0;
+    offset = 0;
+    used = 0;
+    if (blocks.size() > 1) reserve(getCapacity());
+}
+
+void FrameArena::reserve(size_t bytes) {
+    bytes = std::max(bytes, getCapacity());
+    if (bytes == 0 || (blocks.size() == 1 && blocks[0].size() >= bytes)) return;
+    bytes = (bytes + alignment - 1) / alignment * alignment;
+    // Freed first, so the old and new blocks are never held at once
+    blocks.clear();
+    blocks.emplace_back(bytes);
+    block = 0;
+    offset = 0;
+    used = 0;
+}
+
+size_t FrameArena::getCapacity() const {
+    size_t capacity = 0;
+    for (const AlignedVector<std::byte>& data : blocks) capacity += data.size();
+    return capacity;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "AlignedAllocator.hpp"
+
+// Bump allocator for scratch memory that lives no longer than a frame. An allocation
+// is an offset increment into a block reserved up front, and nothing is freed on its
+// own: a Scope hands back what was allocated since it opened, reset() everything at
+// the frame boundary. A frame that outgrows the block spills into a new one twice the
+// size, and the next reset() merges them into a single block, so after the first
+// frames a frame neither allocates nor touches an unmapped page. Blocks are zeroed
+// when allocated for the same reason. Not thread-safe: allocate before a parallel
+// loop and let the workers fill their parts.
+class FrameArena {
+public:
+    static constexpr size_t alignment = 64; // Every allocation starts on a cache line
+
+    explicit FrameArena(size_t capacity = 0);
+
+    // Rewinds the arena to where it stood when the scope opened
+    class Scope {
+    public:
+        explicit Scope(FrameArena& arena)
+            : arena(arena), block(arena.block), offset(arena.offset), used(arena.used) {}
+        ~Scope() {
+            arena.block = block;
+            arena.offset = offset;
+            arena.used = used;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        FrameArena& arena;
+        size_t block, offset, used;
+    };
+
+    // Uninitialized room for count objects of T, valid until the enclosing Scope closes
+    // or reset(). Null for a count of 0.
+    template <typename T>
+    T* allocate(size_t count) {
+        static_assert(std::is_trivially_destructible_v<T> && alignof(T) <= alignment,
+                      "Arena memory is never destroyed and is only cache-line aligned");
+        return static_cast<T*>(allocateBytes(count * sizeof(T)));
+    }
+    // Same, with every element set to value
+    template <typename T>
+    T* allocate(size_t count, const T& value) {
+        T* data = allocate<T>(count);
+        std::uninitialized_fill_n(data, count, value);
+        return data;
+    }
+
+    // Bytes allocate<T>(count) takes up, for sizing reserve()
+    template <typename T>
+    static constexpr size_t footprint(size_t count) {
+        return (count * sizeof(T) + alignment - 1) / alignment * alignment;
+    }
+
+    // Releases every allocation. Call only with no Scope open.
+    void reset();
+    // Makes the next frames fit in one block of at least bytes. Call only with no Scope open.
+    void reserve(size_t bytes);
+
+    size_t getCapacity() const;
+    size_t getUsed() const { return used; }
+    size_t getPeak() const { return peak; } // Most bytes in use at once so far
+    uint64_t getSpillCount() const { return spills; } // Blocks added mid-frame so far
+
+private:
+    std::vector<AlignedVector<std::byte>> blocks;
+    size_t block = 0;  // Block allocations come from
+    size_t offset = 0; // Bytes of it in use
+    size_t used = 0;   // Bytes in use across the blocks, padding included
+    size_t peak = 0;
+    uint64_t spills = 0;
+
+    void* allocateBytes(size_t bytes);
+};
@@ -0,0 +1,394 @@
+#include "GridSolver.hpp"
+#include "Simd.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+constexpr size_t rowGrain = 8;
+constexpr size_t tracerGrain = 16384;
+constexpr int coarsestSweeps = 40;
+
+// Bilinear sample of a w x h field at fractional index (gx, gy), clamped to the field
+inline float sampleField(const float* field, int w, int h, float gx, float gy) {
+    gx = std::clamp(gx, 0.0f, static_cast<float>(w - 1));
+    gy = std::clamp(gy, 0.0f, static_cast<float>(h - 1));
+    int i0 = static_cast<int>(gx), j0 = static_cast<int>(gy);
+    int di = i0 + 1 < w ? 1 : 0;
+    int dj = j0 + 1 < h ? w : 0;
+    float tx = gx - i0, ty = gy - j0;
+    const float* p = field + j0 * w + i0;
+    float bottom = p[0] + (p[di] - p[0]) * tx;
+    float top = p[dj] + (p[dj + di] - p[dj]) * tx;
+    return bottom + (top - bottom) * ty;
+}
+
+} // namespace
+
+GridSolver::GridSolver(int width, int height, const GridParams& params)
+    : params(params), width(static_cast<float>(width)), height(static_cast<float>(height)) {
+    nx = std::max(1, params.resolutionX);
+    h = this->width / nx;
+    ny = std::max(1, static_cast<int>(std::lround(this->height / h)));
+
+    u.assign(static_cast<size_t>(nx + 1) * ny, 0.0f);
+    v.assign(static_cast<size_t>(nx) * (ny + 1), 0.0f);
+    uNext.assign(u.size(), 0.0f);
+    vNext.assign(v.size(), 0.0f);
+
+    // Halve down to a grid small enough for plain relaxation
+    int lnx = nx, lny = ny;
+    float lh = h;
+    while (true) {
+        size_t cells = static_cast<size_t>(lnx) * lny;
+        levels.push_back({ lnx, lny, lh, AlignedVector<float>(cells, 0.0f),
+                           AlignedVector<float>(cells, 0.0f), AlignedVector<float>(cells, 0.0f) });
+        if (lnx <= 4 || lny <= 4) break;
+        lnx = (lnx + 1) / 2;
+        lny = (lny + 1) / 2;
+        lh *= 2.0f;
+    }
+    partialSums.resize(ThreadPool::chunkCount(ny, rowGrain));
+}
+
+float GridSolver::sampleU(float x, float y) const {
+    return sampleField(u.data(), nx + 1, ny, x / h, y / h - 0.5f);
+}
+
+float GridSolver::sampleV(float x, float y) const {
+    return sampleField(v.data(), nx, ny + 1, x / h - 0.5f, y / h);
+}
+
+void GridSolver::step(float dt, ThreadPool& pool) {
+    advect(dt, pool);
+    applyForces(dt, pool);
+    enforceWalls();
+    project(pool);
+}
+
+void GridSolver::advect(float dt, ThreadPool& pool) {
+    // Trace each face back along the flow with a midpoint step and pick up the
+    // velocity found there. The velocity at the face itself needs no interpolation
+    // for its own component and a four-face average for the other. Wall faces stay zero.
+    auto backtrace = [&](float x, float y, float fu, float fv, float& bx, float& by) {
+        float mx = x - 0.5f * dt * fu;
+        float my = y - 0.5f * dt * fv;
+        bx = std::clamp(x - dt * sampleU(mx, my), 0.0f, width);
+        by = std::clamp(y - dt * sampleV(mx, my), 0.0f, height);
+    };
+
+    pool.parallelFor(ny, rowGrain, [&](size_t begin, size_t end) {
+        for (size_t j = begin; j < end; ++j) {
+            float* row = uNext.data() + j * (nx + 1);
+            const float* vBelow = v.data() + j * nx;
+            const float* vAbove = vBelow + nx;
+            row[0] = row[nx] = 0.0f;
+            for (int i = 1; i < nx; ++i) {
+                float fv = 0.25f * (vBelow[i - 1] + vBelow[i] + vAbove[i - 1] + vAbove[i]);
+                float bx, by;
+                backtrace(i * h, (j + 0.5f) * h, u[j * (nx + 1) + i], fv, bx, by);
+                row[i] = sampleU(bx, by);
+            }
+        }
+    });
+    pool.parallelFor(ny + 1, rowGrain, [&](size_t begin, size_t end) {
+        for (size_t j = begin; j < end; ++j) {
+            float* row = vNext.data() + j * nx;
+            if (j == 0 || j == static_cast<size_t>(ny)) {
+                std::fill(row, row + nx, 0.0f);
+                continue;
+            }
+            const float* uBelow = u.data() + (j - 1) * (nx + 1);
+            const float* uAbove = uBelow + nx + 1;
+            for (int i = 0; i < nx; ++i) {
+                float fu = 0.25f * (uBelow[i] + uBelow[i + 1] + uAbove[i] + uAbove[i + 1]);
+                float bx, by;
+                backtrace((i + 0.5f) * h, j * h, fu, v[j * nx + i], bx, by);
+                row[i] = sampleV(bx, by);
+            }
+        }
+    });
+    u.swap(uNext);
+    v.swap(vNext);
+}
+
+void GridSolver::applyForces(float dt, ThreadPool& pool) {
+    float keep = std::max(0.0f, 1.0f - params.dissipation * dt);
+    float dv = params.gravity * dt;
+    if (keep == 1.0f && dv == 0.0f) return;
+
+    pool.parallelFor(u.size(), 16384, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) u[k] *= keep;
+    });
+    pool.parallelFor(v.size(), 16384, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) v[k] = v[k] * keep + dv;
+    });
+}
+
+void GridSolver::enforceWalls() {
+    for (int j = 0; j < ny; ++j) {
+        u[j * (nx + 1)] = 0.0f;
+        u[j * (nx + 1) + nx] = 0.0f;
+    }
+    std::fill(v.begin(), v.begin() + nx, 0.0f);
+    std::fill(v.end() - nx, v.end(), 0.0f);
+}
+
+void GridSolver::project(ThreadPool& pool) {
+    Level& top = levels[0];
+
+    // Right-hand side: the divergence of the face velocities. Solving lap(phi) = div
+    // and subtracting grad(phi) leaves a divergence-free field.
+    pool.parallelFor(ny, rowGrain, [&](size_t begin, size_t end) {
+        double sum = 0.0;
+        for (size_t j = begin; j < end; ++j) {
+            for (int i = 0; i < nx; ++i) {
+                float div = (u[j * (nx + 1) + i + 1] - u[j * (nx + 1) + i]
+                           + v[(j + 1) * nx + i] - v[j * nx + i]) / h;
+                top.rhs[j * nx + i] = div;
+                sum += div;
+            }
+        }
+        partialSums[begin / rowGrain] = sum;
+    });
+
+    // With walls all around, the equation only has a solution for zero net divergence
+    double total = 0.0;
+    for (double s : partialSums) total += s;
+    float mean = static_cast<float>(total / (static_cast<double>(nx) * ny));
+    double rhsNorm = 0.0;
+    for (float& r : top.rhs) {
+        r -= mean;
+        rhsNorm += static_cast<double>(r) * r;
+    }
+    rhsNorm = std::sqrt(rhsNorm);
+
+    lastVCycles = 0;
+    lastResidual = 0.0f;
+    if (rhsNorm > 0.0) {
+        // The previous pressure is a good first guess for a slowly changing flow
+        double residual = computeResidual(top, pool);
+        while (lastVCycles < params.maxVCycles && residual > params.tolerance * rhsNorm) {
+            vCycle(0, pool);
+            residual = computeResidual(top, pool);
+            ++lastVCycles;
+        }
+        lastResidual = static_cast<float>(residual / rhsNorm);
+    }
+
+    // Subtract the pressure gradient from the interior faces
+    const float* p = top.pressure.data();
+    pool.parallelFor(ny, rowGrain, [&](size_t begin, size_t end) {
+        for (size_t j = begin; j < end; ++j) {
+            for (int i = 1; i < nx; ++i) {
+                u[j * (nx + 1) + i] -= (p[j * nx + i] - p[j * nx + i - 1]) / h;
+            }
+            if (j > 0) {
+                for (int i = 0; i < nx; ++i) {
+                    v[j * nx + i] -= (p[j * nx + i] - p[(j - 1) * nx + i]) / h;
+                }
+            }
+        }
+    });
+}
+
+void GridSolver::smooth(Level& level, int sweeps, ThreadPool& pool) {
+    int lnx = level.nx, lny = level.ny;
+    float h2 = level.h * level.h;
+    float* p = level.pressure.data();
+    const float* rhs = level.rhs.data();
+
+    // Red-black ordering: cells of one colour only read the other, so rows of a
+    // colour can be relaxed in parallel with a deterministic result.
+    for (int sweep = 0; sweep < sweeps; ++sweep) {
+        for (int color = 0; color < 2; ++color) {
+            pool.parallelFor(lny, rowGrain, [&](size_t begin, size_t end) {
+                auto relaxEdge = [&](int i, int j) {
+                    int idx = j * lnx + i;
+                    float sum = 0.0f;
+                    int neighbors = 0;
+                    if (i > 0) { sum += p[idx - 1]; ++neighbors; }
+                    if (i < lnx - 1) { sum += p[idx + 1]; ++neighbors; }
+                    if (j > 0) { sum += p[idx - lnx]; ++neighbors; }
+                    if (j < lny - 1) { sum += p[idx + lnx]; ++neighbors; }
+                    if (neighbors > 0) {
+                        p[idx] = (sum - h2 * rhs[idx]) / neighbors;
+                    }
+                };
+                for (int j = static_cast<int>(begin); j < static_cast<int>(end); ++j) {
+                    int first = (j + color) & 1;
+                    if (j == 0 || j == lny - 1 || lnx < 3) {
+                        for (int i = first; i < lnx; i += 2) relaxEdge(i, j);
+                        continue;
+                    }
+                    // Interior cells have all four neighbours; only the row ends need checks
+                    if (first == 0) relaxEdge(0, j);
+                    float* row = p + j * lnx;
+                    const float* rhsRow = rhs + j * lnx;
+                    for (int i = first == 0 ? 2 : 1; i < lnx - 1; i += 2) {
+                        row[i] = 0.25f * (row[i - 1] + row[i + 1] + row[i - lnx] + row[i + lnx] - h2 * rhsRow[i]);
+                    }
+                    if (((lnx - 1 + j + color) & 1) == 0) relaxEdge(lnx - 1, j);
+                }
+            });
+        }
+    }
+}
+
+double GridSolver::computeResidual(Level& level, ThreadPool& pool) {
+    int lnx = level.nx, lny = level.ny;
+    float invH2 = 1.0f / (level.h * level.h);
+    const float* p = level.pressure.data();
+    size_t chunks = ThreadPool::chunkCount(lny, rowGrain);
+
+    pool.parallelFor(lny, rowGrain, [&](size_t begin, size_t end) {
+        double sum = 0.0;
+        auto residualAt = [&](int i, int j) {
+            int idx = j * lnx + i;
+            float laplacian = 0.0f;
+            if (i > 0) laplacian += p[idx - 1] - p[idx];
+            if (i < lnx - 1) laplacian += p[idx + 1] - p[idx];
+            if (j > 0) laplacian += p[idx - lnx] - p[idx];
+            if (j < lny - 1) laplacian += p[idx + lnx] - p[idx];
+            return level.rhs[idx] - laplacian * invH2;
+        };
+        for (int j = static_cast<int>(begin); j < static_cast<int>(end); ++j) {
+            float* residualRow = level.residual.data() + j * lnx;
+            float rowSum = 0.0f;
+            if (j == 0 || j == lny - 1 || lnx < 3) {
+                for (int i = 0; i < lnx; ++i) {
+                    residualRow[i] = residualAt(i, j);
+                    rowSum += residualRow[i] * residualRow[i];
+                }
+            } else {
+                const float* row = p + j * lnx;
+                const float* rhsRow = level.rhs.data() + j * lnx;
+                residualRow[0] = residualAt(0, j);
+                residualRow[lnx - 1] = residualAt(lnx - 1, j);
+                rowSum = residualRow[0] * residualRow[0] + residualRow[lnx - 1] * residualRow[lnx - 1];
+                for (int i = 1; i < lnx - 1; ++i) {
+                    float laplacian = row[i - 1] + row[i + 1] + row[i - lnx] + row[i + lnx] - 4.0f * row[i];
+                    float r = rhsRow[i] - laplacian * invH2;
+                    residualRow[i] = r;
+                    rowSum += r * r;
+                }
+            }
+            sum += rowSum;
+        }
+        partialSums[begin / rowGrain] = sum;
+    });
+
+    double total = 0.0;
+    for (size_t c = 0; c < chunks; ++c) total += partialSums[c];
+    return std::sqrt(total);
+}
+
+void GridSolver::restrictResidual(const Level& fine, Level& coarse, ThreadPool& pool) {
+    // Each coarse cell covers (up to) 2 x 2 fine cells and takes their mean
+    pool.parallelFor(coarse.ny, rowGrain, [&](size_t begin, size_t end) {
+        for (int J = static_cast<int>(begin); J < static_cast<int>(end); ++J) {
+            for (int I = 0; I < coarse.nx; ++I) {
+                float sum = 0.0f;
+                int count = 0;
+                for (int j = 2 * J; j < std::min(2 * J + 2, fine.ny); ++j) {
+                    for (int i = 2 * I; i < std::min(2 * I + 2, fine.nx); ++i) {
+                        sum += fine.residual[j * fine.nx + i];
+                        ++count;
+                    }
+                }
+                coarse.rhs[J * coarse.nx + I] = sum / count;
+                coarse.pressure[J * coarse.nx + I] = 0.0f;
+            }
+        }
+    });
+}
+
+void GridSolver::prolongateCorrection(const Level& coarse, Level& fine, ThreadPool& pool) {
+    // Bilinear interpolation between coarse cell centres
+    pool.parallelFor(fine.ny, rowGrain, [&](size_t begin, size_t end) {
+        for (int j = static_cast<int>(begin); j < static_cast<int>(end); ++j) {
+            float gy = (j + 0.5f) * 0.5f - 0.5f;
+            for (int i = 0; i < fine.nx; ++i) {
+                float gx = (i + 0.5f) * 0.5f - 0.5f;
+                fine.pressure[j * fine.nx + i] += sampleField(coarse.pressure.data(), coarse.nx, coarse.ny, gx, gy);
+            }
+        }
+    });
+}
+
+void GridSolver::vCycle(size_t depth, ThreadPool& pool) {
+    Level& level = levels[depth];
+    if (depth + 1 == levels.size()) {
+        // Keep the tiny coarsest system consistent before relaxing it to convergence
+        float mean = 0.0f;
+        for (float r : level.rhs) mean += r;
+        mean /= static_cast<float>(level.rhs.size());
+        for (float& r : level.rhs) r -= mean;
+        smooth(level, coarsestSweeps, pool);
+        return;
+    }
+
+    smooth(level, params.smoothingSweeps, pool);
+    computeResidual(level, pool);
+    restrictResidual(level, levels[depth + 1], pool);
+    vCycle(depth + 1, pool);
+    prolongateCorrection(levels[depth + 1], level, pool);
+    smooth(level, params.smoothingSweeps, pool);
+}
+
+void GridSolver::advectTracers(float dt, ParticleStorage& particles, ThreadPool& pool, StepStatsCollector* stats) const {
+    if (stats) stats->begin(particles.size(), tracerGrain);
+    pool.parallelFor(particles.size(), tracerGrain, [&](size_t begin, size_t end) {
+        StatsPartial* partial = stats ? stats->partialFor(begin) : nullptr;
+        for (size_t i = begin; i < end; ++i) {
+            float x = particles.x[i], y = particles.y[i];
+            float mx = x + 0.5f * dt * sampleU(x, y);
+            float my = y + 0.5f * dt * sampleV(x, y);
+            x = std::clamp(x + dt * sampleU(mx, my), 0.0f, width);
+            y = std::clamp(y + dt * sampleV(mx, my), 0.0f, height);
+            particles.x[i] = x;
+            particles.y[i] = y;
+            particles.vx[i] = sampleU(x, y);
+            particles.vy[i] = sampleV(x, y);
+            if (partial) partial->add(x, y, particles.vx[i], particles.vy[i]);
+        }
+    });
+}
+
+void GridSolver::addImpulse(float x, float y, float radius, float strength, float falloff) {
+    float radiusSq = radius * radius;
+    float falloffPerDistance = falloff / radius;
+    int j0 = std::max(0, static_cast<int>(std::floor((y - radius) / h)));
+    int j1 = std::min(ny, static_cast<int>(std::ceil((y + radius) / h)));
+    int i0 = std::max(0, static_cast<int>(std::floor((x - radius) / h)));
+    int i1 = std::min(nx, static_cast<int>(std::ceil((x + radius) / h)));
+
+    // Interior faces only, the walls stay closed
+    for (int j = j0; j <= std::min(j1, ny - 1); ++j) {
+        for (int i = std::max(i0, 1); i <= std::min(i1, nx - 1); ++i) {
+            float dx = i * h - x, dy = (j + 0.5f) * h - y;
+            float distSq = dx * dx + dy * dy;
+            if (distSq < radiusSq && distSq > 0.0f) {
+                float inverseDistance = reciprocalSqrt(distSq);
+                u[j * (nx + 1) + i] += strength * dx * inverseDistance * (1.0f - falloffPerDistance * distSq * inverseDistance);
+            }
+        }
+    }
+    for (int j = std::max(j0, 1); j <= std::min(j1, ny - 1); ++j) {
+        for (int i = i0; i <= std::min(i1, nx - 1); ++i) {
+            float dx = (i + 0.5f) * h - x, dy = j * h - y;
+            float distSq = dx * dx + dy * dy;
+            if (distSq < radiusSq && distSq > 0.0f) {
+                float inverseDistance = reciprocalSqrt(distSq);
+                v[j * nx + i] += strength * dy * inverseDistance * (1.0f - falloffPerDistance * distSq * inverseDistance);
+            }
+        }
+    }
+}
+
+void GridSolver::restoreState(const float* uIn, const float* vIn, const float* pressureIn) {
+    std::copy(uIn, uIn + u.size(), u.begin());
+    std::copy(vIn, vIn + v.size(), v.begin());
+    std::copy(pressureIn, pressureIn + levels[0].pressure.size(), levels[0].pressure.begin());
+}
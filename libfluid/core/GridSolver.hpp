@@ -0,0 +1,83 @@
+#pragma once
+
+#include <vector>
+
+#include "AlignedAllocator.hpp"
+#include "ParticleStorage.hpp"
+#include "StepStats.hpp"
+#include "ThreadPool.hpp"
+
+struct GridParams {
+    int resolutionX = 1024;  // Cells across the domain width; the cells are square
+    float gravity = 0.0f;    // Uniform body force along y
+    float dissipation = 0.0f; // Fraction of velocity lost per second
+    int maxVCycles = 6;
+    float tolerance = 1e-3f; // Stop once the residual drops below this fraction of the divergence
+    int smoothingSweeps = 2; // Red-black Gauss-Seidel sweeps before and after each coarse correction
+};
+
+// Eulerian smoke-style solver on a staggered (MAC) grid with solid walls at the
+// domain edges: semi-Lagrangian advection, body forces and an incompressibility
+// projection whose pressure Poisson equation is solved with geometric multigrid
+// V-cycles, warm-started from the previous step. The particles are carried along
+// as passive tracers.
+class GridSolver {
+public:
+    GridSolver(int width, int height, const GridParams& params);
+
+    void step(float dt, ThreadPool& pool);
+
+    // Moves the tracers through the current velocity field and stores the local fluid
+    // velocity on them, which is what the renderer colours by.
+    void advectTracers(float dt, ParticleStorage& particles, ThreadPool& pool, StepStatsCollector* stats = nullptr) const;
+
+    // Adds a radial velocity of the given strength to every face within radius,
+    // scaled by 1 - falloff * distance / radius as for Perturbation.
+    void addImpulse(float x, float y, float radius, float strength, float falloff = 0.0f);
+
+    int getCellsX() const { return nx; }
+    int getCellsY() const { return ny; }
+    float getCellSize() const { return h; }
+    int getLastVCycles() const { return lastVCycles; }
+    float getLastResidual() const { return lastResidual; }
+    const GridParams& getParams() const { return params; }
+
+    // Face velocities and the pressure that warm-starts the next solve, for checkpoints.
+    // restoreState expects arrays of the sizes the getters return.
+    const AlignedVector<float>& getU() const { return u; }
+    const AlignedVector<float>& getV() const { return v; }
+    const AlignedVector<float>& getPressure() const { return levels[0].pressure; }
+    void restoreState(const float* u, const float* v, const float* pressure);
+
+private:
+    struct Level {
+        int nx, ny;
+        float h;
+        AlignedVector<float> pressure, rhs, residual;
+    };
+
+    GridParams params;
+    float width, height;
+    int nx, ny;
+    float h;
+
+    // u on vertical faces ((nx + 1) x ny), v on horizontal faces (nx x (ny + 1))
+    AlignedVector<float> u, v, uNext, vNext;
+    std::vector<Level> levels; // levels[0] is the simulation grid
+    std::vector<double> partialSums;
+    int lastVCycles = 0;
+    float lastResidual = 0.0f;
+
+    float sampleU(float x, float y) const;
+    float sampleV(float x, float y) const;
+    void advect(float dt, ThreadPool& pool);
+    void applyForces(float dt, ThreadPool& pool);
+    void enforceWalls();
+    void project(ThreadPool& pool);
+
+    void smooth(Level& level, int sweeps, ThreadPool& pool);
+    double computeResidual(Level& level, ThreadPool& pool);
+    void restrictResidual(const Level& fine, Level& coarse, ThreadPool& pool);
+    void prolongateCorrection(const Level& coarse, Level& fine, ThreadPool& pool);
+    void vCycle(size_t depth, ThreadPool& pool);
+};
@@ -0,0 +1,523 @@
+#include "IntegrateKernel.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#ifdef FLUID_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// The step is split in two stages, moving (integrator and forces) and the boundary.
+// The specialized kernels instantiate both for one combination; the switch kernels
+// pick the instantiation per particle, or per vector, at run time.
+
+template <Integrator I, ForceSet F>
+inline void moveOne(const IntegrateParams& params, float& x, float& y, float& vx, float& vy, const float* forceX,
+                    const float* forceY, size_t i) {
+    if constexpr (I == Integrator::VelocityVerlet && F == ForceSet::FieldAndParticle) {
+        // The last step's velocity, finished with the force at the positions it reached
+        float halfLastDt = 0.5f * params.lastDt;
+        vx = vx + (forceX[i] - params.lastForceX[i]) * halfLastDt;
+        vy = vy + (forceY[i] - params.lastForceY[i]) * halfLastDt;
+        params.lastForceX[i] = forceX[i];
+        params.lastForceY[i] = forceY[i];
+    }
+    float oldVx = vx, oldVy = vy;
+    vx = vx * params.damping;
+    vy = vy * params.damping + params.gravity * params.dt;
+    if constexpr (F == ForceSet::FieldAndParticle) {
+        vx = vx + forceX[i] * params.dt;
+        vy = vy + forceY[i] * params.dt;
+    }
+
+    if constexpr (I == Integrator::ExplicitEuler) {
+        x += oldVx * params.dt;
+        y += oldVy * params.dt;
+    } else if constexpr (I == Integrator::SemiImplicitEuler) {
+        x += vx * params.dt;
+        y += vy * params.dt;
+    } else {
+        x += (oldVx + vx) * (0.5f * params.dt);
+        y += (oldVy + vy) * (0.5f * params.dt);
+    }
+}
+
+template <Boundary B>
+inline void boundOne(const IntegrateParams& params, float& x, float& y, float& vx, float& vy) {
+    if constexpr (B == Boundary::Reflect || B == Boundary::Clamp) {
+        // Only a velocity heading further out is flipped, so a particle that overshot
+        // comes back in over the next steps instead of flipping every step
+        if ((x < 0.0f && vx < 0.0f) || (x > params.width && vx > 0.0f)) vx = -vx;
+        if ((y < 0.0f && vy < 0.0f) || (y > params.height && vy > 0.0f)) vy = -vy;
+    }
+    if constexpr (B == Boundary::Clamp) {
+        x = std::min(std::max(x, 0.0f), params.width);
+        y = std::min(std::max(y, 0.0f), params.height);
+    }
+    if constexpr (B == Boundary::Wrap) {
+        // One period per step is enough at any sane time step. Adding zero keeps the
+        // rounding identical to the vector versions.
+        x += x < 0.0f ? params.width : 0.0f;
+        x -= x >= params.width ? params.width : 0.0f;
+        y += y < 0.0f ? params.height : 0.0f;
+        y -= y >= params.height ? params.height : 0.0f;
+    }
+}
+
+inline void moveOneSwitch(const IntegrateParams& params, float& x, float& y, float& vx, float& vy,
+                          const float* forceX, const float* forceY, size_t i) {
+    bool forces = forceX != nullptr;
+    switch (params.integrator) {
+    case Integrator::ExplicitEuler:
+        if (forces) moveOne<Integrator::ExplicitEuler, ForceSet::FieldAndParticle>(params, x, y, vx, vy, forceX, forceY, i);
+        else moveOne<Integrator::ExplicitEuler, ForceSet::Field>(params, x, y, vx, vy, forceX, forceY, i);
+        break;
+    case Integrator::SemiImplicitEuler:
+        if (forces) moveOne<Integrator::SemiImplicitEuler, ForceSet::FieldAndParticle>(params, x, y, vx, vy, forceX, forceY, i);
+        else moveOne<Integrator::SemiImplicitEuler, ForceSet::Field>(params, x, y, vx, vy, forceX, forceY, i);
+        break;
+    case Integrator::VelocityVerlet:
+        if (forces) moveOne<Integrator::VelocityVerlet, ForceSet::FieldAndParticle>(params, x, y, vx, vy, forceX, forceY, i);
+        else moveOne<Integrator::VelocityVerlet, ForceSet::Field>(params, x, y, vx, vy, forceX, forceY, i);
+        break;
+    }
+}
+
+inline void boundOneSwitch(const IntegrateParams& params, float& x, float& y, float& vx, float& vy) {
+    switch (params.boundary) {
+    case Boundary::Reflect: boundOne<Boundary::Reflect>(params, x, y, vx, vy); break;
+    case Boundary::Clamp: boundOne<Boundary::Clamp>(params, x, y, vx, vy); break;
+    case Boundary::Wrap: boundOne<Boundary::Wrap>(params, x, y, vx, vy); break;
+    case Boundary::Open: break;
+    }
+}
+
+// Also finishes the vector kernels, so Switch selects the dispatch of those too
+template <Integrator I, Boundary B, ForceSet F, bool Switch>
+void integrateTail(const IntegrateParams& params, float* x, float* y, float* vx, float* vy,
+                   const float* forceX, const float* forceY, size_t begin, size_t end, StatsPartial* stats) {
+    for (size_t i = begin; i < end; ++i) {
+        if constexpr (Switch) {
+            moveOneSwitch(params, x[i], y[i], vx[i], vy[i], forceX, forceY, i);
+            boundOneSwitch(params, x[i], y[i], vx[i], vy[i]);
+        } else {
+            moveOne<I, F>(params, x[i], y[i], vx[i], vy[i], forceX, forceY, i);
+            boundOne<B>(params, x[i], y[i], vx[i], vy[i]);
+        }
+        if (stats) stats->add(x[i], y[i], vx[i], vy[i]);
+    }
+}
+
+struct ScalarFamily {
+    template <Integrator I, Boundary B, ForceSet F, bool Switch>
+    static void run(const IntegrateParams& params, float* x, float* y, float* vx, float* vy,
+                    const float* forceX, const float* forceY, size_t begin, size_t end, StatsPartial* stats) {
+        integrateTail<I, B, F, Switch>(params, x, y, vx, vy, forceX, forceY, begin, end, stats);
+    }
+};
+
+// Lane-wise stats of the vector loops, folded into the chunk's partial in lane order
+template <size_t Lanes>
+void foldLanes(StatsPartial& stats, size_t count, const float* maxSpeedSq, const float* speedSum,
+               const float* speedSqSum, const float* minX, const float* minY, const float* maxX, const float* maxY) {
+    stats.count += count;
+    for (size_t l = 0; l < Lanes; ++l) {
+        stats.maxSpeedSq = std::max(stats.maxSpeedSq, maxSpeedSq[l]);
+        stats.speedSum += speedSum[l];
+        stats.speedSqSum += speedSqSum[l];
+        stats.minX = std::min(stats.minX, minX[l]);
+        stats.minY = std::min(stats.minY, minY[l]);
+        stats.maxX = std::max(stats.maxX, maxX[l]);
+        stats.maxY = std::max(stats.maxY, maxY[l]);
+    }
+}
+
+#ifdef FLUID_X86
+struct SSE2Constants {
+    __m128 dt, halfDt, damping, gravityDt;
+    __m128 zero, width, height, signBit;
+    __m128 halfLastDt;
+    float* lastForceX;
+    float* lastForceY;
+
+    explicit SSE2Constants(const IntegrateParams& params)
+        : dt(_mm_set1_ps(params.dt)), halfDt(_mm_set1_ps(0.5f * params.dt)), damping(_mm_set1_ps(params.damping)),
+          gravityDt(_mm_set1_ps(params.gravity * params.dt)), zero(_mm_setzero_ps()), width(_mm_set1_ps(params.width)),
+          height(_mm_set1_ps(params.height)), signBit(_mm_set1_ps(-0.0f)), halfLastDt(_mm_set1_ps(0.5f * params.lastDt)),
+          lastForceX(params.lastForceX), lastForceY(params.lastForceY) {}
+};
+
+template <Integrator I, ForceSet F>
+inline void moveSSE2(const SSE2Constants& c, __m128& px, __m128& py, __m128& pvx, __m128& pvy,
+                     const float* forceX, const float* forceY, size_t i) {
+    if constexpr (I == Integrator::VelocityVerlet && F == ForceSet::FieldAndParticle) {
+        __m128 fx = _mm_loadu_ps(forceX + i), fy = _mm_loadu_ps(forceY + i);
+        pvx = _mm_add_ps(pvx, _mm_mul_ps(_mm_sub_ps(fx, _mm_loadu_ps(c.lastForceX + i)), c.halfLastDt));
+        pvy = _mm_add_ps(pvy, _mm_mul_ps(_mm_sub_ps(fy, _mm_loadu_ps(c.lastForceY + i)), c.halfLastDt));
+        _mm_storeu_ps(c.lastForceX + i, fx);
+        _mm_storeu_ps(c.lastForceY + i, fy);
+    }
+    __m128 oldVx = pvx, oldVy = pvy;
+    pvx = _mm_mul_ps(pvx, c.damping);
+    pvy = _mm_add_ps(_mm_mul_ps(pvy, c.damping), c.gravityDt);
+    if constexpr (F == ForceSet::FieldAndParticle) {
+        pvx = _mm_add_ps(pvx, _mm_mul_ps(_mm_loadu_ps(forceX + i), c.dt));
+        pvy = _mm_add_ps(pvy, _mm_mul_ps(_mm_loadu_ps(forceY + i), c.dt));
+    }
+
+    if constexpr (I == Integrator::ExplicitEuler) {
+        px = _mm_add_ps(px, _mm_mul_ps(oldVx, c.dt));
+        py = _mm_add_ps(py, _mm_mul_ps(oldVy, c.dt));
+    } else if constexpr (I == Integrator::SemiImplicitEuler) {
+        px = _mm_add_ps(px, _mm_mul_ps(pvx, c.dt));
+        py = _mm_add_ps(py, _mm_mul_ps(pvy, c.dt));
+    } else {
+        px = _mm_add_ps(px, _mm_mul_ps(_mm_add_ps(oldVx, pvx), c.halfDt));
+        py = _mm_add_ps(py, _mm_mul_ps(_mm_add_ps(oldVy, pvy), c.halfDt));
+    }
+}
+
+template <Boundary B>
+inline void boundSSE2(const SSE2Constants& c, __m128& px, __m128& py, __m128& pvx, __m128& pvy) {
+    if constexpr (B == Boundary::Reflect || B == Boundary::Clamp) {
+        __m128 outX = _mm_or_ps(_mm_and_ps(_mm_cmplt_ps(px, c.zero), _mm_cmplt_ps(pvx, c.zero)),
+                                _mm_and_ps(_mm_cmpgt_ps(px, c.width), _mm_cmpgt_ps(pvx, c.zero)));
+        __m128 outY = _mm_or_ps(_mm_and_ps(_mm_cmplt_ps(py, c.zero), _mm_cmplt_ps(pvy, c.zero)),
+                                _mm_and_ps(_mm_cmpgt_ps(py, c.height), _mm_cmpgt_ps(pvy, c.zero)));
+        pvx = _mm_xor_ps(pvx, _mm_and_ps(outX, c.signBit));
+        pvy = _mm_xor_ps(pvy, _mm_and_ps(outY, c.signBit));
+    }
+    if constexpr (B == Boundary::Clamp) {
+        px = _mm_min_ps(_mm_max_ps(px, c.zero), c.width);
+        py = _mm_min_ps(_mm_max_ps(py, c.zero), c.height);
+    }
+    if constexpr (B == Boundary::Wrap) {
+        px = _mm_add_ps(px, _mm_and_ps(_mm_cmplt_ps(px, c.zero), c.width));
+        px = _mm_sub_ps(px, _mm_and_ps(_mm_cmpge_ps(px, c.width), c.width));
+        py = _mm_add_ps(py, _mm_and_ps(_mm_cmplt_ps(py, c.zero), c.height));
+        py = _mm_sub_ps(py, _mm_and_ps(_mm_cmpge_ps(py, c.height), c.height));
+    }
+}
+
+inline void stepSSE2Switch(const IntegrateParams& params, const SSE2Constants& c, __m128& px, __m128& py,
+                           __m128& pvx, __m128& pvy, const float* forceX, const float* forceY, size_t i) {
+    bool forces = forceX != nullptr;
+    switch (params.integrator) {
+    case Integrator::ExplicitEuler:
+        if (forces) moveSSE2<Integrator::ExplicitEuler, ForceSet::FieldAndParticle>(c, px, py, pvx, pvy, forceX, forceY, i);
+        else moveSSE2<Integrator::ExplicitEuler, ForceSet::Field>(c, px, py, pvx, pvy, forceX, forceY, i);
+        break;
+    case Integrator::SemiImplicitEuler:
+        if (forces) moveSSE2<Integrator::SemiImplicitEuler, ForceSet::FieldAndParticle>(c, px, py, pvx, pvy, forceX, forceY, i);
+        else moveSSE2<Integrator::SemiImplicitEuler, ForceSet::Field>(c, px, py, pvx, pvy, forceX, forceY, i);
+        break;
+    case Integrator::VelocityVerlet:
+        if (forces) moveSSE2<Integrator::VelocityVerlet, ForceSet::FieldAndParticle>(c, px, py, pvx, pvy, forceX, forceY, i);
+        else moveSSE2<Integrator::VelocityVerlet, ForceSet::Field>(c, px, py, pvx, pvy, forceX, forceY, i);
+        break;
+    }
+    switch (params.boundary) {
+    case Boundary::Reflect: boundSSE2<Boundary::Reflect>(c, px, py, pvx, pvy); break;
+    case Boundary::Clamp: boundSSE2<Boundary::Clamp>(c, px, py, pvx, pvy); break;
+    case Boundary::Wrap: boundSSE2<Boundary::Wrap>(c, px, py, pvx, pvy); break;
+    case Boundary::Open: break;
+    }
+}
+
+template <Integrator I, Boundary B, ForceSet F, bool Switch, bool CollectStats>
+void integrateSSE2Impl(const IntegrateParams& params, float* x, float* y, float* vx, float* vy,
+                       const float* forceX, const float* forceY, size_t begin, size_t end, StatsPartial* stats) {
+    const SSE2Constants c(params);
+    __m128 maxSpeedSq = c.zero, speedSum = c.zero, speedSqSum = c.zero;
+    __m128 minX = _mm_set1_ps(std::numeric_limits<float>::infinity()), minY = minX;
+    __m128 maxX = _mm_set1_ps(-std::numeric_limits<float>::infinity()), maxY = maxX;
+    alignas(16) float speeds[4];
+
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i);
+        __m128 pvx = _mm_loadu_ps(vx + i), pvy = _mm_loadu_ps(vy + i);
+
+        if constexpr (Switch) {
+            stepSSE2Switch(params, c, px, py, pvx, pvy, forceX, forceY, i);
+        } else {
+            moveSSE2<I, F>(c, px, py, pvx, pvy, forceX, forceY, i);
+            boundSSE2<B>(c, px, py, pvx, pvy);
+        }
+
+        _mm_storeu_ps(x + i, px); _mm_storeu_ps(y + i, py);
+        _mm_storeu_ps(vx + i, pvx); _mm_storeu_ps(vy + i, pvy);
+
+        if constexpr (CollectStats) {
+            __m128 speedSq = _mm_add_ps(_mm_mul_ps(pvx, pvx), _mm_mul_ps(pvy, pvy));
+            __m128 speed = _mm_sqrt_ps(speedSq);
+            maxSpeedSq = _mm_max_ps(maxSpeedSq, speedSq);
+            speedSum = _mm_add_ps(speedSum, speed);
+            speedSqSum = _mm_add_ps(speedSqSum, speedSq);
+            minX = _mm_min_ps(minX, px); minY = _mm_min_ps(minY, py);
+            maxX = _mm_max_ps(maxX, px); maxY = _mm_max_ps(maxY, py);
+            if (stats->histogram) {
+                _mm_store_ps(speeds, speed);
+                for (float s : speeds) stats->addHistogram(s);
+            }
+        }
+    }
+    if constexpr (CollectStats) {
+        alignas(16) float lanes[7][4];
+        _mm_store_ps(lanes[0], maxSpeedSq); _mm_store_ps(lanes[1], speedSum); _mm_store_ps(lanes[2], speedSqSum);
+        _mm_store_ps(lanes[3], minX); _mm_store_ps(lanes[4], minY); _mm_store_ps(lanes[5], maxX); _mm_store_ps(lanes[6], maxY);
+        foldLanes<4>(*stats, i - begin, lanes[0], lanes[1], lanes[2], lanes[3], lanes[4], lanes[5], lanes[6]);
+    }
+    integrateTail<I, B, F, Switch>(params, x, y, vx, vy, forceX, forceY, i, end, stats);
+}
+
+struct SSE2Family {
+    template <Integrator I, Boundary B, ForceSet F, bool Switch>
+    static void run(const IntegrateParams& params, float* x, float* y, float* vx, float* vy,
+                    const float* forceX, const float* forceY, size_t begin, size_t end, StatsPartial* stats) {
+        if (stats) {
+            integrateSSE2Impl<I, B, F, Switch, true>(params, x, y, vx, vy, forceX, forceY, begin, end, stats);
+        } else {
+            integrateSSE2Impl<I, B, F, Switch, false>(params, x, y, vx, vy, forceX, forceY, begin, end, nullptr);
+        }
+    }
+};
+
+struct AVX2Constants {
+    __m256 dt, halfDt, damping, gravityDt;
+    __m256 zero, width, height, signBit;
+    __m256 halfLastDt;
+    float* lastForceX;
+    float* lastForceY;
+
+    FLUID_TARGET_AVX2
+    explicit AVX2Constants(const IntegrateParams& params)
+        : dt(_mm256_set1_ps(params.dt)), halfDt(_mm256_set1_ps(0.5f * params.dt)),
+          damping(_mm256_set1_ps(params.damping)), gravityDt(_mm256_set1_ps(params.gravity * params.dt)),
+          zero(_mm256_setzero_ps()), width(_mm256_set1_ps(params.width)), height(_mm256_set1_ps(params.height)),
+          signBit(_mm256_set1_ps(-0.0f)), halfLastDt(_mm256_set1_ps(0.5f * params.lastDt)),
+          lastForceX(params.lastForceX), lastForceY(params.lastForceY) {}
+};
+
+template <Integrator I, ForceSet F>
+FLUID_TARGET_AVX2
+inline void moveAVX2(const AVX2Constants& c, __m256& px, __m256& py, __m256& pvx, __m256& pvy,
+                     const float* forceX, const float* forceY, size_t i) {
+    if constexpr (I == Integrator::VelocityVerlet && F == ForceSet::FieldAndParticle) {
+        __m256 fx = _mm256_loadu_ps(forceX + i), fy = _mm256_loadu_ps(forceY + i);
+        pvx = _mm256_add_ps(pvx, _mm256_mul_ps(_mm256_sub_ps(fx, _mm256_loadu_ps(c.lastForceX + i)), c.halfLastDt));
+        pvy = _mm256_add_ps(pvy, _mm256_mul_ps(_mm256_sub_ps(fy, _mm256_loadu_ps(c.lastForceY + i)), c.halfLastDt));
+        _mm256_storeu_ps(c.lastForceX + i, fx);
+        _mm256_storeu_ps(c.lastForceY + i, fy);
+    }
+    __m256 oldVx = pvx, oldVy = pvy;
+    pvx = _mm256_mul_ps(pvx, c.damping);
+    pvy = _mm256_add_ps(_mm256_mul_ps(pvy, c.damping), c.gravityDt);
+    if constexpr (F == ForceSet::FieldAndParticle) {
+        pvx = _mm256_add_ps(pvx, _mm256_mul_ps(_mm256_loadu_ps(forceX + i), c.dt));
+        pvy = _mm256_add_ps(pvy, _mm256_mul_ps(_mm256_loadu_ps(forceY + i), c.dt));
+    }
+
+    if constexpr (I == Integrator::ExplicitEuler) {
+        px = _mm256_add_ps(px, _mm256_mul_ps(oldVx, c.dt));
+        py = _mm256_add_ps(py, _mm256_mul_ps(oldVy, c.dt));
+    } else if constexpr (I == Integrator::SemiImplicitEuler) {
+        px = _mm256_add_ps(px, _mm256_mul_ps(pvx, c.dt));
+        py = _mm256_add_ps(py, _mm256_mul_ps(pvy, c.dt));
+    } else {
+        px = _mm256_add_ps(px, _mm256_mul_ps(_mm256_add_ps(oldVx, pvx), c.halfDt));
+        py = _mm256_add_ps(py, _mm256_mul_ps(_mm256_add_ps(oldVy, pvy), c.halfDt));
+    }
+}
+
+template <Boundary B>
+FLUID_TARGET_AVX2
+inline void boundAVX2(const AVX2Constants& c, __m256& px, __m256& py, __m256& pvx, __m256& pvy) {
+    if constexpr (B == Boundary::Reflect || B == Boundary::Clamp) {
+        __m256 outX = _mm256_or_ps(
+            _mm256_and_ps(_mm256_cmp_ps(px, c.zero, _CMP_LT_OQ), _mm256_cmp_ps(pvx, c.zero, _CMP_LT_OQ)),
+            _mm256_and_ps(_mm256_cmp_ps(px, c.width, _CMP_GT_OQ), _mm256_cmp_ps(pvx, c.zero, _CMP_GT_OQ)));
+        __m256 outY = _mm256_or_ps(
+            _mm256_and_ps(_mm256_cmp_ps(py, c.zero, _CMP_LT_OQ), _mm256_cmp_ps(pvy, c.zero, _CMP_LT_OQ)),
+            _mm256_and_ps(_mm256_cmp_ps(py, c.height, _CMP_GT_OQ), _mm256_cmp_ps(pvy, c.zero, _CMP_GT_OQ)));
+        pvx = _mm256_xor_ps(pvx, _mm256_and_ps(outX, c.signBit));
+        pvy = _mm256_xor_ps(pvy, _mm256_and_ps(outY, c.signBit));
+    }
+    if constexpr (B == Boundary::Clamp) {
+        px = _mm256_min_ps(_mm256_max_ps(px, c.zero), c.width);
+        py = _mm256_min_ps(_mm256_max_ps(py, c.zero), c.height);
+    }
+    if constexpr (B == Boundary::Wrap) {
+        px = _mm256_add_ps(px, _mm256_and_ps(_mm256_cmp_ps(px, c.zero, _CMP_LT_OQ), c.width));
+        px = _mm256_sub_ps(px, _mm256_and_ps(_mm256_cmp_ps(px, c.width, _CMP_GE_OQ), c.width));
+        py = _mm256_add_ps(py, _mm256_and_ps(_mm256_cmp_ps(py, c.zero, _CMP_LT_OQ), c.height));
+        py = _mm256_sub_ps(py, _mm256_and_ps(_mm256_cmp_ps(py, c.height, _CMP_GE_OQ), c.height));
+    }
+}
+
+FLUID_TARGET_AVX2
+inline void stepAVX2Switch(const IntegrateParams& params, const AVX2Constants& c, __m256& px, __m256& py,
+                           __m256& pvx, __m256& pvy, const float* forceX, const float* forceY, size_t i) {
+    bool forces = forceX != nullptr;
+    switch (params.integrator) {
+    case Integrator::ExplicitEuler:
+        if (forces) moveAVX2<Integrator::ExplicitEuler, ForceSet::FieldAndParticle>(c, px, py, pvx, pvy, forceX, forceY, i);
+        else moveAVX2<Integrator::ExplicitEuler, ForceSet::Field>(c, px, py, pvx, pvy, forceX, forceY, i);
+        break;
+    case Integrator::SemiImplicitEuler:
+        if (forces) moveAVX2<Integrator::SemiImplicitEuler, ForceSet::FieldAndParticle>(c, px, py, pvx, pvy, forceX, forceY, i);
+        else moveAVX2<Integrator::SemiImplicitEuler, ForceSet::Field>(c, px, py, pvx, pvy, forceX, forceY, i);
+        break;
+    case Integrator::VelocityVerlet:
+        if (forces) moveAVX2<Integrator::VelocityVerlet, ForceSet::FieldAndParticle>(c, px, py, pvx, pvy, forceX, forceY, i);
+        else moveAVX2<Integrator::VelocityVerlet, ForceSet::Field>(c, px, py, pvx, pvy, forceX, forceY, i);
+        break;
+    }
+    switch (params.boundary) {
+    case Boundary::Reflect: boundAVX2<Boundary::Reflect>(c, px, py, pvx, pvy); break;
+    case Boundary::Clamp: boundAVX2<Boundary::Clamp>(c, px, py, pvx, pvy); break;
+    case Boundary::Wrap: boundAVX2<Boundary::Wrap>(c, px, py, pvx, pvy); break;
+    case Boundary::Open: break;
+    }
+}
+
+template <Integrator I, Boundary B, ForceSet F, bool Switch, bool CollectStats>
+FLUID_TARGET_AVX2
+void integrateAVX2Impl(const IntegrateParams& params, float* x, float* y, float* vx, float* vy,
+                       const float* forceX, const float* forceY, size_t begin, size_t end, StatsPartial* stats) {
+    const AVX2Constants c(params);
+    __m256 maxSpeedSq = c.zero, speedSum = c.zero, speedSqSum = c.zero;
+    __m256 minX = _mm256_set1_ps(std::numeric_limits<float>::infinity()), minY = minX;
+    __m256 maxX = _mm256_set1_ps(-std::numeric_limits<float>::infinity()), maxY = maxX;
+    alignas(32) float speeds[8];
+
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i);
+        __m256 pvx = _mm256_loadu_ps(vx + i), pvy = _mm256_loadu_ps(vy + i);
+
+        if constexpr (Switch) {
+            stepAVX2Switch(params, c, px, py, pvx, pvy, forceX, forceY, i);
+        } else {
+            moveAVX2<I, F>(c, px, py, pvx, pvy, forceX, forceY, i);
+            boundAVX2<B>(c, px, py, pvx, pvy);
+        }
+
+        _mm256_storeu_ps(x + i, px); _mm256_storeu_ps(y + i, py);
+        _mm256_storeu_ps(vx + i, pvx); _mm256_storeu_ps(vy + i, pvy);
+
+        if constexpr (CollectStats) {
+            __m256 speedSq = _mm256_add_ps(_mm256_mul_ps(pvx, pvx), _mm256_mul_ps(pvy, pvy));
+            __m256 speed = _mm256_sqrt_ps(speedSq);
+            maxSpeedSq = _mm256_max_ps(maxSpeedSq, speedSq);
+            speedSum = _mm256_add_ps(speedSum, speed);
+            speedSqSum = _mm256_add_ps(speedSqSum, speedSq);
+            minX = _mm256_min_ps(minX, px); minY = _mm256_min_ps(minY, py);
+            maxX = _mm256_max_ps(maxX, px); maxY = _mm256_max_ps(maxY, py);
+            if (stats->histogram) {
+                _mm256_store_ps(speeds, speed);
+                for (float s : speeds) stats->addHistogram(s);
+            }
+        }
+    }
+    if constexpr (CollectStats) {
+        alignas(32) float lanes[7][8];
+        _mm256_store_ps(lanes[0], maxSpeedSq); _mm256_store_ps(lanes[1], speedSum); _mm256_store_ps(lanes[2], speedSqSum);
+        _mm256_store_ps(lanes[3], minX); _mm256_store_ps(lanes[4], minY);
+        _mm256_store_ps(lanes[5], maxX); _mm256_store_ps(lanes[6], maxY);
+        foldLanes<8>(*stats, i - begin, lanes[0], lanes[1], lanes[2], lanes[3], lanes[4], lanes[5], lanes[6]);
+    }
+    integrateTail<I, B, F, Switch>(params, x, y, vx, vy, forceX, forceY, i, end, stats);
+}
+
+struct AVX2Family {
+    template <Integrator I, Boundary B, ForceSet F, bool Switch>
+    FLUID_TARGET_AVX2
+    static void run(const IntegrateParams& params, float* x, float* y, float* vx, float* vy,
+                    const float* forceX, const float* forceY, size_t begin, size_t end, StatsPartial* stats) {
+        if (stats) {
+            integrateAVX2Impl<I, B, F, Switch, true>(params, x, y, vx, vy, forceX, forceY, begin, end, stats);
+        } else {
+            integrateAVX2Impl<I, B, F, Switch, false>(params, x, y, vx, vy, forceX, forceY, begin, end, nullptr);
+        }
+    }
+};
+#endif
+
+// Runtime values to instantiations, one level at a time
+template <typename Family, Integrator I, Boundary B>
+IntegrateKernel selectForces(ForceSet forces) {
+    if (forces == ForceSet::FieldAndParticle) return &Family::template run<I, B, ForceSet::FieldAndParticle, false>;
+    return &Family::template run<I, B, ForceSet::Field, false>;
+}
+
+template <typename Family, Integrator I>
+IntegrateKernel selectBoundary(Boundary boundary, ForceSet forces) {
+    switch (boundary) {
+    case Boundary::Clamp: return selectForces<Family, I, Boundary::Clamp>(forces);
+    case Boundary::Wrap: return selectForces<Family, I, Boundary::Wrap>(forces);
+    case Boundary::Open: return selectForces<Family, I, Boundary::Open>(forces);
+    default: return selectForces<Family, I, Boundary::Reflect>(forces);
+    }
+}
+
+template <typename Family>
+IntegrateKernel selectKernel(Integrator integrator, Boundary boundary, ForceSet forces) {
+    switch (integrator) {
+    case Integrator::SemiImplicitEuler: return selectBoundary<Family, Integrator::SemiImplicitEuler>(boundary, forces);
+    case Integrator::VelocityVerlet: return selectBoundary<Family, Integrator::VelocityVerlet>(boundary, forces);
+    default: return selectBoundary<Family, Integrator::ExplicitEuler>(boundary, forces);
+    }
+}
+
+template <typename Family>
+IntegrateKernel switchKernel() {
+    return &Family::template run<Integrator::ExplicitEuler, Boundary::Reflect, ForceSet::Field, true>;
+}
+
+} // namespace
+
+IntegrateKernel getIntegrateKernel(SimdLevel level, Integrator integrator, Boundary boundary, ForceSet forces) {
+#ifdef FLUID_X86
+    switch (level) {
+    case SimdLevel::AVX2: return selectKernel<AVX2Family>(integrator, boundary, forces);
+    case SimdLevel::SSE2: return selectKernel<SSE2Family>(integrator, boundary, forces);
+    default: break;
+    }
+#else
+    (void)level;
+#endif
+    return selectKernel<ScalarFamily>(integrator, boundary, forces);
+}
+
+IntegrateKernel getSwitchIntegrateKernel(SimdLevel level) {
+#ifdef FLUID_X86
+    switch (level) {
+    case SimdLevel::AVX2: return switchKernel<AVX2Family>();
+    case SimdLevel::SSE2: return switchKernel<SSE2Family>();
+    default: break;
+    }
+#else
+    (void)level;
+#endif
+    return switchKernel<ScalarFamily>();
+}
+
+const char* integratorName(Integrator integrator) {
+    switch (integrator) {
+    case Integrator::SemiImplicitEuler: return "semi-implicit";
+    case Integrator::VelocityVerlet: return "verlet";
+    default: return "euler";
+    }
+}
+
+const char* boundaryName(Boundary boundary) {
+    switch (boundary) {
+    case Boundary::Clamp: return "clamp";
+    case Boundary::Wrap: return "wrap";
+    case Boundary::Open: return "open";
+    default: return "reflect";
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+
+#include "Simd.hpp"
+#include "StepStats.hpp"
+
+enum class Integrator {
+    ExplicitEuler,     // Moves with the velocity from before the step
+    SemiImplicitEuler, // Moves with the updated velocity (symplectic Euler)
+    VelocityVerlet,    // x += v dt + a dt^2 / 2, then v += (a + a') dt / 2 with a' the force
+                       // at the new positions. That is only known next step, so the velocity
+                       // is left as v + a dt and the next step adds (a' - a) dt / 2 first.
+};
+
+enum class Boundary {
+    Reflect, // Velocity flipped outside [0, width] x [0, height] while it points away from the domain
+    Clamp,   // Also pulled back onto the edge
+    Wrap,    // Periodic, a particle leaving [0, width) x [0, height) re-enters opposite
+    Open,    // Left alone; FluidSimulator removes the particles that leave
+};
+
+enum class ForceSet {
+    Field,            // Damping and gravity
+    FieldAndParticle, // Plus a force per particle
+};
+
+struct IntegrateParams {
+    float dt;
+    float damping;
+    float gravity;
+    float width, height;
+    // Only read by the runtime switch kernels; the others are compiled for one of each
+    Integrator integrator = Integrator::ExplicitEuler;
+    Boundary boundary = Boundary::Reflect;
+    // VelocityVerlet with particle forces only: the forces of the previous step, each
+    // replaced by this step's, and that step's length, 0 to skip the correction
+    float* lastForceX = nullptr;
+    float* lastForceY = nullptr;
+    float lastDt = 0.0f;
+};
+
+// One step with damping, gravity, optional per-particle forces and the boundary over
+// particles [begin, end). Every variant of a combination produces bit-identical
+// particles; the vector ones handle the edges with masks instead of branches.
+// With stats non-null the new state is also folded into it on the way out; the
+// vector variants sum per lane, so sums may differ from the scalar one in the last bits.
+// forceX and forceY are read only by ForceSet::FieldAndParticle kernels.
+using IntegrateKernel = void (*)(const IntegrateParams& params, float* x, float* y, float* vx, float* vy,
+                                 const float* forceX, const float* forceY, size_t begin, size_t end,
+                                 StatsPartial* stats);
+
+// Kernel compiled for one integrator, boundary and force set, so its loop has no
+// per-particle dispatch. Look it up once per step, not per chunk.
+IntegrateKernel getIntegrateKernel(SimdLevel level, Integrator integrator, Boundary boundary, ForceSet forces);
+
+// Single kernel that switches on params.integrator, params.boundary and a null
+// forceX inside the loop. Same results as the specialized ones; kept to measure them against.
+IntegrateKernel getSwitchIntegrateKernel(SimdLevel level);
+
+const char* integratorName(Integrator integrator);
+const char* boundaryName(Boundary boundary);
@@ -0,0 +1,111 @@
+#include "MortonOrder.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Fixed so that the sort is independent of the thread count, as in SpatialHash
+constexpr size_t sortBlocks = 16;
+constexpr size_t minBlockSize = 4096;
+constexpr size_t keyGrain = 16384;
+constexpr int digitBits = 8;
+constexpr uint32_t digitCount = 1u << digitBits;
+constexpr int maxCellCoord = 0xFFFF; // Coordinates are interleaved as 16 bits each
+
+// Spreads the low 16 bits of v to the even bit positions
+uint32_t spreadBits(uint32_t v) {
+    v &= 0xFFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+uint32_t mortonCode(uint32_t cx, uint32_t cy) {
+    return spreadBits(cx) | (spreadBits(cy) << 1);
+}
+
+} // namespace
+
+void MortonOrder::sort(const ParticleView& particles, float cellSize, int width, int height, ThreadPool& pool,
+                       FrameArena& arena) {
+    const size_t count = particles.size();
+    const float invCellSize = 1.0f / cellSize;
+    const int cellsX = std::clamp(static_cast<int>(std::ceil(width * invCellSize)), 1, maxCellCoord + 1);
+    const int cellsY = std::clamp(static_cast<int>(std::ceil(height * invCellSize)), 1, maxCellCoord + 1);
+    auto cellCoord = [&](float v, int cells) {
+        return std::clamp(static_cast<int>(std::floor(v * invCellSize)), 0, cells - 1);
+    };
+
+    FrameArena::Scope scratch(arena);
+    uint32_t* keys = arena.allocate<uint32_t>(count);
+    order.resize(count);
+    pool.parallelFor(count, keyGrain, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            keys[i] = mortonCode(cellCoord(particles.x[i], cellsX), cellCoord(particles.y[i], cellsY));
+            order[i] = static_cast<uint32_t>(i);
+        }
+    });
+
+    // The code grows with either coordinate, so the last cell has the largest one
+    const uint32_t maxKey = mortonCode(cellsX - 1, cellsY - 1);
+    const size_t blocks = std::clamp<size_t>(count / minBlockSize, 1, sortBlocks);
+    const size_t blockSize = (count + blocks - 1) / blocks;
+    uint32_t* keyScratch = arena.allocate<uint32_t>(count);
+    // Per-block digit histograms, then scatter cursors
+    uint32_t* blockOffsets = arena.allocate<uint32_t>(blocks * digitCount);
+    orderScratch.resize(count);
+
+    for (int shift = 0; shift < 32 && (maxKey >> shift) != 0; shift += digitBits) {
+        std::fill_n(blockOffsets, blocks * digitCount, 0u);
+        pool.parallelFor(blocks, 1, [&](size_t block, size_t) {
+            uint32_t* histogram = blockOffsets + block * digitCount;
+            size_t end = std::min(count, (block + 1) * blockSize);
+            for (size_t i = block * blockSize; i < end; ++i) {
+                ++histogram[(keys[i] >> shift) & (digitCount - 1)];
+            }
+        });
+
+        // Digit-major, then block order: earlier blocks come first within a digit,
+        // which keeps every pass stable
+        uint32_t offset = 0;
+        for (uint32_t digit = 0; digit < digitCount; ++digit) {
+            for (size_t block = 0; block < blocks; ++block) {
+                uint32_t& entry = blockOffsets[block * digitCount + digit];
+                uint32_t n = entry;
+                entry = offset;
+                offset += n;
+            }
+        }
+
+        pool.parallelFor(blocks, 1, [&](size_t block, size_t) {
+            uint32_t* cursor = blockOffsets + block * digitCount;
+            size_t end = std::min(count, (block + 1) * blockSize);
+            for (size_t i = block * blockSize; i < end; ++i) {
+                uint32_t slot = cursor[(keys[i] >> shift) & (digitCount - 1)]++;
+                keyScratch[slot] = keys[i];
+                orderScratch[slot] = order[i];
+            }
+        });
+        std::swap(keys, keyScratch);
+        std::swap(order, orderScratch);
+    }
+}
+
+void MortonOrder::partition(uint32_t split) {
+    orderScratch.resize(order.size());
+    auto front = std::copy_if(order.begin(), order.end(), orderScratch.begin(), [&](uint32_t slot) { return slot < split; });
+    std::copy_if(order.begin(), order.end(), front, [&](uint32_t slot) { return slot >= split; });
+    std::swap(order, orderScratch);
+}
+
+size_t MortonOrder::scratchBytes(size_t count) {
+    return 2 * FrameArena::footprint<uint32_t>(count) + FrameArena::footprint<uint32_t>(sortBlocks * digitCount);
+}
+
+void MortonOrder::reserve(size_t count) {
+    order.reserve(count);
+    orderScratch.reserve(count);
+}
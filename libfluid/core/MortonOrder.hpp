@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "FrameArena.hpp"
+#include "ParticleStorage.hpp"
+#include "ThreadPool.hpp"
+
+// Order of the particles along a Z-order (Morton) curve over a grid of cells, so that
+// particles close in space become close in memory. The key of a particle is its cell
+// coordinates with their bits interleaved. Keys are sorted with a parallel LSD radix
+// sort of 8-bit digits over a fixed number of blocks, which keeps the order stable and
+// independent of the thread count, and only as many digits are sorted as the largest
+// key has.
+class MortonOrder {
+public:
+    // Sorts by cells of cellSize over [0, width] x [0, height]. Particles outside the
+    // domain count into the nearest border cell, as in SpatialHash. Afterwards slot k
+    // of the new order is the particle now at getOrder()[k]. The keys live in arena for
+    // the duration of the sort.
+    void sort(const ParticleView& particles, float cellSize, int width, int height, ThreadPool& pool,
+              FrameArena& arena);
+    // Arena space sort() takes for count particles
+    static size_t scratchBytes(size_t count);
+
+    const std::vector<uint32_t>& getOrder() const { return order; }
+    // Moves the particles from slots below split ahead of the others, each group
+    // keeping its curve order
+    void partition(uint32_t split);
+    // Grows the order buffers up front so sorting up to count particles never allocates
+    void reserve(size_t count);
+
+    // Gathers array into the new order. scratch receives the old contents and is kept
+    // by the caller so its storage is reused next time. Elements past the sorted
+    // particles, when array has more, stay where they are.
+    template <typename Vector>
+    void apply(Vector& array, Vector& scratch, ThreadPool& pool) const;
+
+private:
+    std::vector<uint32_t> order, orderScratch;
+};
+
+template <typename Vector>
+void MortonOrder::apply(Vector& array, Vector& scratch, ThreadPool& pool) const {
+    scratch.resize(order.size());
+    pool.parallelFor(order.size(), 16384, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            scratch[k] = array[order[k]];
+        }
+    });
+    if (order.size() == array.size()) {
+        std::swap(array, scratch);
+    } else {
+        std::copy(scratch.begin(), scratch.end(), array.begin());
+    }
+}
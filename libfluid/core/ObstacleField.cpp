@@ -0,0 +1,260 @@
+#include "ObstacleField.hpp"
+#include "Profiler.hpp"
+#include "Simd.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+constexpr size_t collideGrain = 16384;
+constexpr int pushIterations = 4;
+constexpr float minGradientSq = 0.25f; // Caps a push step at twice the depth
+
+float circleDistance(const Obstacle& obstacle, float px, float py) {
+    float dx = px - obstacle.x, dy = py - obstacle.y;
+    return std::sqrt(dx * dx + dy * dy) - obstacle.radius;
+}
+
+// Distance to the nearest edge, negative where an even-odd crossing test puts the
+// point inside
+float polygonDistance(const Obstacle& obstacle, float px, float py) {
+    const std::vector<float>& points = obstacle.points;
+    size_t count = points.size() / 2;
+    px -= obstacle.x;
+    py -= obstacle.y;
+    float nearestSq = (px - points[0]) * (px - points[0]) + (py - points[1]) * (py - points[1]);
+    bool inside = false;
+    for (size_t i = 0, j = count - 1; i < count; j = i++) {
+        float ax = points[2 * i], ay = points[2 * i + 1];
+        float ex = points[2 * j] - ax, ey = points[2 * j + 1] - ay;
+        float wx = px - ax, wy = py - ay;
+        float t = std::clamp((wx * ex + wy * ey) / (ex * ex + ey * ey), 0.0f, 1.0f);
+        float bx = wx - ex * t, by = wy - ey * t;
+        nearestSq = std::min(nearestSq, bx * bx + by * by);
+        bool above = py >= ay, belowNext = py < points[2 * j + 1];
+        bool left = ex * wy > ey * wx;
+        if ((above && belowNext && left) || (!above && !belowNext && !left)) inside = !inside;
+    }
+    float distance = std::sqrt(nearestSq);
+    return inside ? -distance : distance;
+}
+
+float obstacleDistance(const Obstacle& obstacle, float px, float py) {
+    return obstacle.shape == Obstacle::Shape::Circle ? circleDistance(obstacle, px, py)
+                                                     : polygonDistance(obstacle, px, py);
+}
+
+} // namespace
+
+std::vector<Obstacle> loadObstacles(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("Cannot open obstacle scene " + path);
+    }
+    std::vector<Obstacle> obstacles;
+    std::string line;
+    for (int lineNumber = 1; std::getline(file, line); ++lineNumber) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string kind;
+        if (!(fields >> kind)) continue;
+
+        auto malformed = [&](const char* what) {
+            return std::runtime_error(path + ":" + std::to_string(lineNumber) + ": " + what);
+        };
+        Obstacle obstacle;
+        if (kind == "circle") {
+            obstacle.shape = Obstacle::Shape::Circle;
+            if (!(fields >> obstacle.x >> obstacle.y >> obstacle.radius) || !(obstacle.radius > 0.0f)) {
+                throw malformed("circle needs X Y and a positive RADIUS");
+            }
+        } else if (kind == "polygon") {
+            obstacle.shape = Obstacle::Shape::Polygon;
+            float value;
+            while (fields >> value) obstacle.points.push_back(value);
+            if (obstacle.points.size() < 6 || obstacle.points.size() % 2 != 0) {
+                throw malformed("polygon needs at least three X Y vertices");
+            }
+            // Vertices relative to their mean, which becomes the position
+            size_t count = obstacle.points.size() / 2;
+            for (size_t i = 0; i < count; ++i) {
+                obstacle.x += obstacle.points[2 * i] / count;
+                obstacle.y += obstacle.points[2 * i + 1] / count;
+            }
+            for (size_t i = 0; i < count; ++i) {
+                obstacle.points[2 * i] -= obstacle.x;
+                obstacle.points[2 * i + 1] -= obstacle.y;
+            }
+        } else {
+            throw malformed("expected circle or polygon");
+        }
+        if (!fields.eof()) {
+            fields.clear();
+            std::string rest;
+            if (fields >> rest) throw malformed("unexpected trailing text");
+        }
+        obstacles.push_back(std::move(obstacle));
+    }
+    return obstacles;
+}
+
+ObstacleField::ObstacleField(int width, int height, std::vector<Obstacle> obstacles, ThreadPool& pool, float cellSize,
+                             float band)
+    : width(width), height(height), cellSize(cellSize), invCellSize(1.0f / cellSize), band(band),
+      obstacles(std::move(obstacles)) {
+    if (!(cellSize > 0.0f) || !(band > 0.0f)) {
+        throw std::invalid_argument("Obstacle field cell size and band must be positive");
+    }
+    for (const Obstacle& obstacle : this->obstacles) {
+        bool valid = obstacle.shape == Obstacle::Shape::Circle
+                         ? obstacle.radius > 0.0f
+                         : obstacle.points.size() >= 6 && obstacle.points.size() % 2 == 0;
+        if (!valid) {
+            throw std::invalid_argument("Obstacles need a positive radius or at least three vertices");
+        }
+    }
+    samplesX = static_cast<int>(std::ceil(width * invCellSize)) + 1;
+    samplesY = static_cast<int>(std::ceil(height * invCellSize)) + 1;
+    samplesX = std::max(samplesX, 2);
+    samplesY = std::max(samplesY, 2);
+    distance.assign(static_cast<size_t>(samplesX) * samplesY, band);
+    bounds.resize(this->obstacles.size());
+    for (size_t i = 0; i < this->obstacles.size(); ++i) {
+        updateBounds(i);
+    }
+    bake({ 0.0f, 0.0f, (samplesX - 1) * cellSize, (samplesY - 1) * cellSize }, pool);
+}
+
+void ObstacleField::updateBounds(size_t index) {
+    const Obstacle& obstacle = obstacles[index];
+    Bounds& box = bounds[index];
+    if (obstacle.shape == Obstacle::Shape::Circle) {
+        box = { obstacle.x - obstacle.radius, obstacle.y - obstacle.radius,
+                obstacle.x + obstacle.radius, obstacle.y + obstacle.radius };
+    } else {
+        box = { obstacle.x, obstacle.y, obstacle.x, obstacle.y };
+        for (size_t i = 0; i < obstacle.points.size(); i += 2) {
+            box.minX = std::min(box.minX, obstacle.x + obstacle.points[i]);
+            box.maxX = std::max(box.maxX, obstacle.x + obstacle.points[i]);
+            box.minY = std::min(box.minY, obstacle.y + obstacle.points[i + 1]);
+            box.maxY = std::max(box.maxY, obstacle.y + obstacle.points[i + 1]);
+        }
+    }
+    box.minX -= band;
+    box.minY -= band;
+    box.maxX += band;
+    box.maxY += band;
+}
+
+void ObstacleField::bake(const Bounds& region, ThreadPool& pool) {
+    int i0 = std::max(0, static_cast<int>(std::ceil(region.minX * invCellSize)));
+    int j0 = std::max(0, static_cast<int>(std::ceil(region.minY * invCellSize)));
+    int i1 = std::min(samplesX - 1, static_cast<int>(std::floor(region.maxX * invCellSize)));
+    int j1 = std::min(samplesY - 1, static_cast<int>(std::floor(region.maxY * invCellSize)));
+    if (i0 > i1 || j0 > j1) return;
+
+    nearby.clear();
+    for (size_t o = 0; o < obstacles.size(); ++o) {
+        const Bounds& box = bounds[o];
+        if (box.minX <= region.maxX && box.maxX >= region.minX && box.minY <= region.maxY && box.maxY >= region.minY) {
+            nearby.push_back(o);
+        }
+    }
+
+    // Outside every grown box the capped distance is band, so only those are evaluated
+    pool.parallelFor(static_cast<size_t>(j1 - j0 + 1), 4, [&](size_t begin, size_t end) {
+        for (int j = j0 + static_cast<int>(begin); j < j0 + static_cast<int>(end); ++j) {
+            float py = j * cellSize;
+            for (int i = i0; i <= i1; ++i) {
+                float px = i * cellSize;
+                float d = band;
+                for (size_t o : nearby) {
+                    const Bounds& box = bounds[o];
+                    if (px >= box.minX && px <= box.maxX && py >= box.minY && py <= box.maxY) {
+                        d = std::min(d, obstacleDistance(obstacles[o], px, py));
+                    }
+                }
+                distance[static_cast<size_t>(j) * samplesX + i] = d;
+            }
+        }
+    });
+    lastRebakedSamples += static_cast<size_t>(i1 - i0 + 1) * (j1 - j0 + 1);
+}
+
+void ObstacleField::move(size_t index, float x, float y, ThreadPool& pool) {
+    if (index >= obstacles.size()) {
+        throw std::out_of_range("No obstacle " + std::to_string(index));
+    }
+    FLUID_PROFILE_SCOPE("obstacle rebake");
+    Bounds before = bounds[index];
+    obstacles[index].x = x;
+    obstacles[index].y = y;
+    updateBounds(index);
+    const Bounds& after = bounds[index];
+
+    // Overlapping regions are baked as one, so no sample is evaluated twice
+    lastRebakedSamples = 0;
+    if (before.minX <= after.maxX && before.maxX >= after.minX && before.minY <= after.maxY && before.maxY >= after.minY) {
+        bake({ std::min(before.minX, after.minX), std::min(before.minY, after.minY),
+               std::max(before.maxX, after.maxX), std::max(before.maxY, after.maxY) }, pool);
+    } else {
+        bake(before, pool);
+        bake(after, pool);
+    }
+}
+
+float ObstacleField::sample(float x, float y, float& gradientX, float& gradientY) const {
+    float gx = std::clamp(x * invCellSize, 0.0f, static_cast<float>(samplesX - 1));
+    float gy = std::clamp(y * invCellSize, 0.0f, static_cast<float>(samplesY - 1));
+    int i = std::min(static_cast<int>(gx), samplesX - 2);
+    int j = std::min(static_cast<int>(gy), samplesY - 2);
+    float fx = gx - i, fy = gy - j;
+
+    const float* row = distance.data() + static_cast<size_t>(j) * samplesX + i;
+    float d00 = row[0], d10 = row[1];
+    float d01 = row[samplesX], d11 = row[samplesX + 1];
+    float top = d00 + (d10 - d00) * fx;
+    float bottom = d01 + (d11 - d01) * fx;
+    gradientX = ((d10 - d00) * (1.0f - fy) + (d11 - d01) * fy) * invCellSize;
+    gradientY = (bottom - top) * invCellSize;
+    return top + (bottom - top) * fy;
+}
+
+void ObstacleField::collide(ParticleStorage& particles, size_t count, float restitution, ThreadPool& pool) const {
+    if (obstacles.empty()) return;
+    pool.parallelFor(std::min(count, particles.size()), collideGrain, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            float gradientX, gradientY;
+            float d = sample(particles.x[i], particles.y[i], gradientX, gradientY);
+            if (!(d < 0.0f)) continue;
+            float lengthSq = gradientX * gradientX + gradientY * gradientY;
+            if (lengthSq == 0.0f) continue; // Flat spot, no direction to push in
+            float inverseLength = reciprocalSqrt(lengthSq);
+            float nx = gradientX * inverseLength, ny = gradientY * inverseLength;
+
+            // Newton steps onto the zero level. Where the gradient averages the normals
+            // of two edges, at a corner or the middle of a thin obstacle, it is shorter
+            // than 1 and a step of d along it alone would stop short of the surface.
+            for (int k = 0; k < pushIterations && d < 0.0f && lengthSq > 0.0f; ++k) {
+                float scale = d / std::max(lengthSq, minGradientSq);
+                particles.x[i] -= scale * gradientX;
+                particles.y[i] -= scale * gradientY;
+                d = sample(particles.x[i], particles.y[i], gradientX, gradientY);
+                lengthSq = gradientX * gradientX + gradientY * gradientY;
+            }
+
+            // Only a velocity into the obstacle is reflected, so one already leaving it is kept
+            float normalSpeed = particles.vx[i] * nx + particles.vy[i] * ny;
+            if (normalSpeed < 0.0f) {
+                float change = (1.0f + restitution) * normalSpeed;
+                particles.vx[i] -= change * nx;
+                particles.vy[i] -= change * ny;
+            }
+        }
+    });
+}
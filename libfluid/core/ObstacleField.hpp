@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "AlignedAllocator.hpp"
+#include "ParticleStorage.hpp"
+#include "ThreadPool.hpp"
+
+struct Obstacle {
+    enum class Shape { Circle, Polygon };
+
+    Shape shape = Shape::Circle;
+    float x = 0.0f, y = 0.0f; // Circle centre, polygon origin (the mean of its vertices as loaded)
+    float radius = 0.0f;      // Circle only
+    std::vector<float> points; // Polygon vertices relative to (x, y), as x, y pairs, either winding
+};
+
+// Reads obstacles from a scene description, one per line, '#' starting a comment:
+//   circle X Y RADIUS
+//   polygon X1 Y1 X2 Y2 X3 Y3 ...
+// Throws std::runtime_error naming the line of the first malformed entry.
+std::vector<Obstacle> loadObstacles(const std::string& path);
+
+// Static obstacles baked into a signed distance field sampled at the corners of square
+// cells: negative inside an obstacle, positive outside, the union taking the minimum.
+// A particle's collision test is one bilinear lookup, and the gradient of the same
+// four samples gives the push-out direction, however many obstacles there are.
+// Positive distances are capped at band, which bounds the region an obstacle affects
+// to its bounding box grown by band, so moving one only rebakes that region.
+class ObstacleField {
+public:
+    struct Bounds {
+        float minX, minY, maxX, maxY;
+    };
+
+    // Throws std::invalid_argument for a non-positive cell size or band, or a degenerate
+    // obstacle. Keep band above the distance a particle travels in a step.
+    ObstacleField(int width, int height, std::vector<Obstacle> obstacles, ThreadPool& pool, float cellSize = 4.0f,
+                  float band = 16.0f);
+
+    // Moves obstacle index so its position is (x, y) and rebakes the cells it left and entered
+    void move(size_t index, float x, float y, ThreadPool& pool);
+
+    // Pushes the first count particles that are inside an obstacle out onto its surface
+    // along the gradient. Velocity into the obstacle is reflected and scaled by
+    // restitution, 0 stopping it.
+    void collide(ParticleStorage& particles, size_t count, float restitution, ThreadPool& pool) const;
+
+    // Interpolated distance at (x, y), with the gradient of the interpolation. Points
+    // outside the domain read the nearest border cell.
+    float sample(float x, float y, float& gradientX, float& gradientY) const;
+
+    const std::vector<Obstacle>& getObstacles() const { return obstacles; }
+    float getCellSize() const { return cellSize; }
+    float getBand() const { return band; }
+    size_t getSampleCount() const { return distance.size(); }
+    size_t getLastRebakedSamples() const { return lastRebakedSamples; }
+    // Region obstacle index affects, its bounding box grown by band
+    const Bounds& getBounds(size_t index) const { return bounds[index]; }
+
+private:
+    int width, height;
+    float cellSize, invCellSize;
+    float band;
+    int samplesX, samplesY; // Cell corners, one more than the cells each way
+    std::vector<Obstacle> obstacles;
+    std::vector<Bounds> bounds; // Per obstacle, grown by band
+    AlignedVector<float> distance;
+    std::vector<size_t> nearby; // Obstacles overlapping the region being baked
+    size_t lastRebakedSamples = 0;
+
+    void updateBounds(size_t index);
+    void bake(const Bounds& region, ThreadPool& pool);
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+
+#include "AlignedAllocator.hpp"
+
+struct Particle {
+    float x, y;
+    float vx, vy; // Velocity
+};
+
+// Read-only structure-of-arrays view of the particle set, as handed to consumers
+// such as the renderer. Indexing yields a Particle by value.
+struct ParticleView {
+    const float* x = nullptr;
+    const float* y = nullptr;
+    const float* vx = nullptr;
+    const float* vy = nullptr;
+    size_t count = 0;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    Particle operator[](size_t i) const { return { x[i], y[i], vx[i], vy[i] }; }
+};
+
+// Particle state stored as separate aligned arrays so the integration kernel can
+// load full SIMD registers of a single component.
+struct ParticleStorage {
+    AlignedVector<float> x, y;
+    AlignedVector<float> vx, vy;
+
+    size_t size() const { return x.size(); }
+
+    void reserve(size_t n) {
+        x.reserve(n); y.reserve(n);
+        vx.reserve(n); vy.reserve(n);
+    }
+
+    void push_back(const Particle& p) {
+        x.push_back(p.x); y.push_back(p.y);
+        vx.push_back(p.vx); vy.push_back(p.vy);
+    }
+
+    ParticleView view() const {
+        return { x.data(), y.data(), vx.data(), vy.data(), x.size() };
+    }
+};
@@ -0,0 +1,170 @@
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+
+namespace {
+
+struct TrackRegistry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ProfileTrack>> tracks; // Never shrinks; tracks outlive their threads
+};
+
+TrackRegistry& registry() {
+    static TrackRegistry instance;
+    return instance;
+}
+
+ProfileTrack* addTrack(TrackRegistry& reg, std::string name) {
+    int id = static_cast<int>(reg.tracks.size()) + 1;
+    if (name.empty()) name = "thread " + std::to_string(id);
+    reg.tracks.push_back(std::make_unique<ProfileTrack>(std::move(name), id));
+    return reg.tracks.back().get();
+}
+
+// Nearest-rank percentile of sorted values
+double percentile(const std::vector<double>& sorted, double p) {
+    size_t rank = static_cast<size_t>(std::ceil(p * static_cast<double>(sorted.size())));
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+void writeJsonString(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') out << '\\';
+        out << c;
+    }
+    out << '"';
+}
+
+} // namespace
+
+thread_local ProfileTrack* Profiler::threadTrack = nullptr;
+
+ProfileTrack::ProfileTrack(std::string name, int id)
+    : name(std::move(name)), id(id), events(new ProfileEvent[capacity]) {}
+
+std::vector<ProfileEvent> ProfileTrack::snapshot() const {
+    uint64_t end = written.load(std::memory_order_acquire);
+    uint64_t begin = end > capacity ? end - capacity : 0;
+    std::vector<ProfileEvent> result;
+    result.reserve(static_cast<size_t>(end - begin));
+    for (uint64_t i = begin; i < end; ++i) {
+        result.push_back(events[i & (capacity - 1)]);
+    }
+    return result;
+}
+
+uint64_t Profiler::now() {
+    using Clock = std::chrono::steady_clock;
+    static const Clock::time_point epoch = Clock::now();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch).count());
+}
+
+ProfileTrack* Profiler::registerThread() {
+    TrackRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    threadTrack = addTrack(reg, {});
+    return threadTrack;
+}
+
+void Profiler::setThreadName(const std::string& name) {
+    if constexpr (!profilingEnabled) return;
+    TrackRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    if (threadTrack) {
+        threadTrack->name = name;
+    } else {
+        threadTrack = addTrack(reg, name);
+    }
+}
+
+ProfileTrack& Profiler::namedTrack(const std::string& name) {
+    TrackRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (auto& track : reg.tracks) {
+        if (track->name == name) return *track;
+    }
+    return *addTrack(reg, name);
+}
+
+std::vector<PhaseSummary> Profiler::summarize(double windowSeconds) {
+    uint64_t cutoff = now();
+    uint64_t window = static_cast<uint64_t>(windowSeconds * 1e9);
+    cutoff = cutoff > window ? cutoff - window : 0;
+
+    std::map<std::string, std::vector<double>> durations;
+    {
+        TrackRegistry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for (auto& track : reg.tracks) {
+            for (const ProfileEvent& event : track->snapshot()) {
+                if (event.name && event.start + event.duration >= cutoff) {
+                    durations[event.name].push_back(event.duration * 1e-6);
+                }
+            }
+        }
+    }
+
+    std::vector<PhaseSummary> summaries;
+    for (auto& [name, values] : durations) {
+        std::sort(values.begin(), values.end());
+        PhaseSummary summary;
+        summary.name = name;
+        summary.samples = values.size();
+        summary.p50 = percentile(values, 0.50);
+        summary.p99 = percentile(values, 0.99);
+        summary.max = values.back();
+        summaries.push_back(std::move(summary));
+    }
+    return summaries;
+}
+
+void Profiler::printSummary(std::ostream& out, double windowSeconds) {
+    std::vector<PhaseSummary> summaries = summarize(windowSeconds);
+    if (summaries.empty()) return;
+    char line[128];
+    std::snprintf(line, sizeof(line), "%-24s %8s %10s %10s %10s", "phase", "samples", "p50 ms", "p99 ms", "max ms");
+    out << line << "\n";
+    for (const PhaseSummary& s : summaries) {
+        std::snprintf(line, sizeof(line), "%-24s %8zu %10.3f %10.3f %10.3f", s.name.c_str(), s.samples, s.p50, s.p99, s.max);
+        out << line << "\n";
+    }
+    out.flush();
+}
+
+void Profiler::writeChromeTrace(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("Cannot write trace file " + path);
+    }
+
+    TrackRegistry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    char number[64];
+    for (auto& track : reg.tracks) {
+        out << (first ? "\n" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << track->id
+            << ",\"args\":{\"name\":";
+        writeJsonString(out, track->name);
+        out << "}}";
+        first = false;
+        for (const ProfileEvent& event : track->snapshot()) {
+            if (!event.name) continue;
+            // Microseconds with nanosecond precision
+            std::snprintf(number, sizeof(number), "%.3f,\"dur\":%.3f", event.start * 1e-3, event.duration * 1e-3);
+            out << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << track->id << ",\"name\":";
+            writeJsonString(out, event.name);
+            out << ",\"ts\":" << number << "}";
+        }
+    }
+    out << "\n]}\n";
+}
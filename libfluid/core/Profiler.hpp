@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Scoped wall-clock timers for the frame phases. Every thread records into its own
+// fixed-size ring of events, so recording is a clock read and a store, never an
+// allocation or a lock. Built with FLUID_PROFILING undefined, the scope macros expand
+// to nothing and the export functions see no events.
+#ifdef FLUID_PROFILING
+constexpr bool profilingEnabled = true;
+#else
+constexpr bool profilingEnabled = false;
+#endif
+
+struct ProfileEvent {
+    const char* name = nullptr; // Must outlive the profiler, normally a string literal
+    uint64_t start = 0;         // Nanoseconds since the profiler epoch
+    uint64_t duration = 0;
+};
+
+// Rolling statistics of one phase, in milliseconds
+struct PhaseSummary {
+    std::string name;
+    size_t samples = 0;
+    double p50 = 0.0, p99 = 0.0, max = 0.0;
+};
+
+// One ring of events with a single writer. Readers take whatever is in the ring at the
+// time; events the writer overwrites while being read may come out torn, so exports
+// are best taken between frames.
+class ProfileTrack {
+public:
+    static constexpr size_t capacity = 1 << 14;
+
+    explicit ProfileTrack(std::string name, int id);
+
+    void record(const char* eventName, uint64_t start, uint64_t end) {
+        uint64_t index = written.load(std::memory_order_relaxed);
+        events[index & (capacity - 1)] = { eventName, start, end - start };
+        written.store(index + 1, std::memory_order_release);
+    }
+
+    const std::string& getName() const { return name; }
+    int getId() const { return id; }
+    std::vector<ProfileEvent> snapshot() const;
+
+private:
+    std::string name;
+    int id;
+    std::unique_ptr<ProfileEvent[]> events;
+    std::atomic<uint64_t> written{ 0 };
+
+    friend class Profiler;
+};
+
+class Profiler {
+public:
+    // Nanoseconds since the first call, on the steady clock
+    static uint64_t now();
+
+    // Records into the calling thread's track, registering it on first use
+    static void record(const char* name, uint64_t start, uint64_t end) {
+        ProfileTrack* track = threadTrack;
+        if (!track) track = registerThread();
+        track->record(name, start, end);
+    }
+
+    // Names the calling thread's track in exports (default "thread N")
+    static void setThreadName(const std::string& name);
+
+    // A named track not tied to a thread, e.g. for GPU timings. It must only be
+    // written from one thread at a time.
+    static ProfileTrack& namedTrack(const std::string& name);
+
+    // Per-phase percentiles over the events that ended in the last windowSeconds
+    static std::vector<PhaseSummary> summarize(double windowSeconds);
+    static void printSummary(std::ostream& out, double windowSeconds);
+
+    // Chrome trace-event JSON, loadable in chrome://tracing or Perfetto
+    static void writeChromeTrace(const std::string& path);
+
+private:
+    static thread_local ProfileTrack* threadTrack;
+    static ProfileTrack* registerThread();
+};
+
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name) : name(name), start(Profiler::now()) {}
+    ~ProfileScope() { Profiler::record(name, start, Profiler::now()); }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    const char* name;
+    uint64_t start;
+};
+
+#define FLUID_PROFILE_CONCAT_INNER(a, b) a##b
+#define FLUID_PROFILE_CONCAT(a, b) FLUID_PROFILE_CONCAT_INNER(a, b)
+
+#ifdef FLUID_PROFILING
+#define FLUID_PROFILE_SCOPE(name) ProfileScope FLUID_PROFILE_CONCAT(profileScope, __LINE__)(name)
+#else
+#define FLUID_PROFILE_SCOPE(name) ((void)0)
+#endif
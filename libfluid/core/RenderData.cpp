@@ -0,0 +1,171 @@
+#include "RenderData.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef FLUID_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+template <typename Speed>
+constexpr float speedCodeMax() { return sizeof(Speed) == 1 ? 255.0f : 65535.0f; }
+
+constexpr float positionCodeMax = 65535.0f;
+
+inline uint32_t quantize(float value, float scale, float codeMax) {
+    float q = std::min(std::max(value * scale, 0.0f), codeMax);
+    return static_cast<uint32_t>(std::nearbyint(q));
+}
+
+template <typename Speed>
+void packCompactTail(const ParticleView& particles, const CompactPackParams& params, uint32_t* positions,
+                     Speed* speeds, size_t begin, size_t end) {
+    const float scaleX = positionCodeMax / params.width;
+    const float scaleY = positionCodeMax / params.height;
+    const float scaleSpeed = speedCodeMax<Speed>() / params.maxSpeed;
+    for (size_t i = begin; i < end; ++i) {
+        float speed = std::sqrt(particles.vx[i] * particles.vx[i] + particles.vy[i] * particles.vy[i]);
+        positions[i] = quantize(particles.x[i], scaleX, positionCodeMax) |
+                       quantize(particles.y[i], scaleY, positionCodeMax) << 16;
+        speeds[i] = static_cast<Speed>(quantize(speed, scaleSpeed, speedCodeMax<Speed>()));
+    }
+}
+
+template <typename Speed>
+void packCompactScalar(const ParticleView& particles, const CompactPackParams& params, uint32_t* positions,
+                       void* speeds, size_t begin, size_t end) {
+    packCompactTail(particles, params, positions, static_cast<Speed*>(speeds), begin, end);
+}
+
+#ifdef FLUID_X86
+// Narrows four 32-bit codes to 8 or 16 bits. SSE2 only packs with signed saturation,
+// so 16-bit codes are biased into the signed range and back.
+inline __m128i narrowBiased16(__m128i lo, __m128i hi) {
+    const __m128i bias = _mm_set1_epi32(32768);
+    __m128i packed = _mm_packs_epi32(_mm_sub_epi32(lo, bias), _mm_sub_epi32(hi, bias));
+    return _mm_xor_si128(packed, _mm_set1_epi16(static_cast<short>(0x8000)));
+}
+
+template <typename Speed>
+void packCompactSSE2(const ParticleView& particles, const CompactPackParams& params, uint32_t* positions,
+                     void* speedOut, size_t begin, size_t end) {
+    Speed* speeds = static_cast<Speed*>(speedOut);
+    const __m128 scaleX = _mm_set1_ps(positionCodeMax / params.width);
+    const __m128 scaleY = _mm_set1_ps(positionCodeMax / params.height);
+    const __m128 scaleSpeed = _mm_set1_ps(speedCodeMax<Speed>() / params.maxSpeed);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 positionMax = _mm_set1_ps(positionCodeMax);
+    const __m128 speedMax = _mm_set1_ps(speedCodeMax<Speed>());
+
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 vx = _mm_loadu_ps(particles.vx + i), vy = _mm_loadu_ps(particles.vy + i);
+        __m128i qx = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(particles.x + i), scaleX), zero), positionMax));
+        __m128i qy = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(particles.y + i), scaleY), zero), positionMax));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(positions + i), _mm_or_si128(qx, _mm_slli_epi32(qy, 16)));
+
+        __m128 speed = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)));
+        __m128i qs = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(speed, scaleSpeed), zero), speedMax));
+        if constexpr (sizeof(Speed) == 1) {
+            __m128i packed = _mm_packus_epi16(_mm_packs_epi32(qs, qs), _mm_setzero_si128());
+            int bytes = _mm_cvtsi128_si32(packed);
+            std::memcpy(speeds + i, &bytes, 4);
+        } else {
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(speeds + i), narrowBiased16(qs, qs));
+        }
+    }
+    packCompactTail(particles, params, positions, speeds, i, end);
+}
+
+template <typename Speed>
+FLUID_TARGET_AVX2
+void packCompactAVX2(const ParticleView& particles, const CompactPackParams& params, uint32_t* positions,
+                     void* speedOut, size_t begin, size_t end) {
+    Speed* speeds = static_cast<Speed*>(speedOut);
+    const __m256 scaleX = _mm256_set1_ps(positionCodeMax / params.width);
+    const __m256 scaleY = _mm256_set1_ps(positionCodeMax / params.height);
+    const __m256 scaleSpeed = _mm256_set1_ps(speedCodeMax<Speed>() / params.maxSpeed);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 positionMax = _mm256_set1_ps(positionCodeMax);
+    const __m256 speedMax = _mm256_set1_ps(speedCodeMax<Speed>());
+
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        __m256 vx = _mm256_loadu_ps(particles.vx + i), vy = _mm256_loadu_ps(particles.vy + i);
+        __m256i qx = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(particles.x + i), scaleX), zero), positionMax));
+        __m256i qy = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(particles.y + i), scaleY), zero), positionMax));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(positions + i), _mm256_or_si256(qx, _mm256_slli_epi32(qy, 16)));
+
+        __m256 speed = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)));
+        __m256i qs = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(speed, scaleSpeed), zero), speedMax));
+        // 256-bit packs work per 128-bit lane, narrowing the two halves keeps the order
+        __m128i lo = _mm256_castsi256_si128(qs), hi = _mm256_extracti128_si256(qs, 1);
+        if constexpr (sizeof(Speed) == 1) {
+            __m128i packed = _mm_packus_epi16(_mm_packs_epi32(lo, hi), _mm_setzero_si128());
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(speeds + i), packed);
+        } else {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(speeds + i), _mm_packus_epi32(lo, hi));
+        }
+    }
+    packCompactTail(particles, params, positions, speeds, i, end);
+}
+#endif
+
+} // namespace
+
+float computeMaxSpeed(const ParticleView& particles) {
+    // Compare squared speeds, one square root at the end
+    float maxSpeedSq = 0.0f;
+    for (size_t i = 0; i < particles.size(); ++i) {
+        maxSpeedSq = std::max(maxSpeedSq, particles.vx[i] * particles.vx[i] + particles.vy[i] * particles.vy[i]);
+    }
+    return std::sqrt(maxSpeedSq);
+}
+
+size_t vertexArrayCount(VertexFormat format) {
+    return format == VertexFormat::Float32 ? 4 : 2;
+}
+
+size_t vertexElementBytes(VertexFormat format, size_t array) {
+    switch (format) {
+    case VertexFormat::Compact16: return array == 0 ? sizeof(uint32_t) : sizeof(uint16_t);
+    case VertexFormat::Compact8: return array == 0 ? sizeof(uint32_t) : sizeof(uint8_t);
+    default: return sizeof(float);
+    }
+}
+
+size_t vertexBytesPerParticle(VertexFormat format) {
+    size_t bytes = 0;
+    for (size_t a = 0; a < vertexArrayCount(format); ++a) {
+        bytes += vertexElementBytes(format, a);
+    }
+    return bytes;
+}
+
+void writeVertexData(const ParticleView& particles, void* const* destinations) {
+    const float* arrays[4] = { particles.x, particles.y, particles.vx, particles.vy };
+    for (size_t a = 0; a < 4; ++a) {
+        std::memcpy(destinations[a], arrays[a], particles.size() * sizeof(float));
+    }
+}
+
+CompactPackKernel getCompactPackKernel(VertexFormat format, SimdLevel level) {
+    if (format == VertexFormat::Float32) {
+        throw std::invalid_argument("Float32 vertices are not packed");
+    }
+    bool wide = format == VertexFormat::Compact16;
+#ifdef FLUID_X86
+    switch (level) {
+    case SimdLevel::AVX2: return wide ? packCompactAVX2<uint16_t> : packCompactAVX2<uint8_t>;
+    case SimdLevel::SSE2: return wide ? packCompactSSE2<uint16_t> : packCompactSSE2<uint8_t>;
+    default: break;
+    }
+#else
+    (void)level;
+#endif
+    return wide ? packCompactScalar<uint16_t> : packCompactScalar<uint8_t>;
+}
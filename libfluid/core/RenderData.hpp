@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ParticleStorage.hpp"
+#include "Simd.hpp"
+
+// CPU-side preparation of what the renderer draws, kept free of GL so it can be
+// benchmarked and reused by other front ends.
+
+// Largest particle speed, the normalisation of the velocity colour ramp.
+float computeMaxSpeed(const ParticleView& particles);
+
+enum class VertexFormat {
+    Float32,   // x, y, vx and vy as floats, 16 bytes per particle
+    Compact16, // x and y as 16-bit fractions of the domain, speed / max speed in 16 bits: 6 bytes
+    Compact8,  // Same with an 8-bit speed: 5 bytes
+};
+
+// Vertex arrays of a format, each holding one element per particle. Float32 has
+// x, y, vx and vy; the compact formats have packed positions and speeds.
+constexpr size_t maxVertexArrays = 4;
+size_t vertexArrayCount(VertexFormat format);
+size_t vertexElementBytes(VertexFormat format, size_t array);
+size_t vertexBytesPerParticle(VertexFormat format);
+
+// Float32: copies the four arrays to destinations[0..3]
+void writeVertexData(const ParticleView& particles, void* const* destinations);
+
+struct CompactPackParams {
+    float width, height; // Domain that maps onto [0, 65535]
+    float maxSpeed;      // Speed that maps onto the largest speed code
+};
+
+// Packs particles [begin, end): positions[i] holds x in the low and y in the high 16
+// bits, speeds[i] is a uint16_t (Compact16) or uint8_t (Compact8). Values are rounded
+// to nearest and clamped; every variant produces identical bytes.
+using CompactPackKernel = void (*)(const ParticleView& particles, const CompactPackParams& params,
+                                   uint32_t* positions, void* speeds, size_t begin, size_t end);
+
+CompactPackKernel getCompactPackKernel(VertexFormat format, SimdLevel level);
+
+// Bloom applied by both renderers after drawing the particles. The scene is halved
+// `levels` times with the dual-Kawase downsample, the smallest level gets a separable
+// linear-sampled Gaussian, and the dual-Kawase upsample brings it back to half
+// resolution, where the composite adds it to the scene, scaled by `strength`.
+// Level 0 skips the chain and shows the scene as drawn.
+constexpr int maxBloomLevels = 6;
+
+struct BloomSettings {
+    int levels = 3;        // Clamped to [0, maxBloomLevels]
+    float strength = 0.5f;
+};
+
+// Size of pyramid level `level` (0 is half resolution) for a scene dimension
+inline int bloomLevelSize(int size, int level) {
+    int scaled = size >> (level + 1);
+    return scaled > 0 ? scaled : 1;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FLUID_X86 1
+#include <xmmintrin.h>
+#endif
+
+// Functions using AVX2 intrinsics are compiled for that target individually and only
+// called after the runtime check, so the rest of the build stays at the baseline ISA.
+#if defined(FLUID_X86) && (defined(__GNUC__) || defined(__clang__))
+#define FLUID_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define FLUID_TARGET_AVX2
+#endif
+
+enum class SimdLevel {
+    Scalar,
+    SSE2,
+    AVX2,
+};
+
+// Highest instruction set supported by both the CPU and the OS.
+SimdLevel detectSimdLevel();
+const char* simdLevelName(SimdLevel level);
+
+// 1 / sqrt(value) for value > 0: the hardware estimate refined by one Newton step,
+// within a few ulp of the exact result and without a divide
+inline float reciprocalSqrt(float value) {
+#ifdef FLUID_X86
+    float estimate = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(value)));
+    return estimate * (1.5f - 0.5f * value * estimate * estimate);
+#else
+    return 1.0f / std::sqrt(value);
+#endif
+}
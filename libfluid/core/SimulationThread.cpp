@@ -0,0 +1,142 @@
+#include "SimulationThread.hpp"
+#include "AllocationAudit.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+namespace {
+
+// Steps after which every buffer of the loop has grown to its working size, and
+// allocation audit builds start checking that they stay that way
+constexpr uint64_t auditWarmupSteps = 10;
+
+} // namespace
+
+SimulationThread::SimulationThread(FluidSimulator& simulator, float timeStep, int maxStepsPerTick,
+                                   TrajectoryRecorder* recorder)
+    : simulator(simulator), timeStep(timeStep), maxStepsPerTick(maxStepsPerTick), recorder(recorder) {
+    if (!(timeStep >= 0.0f) || maxStepsPerTick < 1) {
+        throw std::invalid_argument("Simulation time step must not be negative and steps per tick must be positive");
+    }
+    // The renderer gets the initial state right away
+    publish();
+    thread = std::thread(&SimulationThread::run, this);
+}
+
+SimulationThread::~SimulationThread() {
+    stop();
+}
+
+void SimulationThread::stop() {
+    stopping.store(true, std::memory_order_relaxed);
+    if (thread.joinable()) thread.join();
+    // The last snapshot may still be lent to the recorder
+    if (recorder) recorder->waitForCopy();
+}
+
+bool SimulationThread::addPerturbation(const Perturbation& perturbation) {
+    return commands.tryPush(perturbation);
+}
+
+void SimulationThread::rethrowIfFailed() {
+    if (failed.load(std::memory_order_acquire)) {
+        std::rethrow_exception(failure);
+    }
+}
+
+void SimulationThread::publish(bool toRecorder) {
+    FLUID_PROFILE_SCOPE("publish");
+    // The buffer about to be filled may be the one last lent to the recorder
+    if (recorder) recorder->waitForCopy();
+    ParticleView view = simulator.getParticles();
+    ParticleSnapshot& snapshot = snapshots.writeBuffer();
+    snapshot.particles.reserve(simulator.getParticleCapacity());
+    // assign() reuses the buffer's storage once it has grown to the particle count
+    snapshot.particles.x.assign(view.x, view.x + view.count);
+    snapshot.particles.y.assign(view.y, view.y + view.count);
+    snapshot.particles.vx.assign(view.vx, view.vx + view.count);
+    snapshot.particles.vy.assign(view.vy, view.vy + view.count);
+    snapshot.stats = simulator.getStats();
+    snapshot.step = stepCount.load(std::memory_order_relaxed);
+    snapshot.time = simulatedTime;
+    if (toRecorder) {
+        const uint32_t* slots = simulator.getParticleSlots();
+        size_t idCount = simulator.getParticleIdCount();
+        if (slots) {
+            // IDs keep growing past the capacity while emitters run, so grow ahead of them
+            if (idCount > snapshot.slotOfId.capacity()) {
+                snapshot.slotOfId.reserve(std::max(simulator.getParticleCapacity(), 2 * idCount));
+            }
+            snapshot.slotOfId.assign(slots, slots + idCount);
+        }
+        recorder->recordBorrowed(snapshot.particles.view(), snapshot.step, snapshot.time,
+                                 slots ? snapshot.slotOfId.data() : nullptr, idCount);
+    }
+    snapshots.publish();
+}
+
+void SimulationThread::drainCommands() {
+    // Queued on the simulator, which applies them as one batch in the step
+    Perturbation perturbation;
+    bool any = false;
+    while (commands.tryPop(perturbation)) {
+        simulator.addPerturbation(perturbation);
+        any = true;
+    }
+    // An adaptive step has to see the speeds the perturbations leave behind
+    if (any && timeStep == adaptiveTimeStep) simulator.applyPerturbations();
+}
+
+float SimulationThread::nextTimeStep() const {
+    return timeStep == adaptiveTimeStep ? simulator.frameTimeStep() : timeStep;
+}
+
+void SimulationThread::run() {
+    using Clock = std::chrono::steady_clock;
+    Profiler::setThreadName("simulation");
+
+    try {
+        auto last = Clock::now();
+        std::chrono::duration<double> accumulator(0.0);
+
+        while (!stopping.load(std::memory_order_relaxed)) {
+            auto now = Clock::now();
+            accumulator += now - last;
+            last = now;
+
+            int steps = 0;
+            drainCommands();
+            float dt = nextTimeStep();
+            auto stepDuration = std::chrono::duration<double>(dt);
+            while (accumulator >= stepDuration && steps < maxStepsPerTick) {
+                NoAllocationScope audit(stepCount.load(std::memory_order_relaxed) >= auditWarmupSteps);
+                simulator.update(dt);
+                simulatedTime += dt;
+                stepCount.fetch_add(1, std::memory_order_relaxed);
+                // Every step is a trajectory frame, so each one is published
+                if (recorder) publish(true);
+                accumulator -= stepDuration;
+                ++steps;
+                drainCommands();
+                dt = nextTimeStep();
+                stepDuration = std::chrono::duration<double>(dt);
+            }
+            if (accumulator >= stepDuration) {
+                // Behind by more than a tick: run slow instead of trying to catch up
+                accumulator = std::chrono::duration<double>(0.0);
+            }
+
+            if (steps > 0 && !recorder) {
+                NoAllocationScope audit(stepCount.load(std::memory_order_relaxed) > auditWarmupSteps);
+                publish();
+            } else if (steps == 0) {
+                std::this_thread::sleep_for(stepDuration - accumulator);
+            }
+        }
+    } catch (...) {
+        failure = std::current_exception();
+        failed.store(true, std::memory_order_release);
+    }
+}
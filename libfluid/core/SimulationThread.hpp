@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <thread>
+#include <vector>
+
+#include "FluidSimulator.hpp"
+#include "ParticleStorage.hpp"
+#include "SpscQueue.hpp"
+#include "TrajectoryRecorder.hpp"
+#include "TripleBuffer.hpp"
+
+// State of the simulation as of one step, handed to the render thread
+struct ParticleSnapshot {
+    ParticleStorage particles;
+    StepStats stats;
+    uint64_t step = 0;
+    double time = 0.0; // Simulated seconds
+    // Slot of each particle ID, for the recorder while the storage is reordered
+    std::vector<uint32_t> slotOfId;
+};
+
+// Runs a FluidSimulator on its own thread, so simulation and rendering each run at
+// their own rate. Wall-clock time is accumulated and consumed in whole steps, of a
+// fixed length or, with adaptiveTimeStep, of the simulator's frameTimeStep(): long
+// ones while the scene is calm, shorter ones split into substeps while it is
+// violent. When the simulation cannot keep up, at most maxStepsPerTick steps
+// run back to back and the remaining backlog is dropped rather than snowballing.
+// After each batch of steps the particles are copied into a triple buffer that the
+// render thread reads without blocking. Input goes the other way through a queue
+// drained before every step. With a recorder attached, every step is published and
+// lent to it as a trajectory frame, so the recorder's copy thread takes the frame
+// out of the snapshot instead of the simulation thread copying it twice.
+class SimulationThread {
+public:
+    static constexpr float adaptiveTimeStep = 0.0f;
+
+    // The simulator and recorder must outlive this object and are only touched by the
+    // simulation thread until it is destroyed.
+    explicit SimulationThread(FluidSimulator& simulator, float timeStep = 0.016f, int maxStepsPerTick = 4,
+                              TrajectoryRecorder* recorder = nullptr);
+    ~SimulationThread();
+
+    SimulationThread(const SimulationThread&) = delete;
+    SimulationThread& operator=(const SimulationThread&) = delete;
+
+    // Producer side of the input queue, call from a single thread. Returns false if
+    // the queue is full and the perturbation was dropped.
+    bool addPerturbation(const Perturbation& perturbation);
+    bool addPerturbation(float x, float y, float radius, float strength) {
+        return addPerturbation(Perturbation{ x, y, radius, strength });
+    }
+
+    // Latest published snapshot, call from a single (render) thread. The reference
+    // stays valid and unchanged until the next call.
+    const ParticleSnapshot& latestSnapshot() { return snapshots.read(); }
+
+    uint64_t getStepCount() const { return stepCount.load(std::memory_order_relaxed); }
+    // adaptiveTimeStep when the simulator picks it; snapshots carry the step taken
+    float getTimeStep() const { return timeStep; }
+
+    // Rethrows on the calling thread an exception that stopped the simulation thread
+    void rethrowIfFailed();
+
+    // Stops stepping and joins the thread, after which the simulator may be used
+    // directly again. Called by the destructor.
+    void stop();
+
+private:
+    FluidSimulator& simulator;
+    float timeStep;
+    int maxStepsPerTick;
+    TrajectoryRecorder* recorder;
+
+    TripleBuffer<ParticleSnapshot> snapshots;
+    SpscQueue<Perturbation, 256> commands;
+    std::atomic<uint64_t> stepCount{ 0 };
+    double simulatedTime = 0.0;
+
+    std::atomic<bool> stopping{ false };
+    std::atomic<bool> failed{ false };
+    std::exception_ptr failure;
+    std::thread thread;
+
+    void run();
+    void publish(bool toRecorder = false);
+    void drainCommands();
+    float nextTimeStep() const;
+};
@@ -0,0 +1,585 @@
+#include "SoftwareRenderer.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#ifdef FLUID_X86
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// A bilinear fetch at an offset from the target pixel's centre, in source texels
+struct BloomTap {
+    float dx, dy, weight;
+};
+
+// The bloom shaders of Renderer.cpp. Every set is symmetric in y, so they apply
+// unchanged to rows stored top first.
+constexpr BloomTap kawaseDownTaps[] = {
+    { 0.0f, 0.0f, 0.5f },
+    { -1.0f, -1.0f, 0.125f }, { 1.0f, -1.0f, 0.125f }, { -1.0f, 1.0f, 0.125f }, { 1.0f, 1.0f, 0.125f },
+};
+constexpr BloomTap kawaseUpTaps[] = {
+    { -1.0f, 0.0f, 1.0f / 12.0f }, { 1.0f, 0.0f, 1.0f / 12.0f }, { 0.0f, -1.0f, 1.0f / 12.0f }, { 0.0f, 1.0f, 1.0f / 12.0f },
+    { -0.5f, -0.5f, 2.0f / 12.0f }, { 0.5f, -0.5f, 2.0f / 12.0f }, { -0.5f, 0.5f, 2.0f / 12.0f }, { 0.5f, 0.5f, 2.0f / 12.0f },
+};
+constexpr BloomTap horizontalBlurTaps[] = {
+    { 0.0f, 0.0f, 0.2270270270f },
+    { 1.3846153846f, 0.0f, 0.3162162162f }, { -1.3846153846f, 0.0f, 0.3162162162f },
+    { 3.2307692308f, 0.0f, 0.0702702703f }, { -3.2307692308f, 0.0f, 0.0702702703f },
+};
+constexpr BloomTap verticalBlurTaps[] = {
+    { 0.0f, 0.0f, 0.2270270270f },
+    { 0.0f, 1.3846153846f, 0.3162162162f }, { 0.0f, -1.3846153846f, 0.3162162162f },
+    { 0.0f, 3.2307692308f, 0.0702702703f }, { 0.0f, -3.2307692308f, 0.0702702703f },
+};
+constexpr BloomTap centreTap = { 0.0f, 0.0f, 1.0f };
+constexpr size_t maxBloomTaps = 8;
+
+constexpr size_t rowGrain = 8;
+constexpr size_t pngPartBytes = 1 << 20; // Raw bytes deflated per task
+constexpr size_t pngWindowBytes = 32768;
+
+float smoothstep(float edge0, float edge1, float x) {
+    float t = std::clamp((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+// floor and ceil of the in-range coordinates here, without a libm call
+int floorToInt(float value) {
+    int truncated = static_cast<int>(value);
+    return truncated - (value < static_cast<float>(truncated));
+}
+int ceilToInt(float value) {
+    int truncated = static_cast<int>(value);
+    return truncated + (value > static_cast<float>(truncated));
+}
+
+// Pixels whose centres a sprite of the given radius covers, or false if none
+bool pixelBounds(float x, float y, float radius, int width, int height, int& x0, int& y0, int& x1, int& y1) {
+    // Also rejects NaN, and keeps the casts below in range
+    if (!(x + radius > 0.0f && x - radius < width && y + radius > 0.0f && y - radius < height)) {
+        return false;
+    }
+    x0 = std::max(0, ceilToInt(x - radius - 0.5f));
+    x1 = std::min(width - 1, floorToInt(x + radius - 0.5f));
+    y0 = std::max(0, ceilToInt(y - radius - 0.5f));
+    y1 = std::min(height - 1, floorToInt(y + radius - 0.5f));
+    return x0 <= x1 && y0 <= y1;
+}
+
+// The two texels a GL_LINEAR fetch blends along one axis, clamped to the edge, and
+// the weight of the second
+struct LinearSpan {
+    int first, second;
+    float fraction;
+};
+
+LinearSpan linearSpan(float texelCoordinate, int size) {
+    float position = texelCoordinate - 0.5f;
+    float base = std::floor(position);
+    int index = static_cast<int>(base);
+    return { std::clamp(index, 0, size - 1), std::clamp(index + 1, 0, size - 1), position - base };
+}
+
+// Horizontal spans of every target column for every tap, [column * tapCount + tap], in arena
+const LinearSpan* columnSpans(FrameArena& arena, int sourceWidth, int targetWidth, const BloomTap* taps, size_t tapCount) {
+    const float scale = static_cast<float>(sourceWidth) / targetWidth;
+    LinearSpan* spans = arena.allocate<LinearSpan>(tapCount * targetWidth);
+    for (int x = 0; x < targetWidth; ++x) {
+        for (size_t tap = 0; tap < tapCount; ++tap) {
+            spans[x * tapCount + tap] = linearSpan((x + 0.5f) * scale + taps[tap].dx, sourceWidth);
+        }
+    }
+    return spans;
+}
+
+// Adds one bilinear RGBA fetch between the rows top and bottom, already weighted by
+// the vertical fraction and the tap weight
+#ifdef FLUID_X86
+__m128 linearFetch(__m128 sum, const float* top, const float* bottom, const LinearSpan& column,
+                   __m128 topWeight, __m128 bottomWeight) {
+    const __m128 right = _mm_set1_ps(column.fraction), left = _mm_set1_ps(1.0f - column.fraction);
+    __m128 upper = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(top + column.first * 4), left),
+                              _mm_mul_ps(_mm_loadu_ps(top + column.second * 4), right));
+    __m128 lower = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(bottom + column.first * 4), left),
+                              _mm_mul_ps(_mm_loadu_ps(bottom + column.second * 4), right));
+    return _mm_add_ps(sum, _mm_add_ps(_mm_mul_ps(upper, topWeight), _mm_mul_ps(lower, bottomWeight)));
+}
+#else
+void linearFetch(float* sum, const float* top, const float* bottom, const LinearSpan& column,
+                 float topWeight, float bottomWeight) {
+    const float right = column.fraction, left = 1.0f - column.fraction;
+    for (int c = 0; c < 4; ++c) {
+        float upper = top[column.first * 4 + c] * left + top[column.second * 4 + c] * right;
+        float lower = bottom[column.first * 4 + c] * left + bottom[column.second * 4 + c] * right;
+        sum[c] += upper * topWeight + lower * bottomWeight;
+    }
+}
+#endif
+
+// Weighted sum of bilinear fetches per target pixel, the fragment shaders' pass over
+// a full-screen quad
+void bloomPass(ThreadPool& pool, FrameArena& arena, const float* source, int sourceWidth, int sourceHeight,
+               float* target, int targetWidth, int targetHeight, const BloomTap* taps, size_t tapCount) {
+    FrameArena::Scope scratch(arena);
+    const LinearSpan* columns = columnSpans(arena, sourceWidth, targetWidth, taps, tapCount);
+    const float scaleY = static_cast<float>(sourceHeight) / targetHeight;
+    const size_t sourceStride = static_cast<size_t>(sourceWidth) * 4;
+
+    pool.parallelFor(static_cast<size_t>(targetHeight), rowGrain, [&](size_t begin, size_t end) {
+        const float* tops[maxBloomTaps];
+        const float* bottoms[maxBloomTaps];
+        float topWeights[maxBloomTaps], bottomWeights[maxBloomTaps];
+        for (size_t y = begin; y < end; ++y) {
+            for (size_t tap = 0; tap < tapCount; ++tap) {
+                LinearSpan rows = linearSpan((y + 0.5f) * scaleY + taps[tap].dy, sourceHeight);
+                tops[tap] = source + rows.first * sourceStride;
+                bottoms[tap] = source + rows.second * sourceStride;
+                topWeights[tap] = taps[tap].weight * (1.0f - rows.fraction);
+                bottomWeights[tap] = taps[tap].weight * rows.fraction;
+            }
+            float* out = target + y * targetWidth * 4;
+            for (int x = 0; x < targetWidth; ++x) {
+                const LinearSpan* spans = &columns[x * tapCount];
+#ifdef FLUID_X86
+                __m128 sum = _mm_setzero_ps();
+                for (size_t tap = 0; tap < tapCount; ++tap) {
+                    sum = linearFetch(sum, tops[tap], bottoms[tap], spans[tap],
+                                      _mm_set1_ps(topWeights[tap]), _mm_set1_ps(bottomWeights[tap]));
+                }
+                _mm_storeu_ps(out + x * 4, sum);
+#else
+                float sum[4] = {};
+                for (size_t tap = 0; tap < tapCount; ++tap) {
+                    linearFetch(sum, tops[tap], bottoms[tap], spans[tap], topWeights[tap], bottomWeights[tap]);
+                }
+                std::memcpy(out + x * 4, sum, sizeof(sum));
+#endif
+            }
+        }
+    });
+}
+
+void appendBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+void appendPngChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t bytes) {
+    appendBigEndian(out, static_cast<uint32_t>(bytes));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + bytes);
+    appendBigEndian(out, static_cast<uint32_t>(crc32(0, out.data() + start, static_cast<uInt>(bytes + 4))));
+}
+
+void writeFile(const std::string& path, const void* data, size_t bytes) {
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("Cannot create image " + path);
+    }
+    bool written = std::fwrite(data, 1, bytes, file) == bytes;
+    if (std::fclose(file) != 0 || !written) {
+        throw std::runtime_error("Failed to write image " + path);
+    }
+}
+
+} // namespace
+
+SoftwareRenderer::SoftwareRenderer(int width, int height, unsigned threadCount)
+    : width(width), height(height), pool(threadCount) {
+    if (width <= 0 || height <= 0) {
+        throw std::invalid_argument("Image size must be positive");
+    }
+    tilesX = (width + tileSize - 1) / tileSize;
+    tilesY = (height + tileSize - 1) / tileSize;
+    tileStart.resize(static_cast<size_t>(tilesX) * tilesY + 1);
+    framebuffer.resize(static_cast<size_t>(width) * height * 4);
+    for (int level = 0; level < maxBloomLevels; ++level) {
+        BloomLevel& target = bloomLevels[level];
+        target.width = bloomLevelSize(width, level);
+        target.height = bloomLevelSize(height, level);
+        target.pixels.resize(static_cast<size_t>(target.width) * target.height * 4);
+    }
+    bloomScratch.resize(bloomLevels[0].pixels.size());
+    image.resize(static_cast<size_t>(width) * height * 3);
+
+    // alpha = smoothstep(1, 0, dist) * exp(-dist^2 * 2) * 0.3, looked up by dist^2
+    for (int i = 0; i <= smokeTableSize; ++i) {
+        float distSq = static_cast<float>(i) / smokeTableSize;
+        float dist = std::sqrt(distSq);
+        smokeAlpha[i] = smoothstep(1.0f, 0.0f, dist) * std::exp(-distSq * 2.0f) * 0.3f;
+    }
+}
+
+void SoftwareRenderer::render(const ParticleView& particles, const StepStats& stats) {
+    FLUID_PROFILE_SCOPE("software render");
+    float maxVelocity = std::max(stats.maxSpeed, 1e-5f);
+    // gl_PointSize is a diameter, and the smoke sprites are twice as large
+    float radius = smoke ? particleSize : particleSize * 0.5f;
+
+    bin(particles, radius, maxVelocity);
+
+    {
+        FLUID_PROFILE_SCOPE("rasterize");
+        pool.parallelFor(static_cast<size_t>(tilesX) * tilesY, 1, [&](size_t begin, size_t end) {
+            for (size_t tile = begin; tile < end; ++tile) {
+                rasterizeTile(static_cast<int>(tile), radius);
+            }
+        });
+    }
+
+    // Renderer::render's bloom chain
+    const int levels = std::clamp(bloom.levels, 0, maxBloomLevels);
+    if (levels > 0) {
+        FLUID_PROFILE_SCOPE("bloom");
+        const float* source = framebuffer.data();
+        int sourceWidth = width, sourceHeight = height;
+        for (int level = 0; level < levels; ++level) {
+            BloomLevel& target = bloomLevels[level];
+            bloomPass(pool, frameArena, source, sourceWidth, sourceHeight, target.pixels.data(), target.width,
+                      target.height, kawaseDownTaps, std::size(kawaseDownTaps));
+            source = target.pixels.data();
+            sourceWidth = target.width;
+            sourceHeight = target.height;
+        }
+
+        BloomLevel& smallest = bloomLevels[levels - 1];
+        bloomPass(pool, frameArena, smallest.pixels.data(), smallest.width, smallest.height, bloomScratch.data(),
+                  smallest.width, smallest.height, horizontalBlurTaps, std::size(horizontalBlurTaps));
+        bloomPass(pool, frameArena, bloomScratch.data(), smallest.width, smallest.height, smallest.pixels.data(),
+                  smallest.width, smallest.height, verticalBlurTaps, std::size(verticalBlurTaps));
+
+        for (int level = levels - 2; level >= 0; --level) {
+            const BloomLevel& from = bloomLevels[level + 1];
+            BloomLevel& to = bloomLevels[level];
+            bloomPass(pool, frameArena, from.pixels.data(), from.width, from.height, to.pixels.data(), to.width,
+                      to.height, kawaseUpTaps, std::size(kawaseUpTaps));
+        }
+    }
+    composite(levels > 0 ? &bloomLevels[0] : nullptr);
+    // Merged now rather than at the next frame, so only the first one allocates
+    frameArena.reset();
+}
+
+void SoftwareRenderer::bin(const ParticleView& particles, float radius, float maxVelocity) {
+    FLUID_PROFILE_SCOPE("bin");
+    const size_t tileCount = static_cast<size_t>(tilesX) * tilesY;
+    const size_t chunks = ThreadPool::chunkCount(particles.count, binGrain);
+    chunkTileOffsets = frameArena.allocate<uint32_t>(chunks * tileCount, 0u);
+    const float flipY = static_cast<float>(height);
+
+    pool.parallelFor(particles.count, binGrain, [&](size_t begin, size_t end) {
+        uint32_t* counts = &chunkTileOffsets[begin / binGrain * tileCount];
+        for (size_t i = begin; i < end; ++i) {
+            int x0, y0, x1, y1;
+            if (!pixelBounds(particles.x[i], flipY - particles.y[i], radius, width, height, x0, y0, x1, y1)) continue;
+            for (int ty = y0 / tileSize; ty <= y1 / tileSize; ++ty) {
+                for (int tx = x0 / tileSize; tx <= x1 / tileSize; ++tx) {
+                    ++counts[ty * tilesX + tx];
+                }
+            }
+        }
+    });
+
+    // Tile-major prefix sum: within a tile, chunk order and so particle order
+    uint32_t total = 0;
+    for (size_t tile = 0; tile < tileCount; ++tile) {
+        tileStart[tile] = total;
+        for (size_t chunk = 0; chunk < chunks; ++chunk) {
+            uint32_t& entry = chunkTileOffsets[chunk * tileCount + tile];
+            uint32_t count = entry;
+            entry = total;
+            total += count;
+        }
+    }
+    tileStart[tileCount] = total;
+    splats = frameArena.allocate<Splat>(total);
+
+    pool.parallelFor(particles.count, binGrain, [&](size_t begin, size_t end) {
+        uint32_t* offsets = &chunkTileOffsets[begin / binGrain * tileCount];
+        for (size_t i = begin; i < end; ++i) {
+            Splat splat{ particles.x[i], flipY - particles.y[i], 0.0f };
+            int x0, y0, x1, y1;
+            if (!pixelBounds(splat.x, splat.y, radius, width, height, x0, y0, x1, y1)) continue;
+            float speed = std::sqrt(particles.vx[i] * particles.vx[i] + particles.vy[i] * particles.vy[i]);
+            splat.ramp = smoke ? smoothstep(0.0f, maxVelocity, speed) : std::clamp(speed / maxVelocity, 0.0f, 1.0f);
+            for (int ty = y0 / tileSize; ty <= y1 / tileSize; ++ty) {
+                for (int tx = x0 / tileSize; tx <= x1 / tileSize; ++tx) {
+                    splats[offsets[ty * tilesX + tx]++] = splat;
+                }
+            }
+        }
+    });
+}
+
+void SoftwareRenderer::rasterizeTile(int tile, float radius) {
+    const int tileX0 = tile % tilesX * tileSize, tileY0 = tile / tilesX * tileSize;
+    const int tileX1 = std::min(tileX0 + tileSize, width) - 1, tileY1 = std::min(tileY0 + tileSize, height) - 1;
+
+    // Drawn into a contiguous copy of the tile, as framebuffer rows are a multiple of
+    // 2 KB apart and would evict each other from L1. Each row has room for a spare
+    // group of four pixels, so every sprite row is drawn in whole groups.
+    constexpr int padding = 4;
+    constexpr size_t stride = (tileSize + padding) * 4;
+    alignas(64) float pixels[tileSize * stride];
+
+    // glClearColor(0, 0, 0, 1)
+    for (size_t i = 0; i < tileSize * stride; i += 4) {
+        pixels[i] = pixels[i + 1] = pixels[i + 2] = 0.0f;
+        pixels[i + 3] = 1.0f;
+    }
+
+    // glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) on all four channels. Alpha is
+    // zero outside the circle, including the pixels past the sprite in the last group.
+    // Per-pixel alpha keeps the loops free of data dependent branches.
+    const float radiusSq = radius * radius;
+    const float tableScale = smokeTableSize / radiusSq;
+    constexpr float pointAlpha = 0.7f;
+#ifdef FLUID_X86
+    const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 alphaUnit = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+#endif
+    for (uint32_t s = tileStart[tile]; s < tileStart[tile + 1]; ++s) {
+        const Splat splat = splats[s];
+        float r, g, b;
+        if (smoke) {
+            r = 0.5f + 0.3f * splat.ramp;
+            g = 0.7f - 0.3f * splat.ramp;
+            b = 1.0f;
+        } else {
+            r = splat.ramp;
+            g = 1.0f - splat.ramp;
+            b = splat.ramp;
+        }
+
+        int x0 = std::max(tileX0, ceilToInt(splat.x - radius - 0.5f));
+        int x1 = std::min(tileX1, floorToInt(splat.x + radius - 0.5f));
+        int y0 = std::max(tileY0, ceilToInt(splat.y - radius - 0.5f));
+        int y1 = std::min(tileY1, floorToInt(splat.y + radius - 0.5f));
+#ifdef FLUID_X86
+        const __m128 colour = _mm_setr_ps(r, g, b, 0.0f);
+#endif
+        for (int y = y0; y <= y1; ++y) {
+            float dy = y + 0.5f - splat.y;
+            float dySq = dy * dy;
+            float* pixel = &pixels[(y - tileY0) * stride + (x0 - tileX0) * 4];
+            for (int x = x0; x <= x1; x += 4, pixel += 16) {
+#ifdef FLUID_X86
+                __m128 dx = _mm_sub_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneOffsets), _mm_set1_ps(splat.x));
+                __m128 distSq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_set1_ps(dySq));
+                __m128 alpha;
+                if (!smoke) {
+                    alpha = _mm_and_ps(_mm_cmple_ps(distSq, _mm_set1_ps(radiusSq)), _mm_set1_ps(pointAlpha));
+                } else {
+                    __m128 position = _mm_min_ps(_mm_mul_ps(distSq, _mm_set1_ps(tableScale)),
+                                                 _mm_set1_ps(static_cast<float>(smokeTableSize)));
+                    __m128 indexF = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(position)),
+                                               _mm_set1_ps(static_cast<float>(smokeTableSize - 1)));
+                    alignas(16) int32_t index[4];
+                    _mm_store_si128(reinterpret_cast<__m128i*>(index), _mm_cvttps_epi32(indexF));
+                    __m128 low = _mm_setr_ps(smokeAlpha[index[0]], smokeAlpha[index[1]], smokeAlpha[index[2]], smokeAlpha[index[3]]);
+                    __m128 high = _mm_setr_ps(smokeAlpha[index[0] + 1], smokeAlpha[index[1] + 1],
+                                              smokeAlpha[index[2] + 1], smokeAlpha[index[3] + 1]);
+                    alpha = _mm_add_ps(low, _mm_mul_ps(_mm_sub_ps(high, low), _mm_sub_ps(position, indexF)));
+                }
+                // Source (r, g, b, alpha) * alpha, one pixel per lane of alpha
+                auto blend = [&](float* target, __m128 a) {
+                    __m128 source = _mm_mul_ps(_mm_add_ps(colour, _mm_mul_ps(alphaUnit, a)), a);
+                    _mm_store_ps(target, _mm_add_ps(_mm_mul_ps(_mm_load_ps(target), _mm_sub_ps(one, a)), source));
+                };
+                blend(pixel, _mm_shuffle_ps(alpha, alpha, _MM_SHUFFLE(0, 0, 0, 0)));
+                blend(pixel + 4, _mm_shuffle_ps(alpha, alpha, _MM_SHUFFLE(1, 1, 1, 1)));
+                blend(pixel + 8, _mm_shuffle_ps(alpha, alpha, _MM_SHUFFLE(2, 2, 2, 2)));
+                blend(pixel + 12, _mm_shuffle_ps(alpha, alpha, _MM_SHUFFLE(3, 3, 3, 3)));
+#else
+                for (int lane = 0; lane < 4; ++lane) {
+                    float dx = (static_cast<float>(x) + (lane + 0.5f)) - splat.x;
+                    float distSq = dx * dx + dySq;
+                    float alpha;
+                    if (!smoke) {
+                        alpha = distSq <= radiusSq ? pointAlpha : 0.0f;
+                    } else {
+                        float position = std::min(distSq * tableScale, static_cast<float>(smokeTableSize));
+                        int index = std::min(static_cast<int>(position), smokeTableSize - 1);
+                        alpha = smokeAlpha[index] + (smokeAlpha[index + 1] - smokeAlpha[index]) * (position - index);
+                    }
+                    float* target = pixel + lane * 4;
+                    target[0] = target[0] * (1.0f - alpha) + r * alpha;
+                    target[1] = target[1] * (1.0f - alpha) + g * alpha;
+                    target[2] = target[2] * (1.0f - alpha) + b * alpha;
+                    target[3] = target[3] * (1.0f - alpha) + alpha * alpha;
+                }
+#endif
+            }
+        }
+    }
+
+    const size_t rowBytes = static_cast<size_t>(tileX1 - tileX0 + 1) * 4 * sizeof(float);
+    for (int y = tileY0; y <= tileY1; ++y) {
+        std::memcpy(&framebuffer[(static_cast<size_t>(y) * width + tileX0) * 4], &pixels[(y - tileY0) * stride], rowBytes);
+    }
+}
+
+void SoftwareRenderer::composite(const BloomLevel* bloomSource) {
+    // bloomCompositeFragmentSource, then 8 bits as the default framebuffer stores them
+    FLUID_PROFILE_SCOPE("composite");
+    FrameArena::Scope scratch(frameArena);
+    const LinearSpan* columns = nullptr;
+    float scaleY = 0.0f;
+    if (bloomSource) {
+        columns = columnSpans(frameArena, bloomSource->width, width, &centreTap, 1);
+        scaleY = static_cast<float>(bloomSource->height) / height;
+    }
+    const float strength = bloom.strength;
+    const size_t bloomStride = bloomSource ? static_cast<size_t>(bloomSource->width) * 4 : 0;
+
+    pool.parallelFor(static_cast<size_t>(height), rowGrain, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+            const float* scene = &framebuffer[y * width * 4];
+            uint8_t* pixel = &image[y * width * 3];
+            const float *top = nullptr, *bottom = nullptr;
+            float topWeight = 0.0f, bottomWeight = 0.0f;
+            if (bloomSource) {
+                LinearSpan rows = linearSpan((y + 0.5f) * scaleY, bloomSource->height);
+                top = bloomSource->pixels.data() + rows.first * bloomStride;
+                bottom = bloomSource->pixels.data() + rows.second * bloomStride;
+                topWeight = (1.0f - rows.fraction) * strength;
+                bottomWeight = rows.fraction * strength;
+            }
+            for (int x = 0; x < width; ++x, pixel += 3) {
+#ifdef FLUID_X86
+                const __m128 one = _mm_set1_ps(1.0f);
+                __m128 color = _mm_loadu_ps(scene + x * 4);
+                if (bloomSource) {
+                    color = linearFetch(color, top, bottom, columns[x], _mm_set1_ps(topWeight), _mm_set1_ps(bottomWeight));
+                }
+                color = _mm_min_ps(color, one);
+                __m128 value = _mm_mul_ps(color, _mm_shuffle_ps(color, color, _MM_SHUFFLE(3, 3, 3, 3)));
+                value = _mm_max_ps(_mm_min_ps(value, one), _mm_setzero_ps());
+                alignas(16) int32_t codes[4];
+                _mm_store_si128(reinterpret_cast<__m128i*>(codes),
+                                _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f))));
+                for (int c = 0; c < 3; ++c) pixel[c] = static_cast<uint8_t>(codes[c]);
+#else
+                float color[4];
+                std::memcpy(color, scene + x * 4, sizeof(color));
+                if (bloomSource) linearFetch(color, top, bottom, columns[x], topWeight, bottomWeight);
+                float alpha = std::min(color[3], 1.0f);
+                for (int c = 0; c < 3; ++c) {
+                    pixel[c] = static_cast<uint8_t>(std::clamp(std::min(color[c], 1.0f) * alpha, 0.0f, 1.0f) * 255.0f + 0.5f);
+                }
+#endif
+            }
+        }
+    });
+}
+
+void SoftwareRenderer::writeImage(const std::string& path) {
+    FLUID_PROFILE_SCOPE("write image");
+    bool png = path.size() >= 4 && path.compare(path.size() - 4, 4, ".png") == 0;
+    if (png) writePng(path);
+    else writePpm(path);
+}
+
+void SoftwareRenderer::writePpm(const std::string& path) const {
+    std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+    std::vector<uint8_t> file(header.begin(), header.end());
+    file.insert(file.end(), image.begin(), image.end());
+    writeFile(path, file.data(), file.size());
+}
+
+void SoftwareRenderer::writePng(const std::string& path) {
+    // Rows with the Sub filter, which suits smooth gradients
+    const size_t rowBytes = static_cast<size_t>(width) * 3 + 1;
+    std::vector<uint8_t> raw(rowBytes * height);
+    pool.parallelFor(static_cast<size_t>(height), rowGrain, [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; ++y) {
+            const uint8_t* pixels = &image[y * width * 3];
+            uint8_t* filtered = &raw[y * rowBytes];
+            filtered[0] = 1;
+            for (size_t i = 0; i < rowBytes - 1; ++i) {
+                filtered[i + 1] = static_cast<uint8_t>(pixels[i] - (i >= 3 ? pixels[i - 3] : 0));
+            }
+        }
+    });
+
+    // Deflate slices in parallel, each primed with the 32 KB before it and ended on a
+    // byte boundary, so the concatenation is a single valid zlib stream
+    const size_t parts = ThreadPool::chunkCount(raw.size(), pngPartBytes);
+    std::vector<std::vector<uint8_t>> compressed(parts);
+    std::vector<uLong> checksums(parts);
+    int level = pngCompressionLevel;
+    std::atomic<bool> failed{ false };
+    pool.parallelFor(parts, 1, [&](size_t begin, size_t end) {
+        for (size_t part = begin; part < end; ++part) {
+            size_t offset = part * pngPartBytes;
+            size_t bytes = std::min(pngPartBytes, raw.size() - offset);
+            checksums[part] = adler32(1, raw.data() + offset, static_cast<uInt>(bytes));
+
+            z_stream stream{};
+            if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                failed.store(true, std::memory_order_relaxed);
+                continue;
+            }
+            if (offset > 0) {
+                size_t window = std::min(offset, pngWindowBytes);
+                deflateSetDictionary(&stream, raw.data() + offset - window, static_cast<uInt>(window));
+            }
+            std::vector<uint8_t>& out = compressed[part];
+            out.resize(deflateBound(&stream, static_cast<uLong>(bytes)) + 16);
+            stream.next_in = raw.data() + offset;
+            stream.avail_in = static_cast<uInt>(bytes);
+            stream.next_out = out.data();
+            stream.avail_out = static_cast<uInt>(out.size());
+            bool last = part + 1 == parts;
+            int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+            if (result != (last ? Z_STREAM_END : Z_OK) || stream.avail_in != 0) {
+                failed.store(true, std::memory_order_relaxed);
+            }
+            out.resize(stream.total_out);
+            deflateEnd(&stream);
+        }
+    });
+    if (failed.load()) {
+        throw std::runtime_error("Failed to compress image " + path);
+    }
+
+    std::vector<uint8_t> data = { 0x78, 0x01 }; // zlib header: deflate, 32 KB window
+    uLong checksum = checksums[0];
+    for (size_t part = 0; part < parts; ++part) {
+        data.insert(data.end(), compressed[part].begin(), compressed[part].end());
+        if (part > 0) {
+            size_t bytes = std::min(pngPartBytes, raw.size() - part * pngPartBytes);
+            checksum = adler32_combine(checksum, checksums[part], static_cast<z_off_t>(bytes));
+        }
+    }
+    appendBigEndian(data, static_cast<uint32_t>(checksum));
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    std::vector<uint8_t> file(signature, signature + 8);
+    uint8_t header[13] = {};
+    for (int i = 0; i < 4; ++i) {
+        header[i] = static_cast<uint8_t>(width >> (24 - 8 * i));
+        header[4 + i] = static_cast<uint8_t>(height >> (24 - 8 * i));
+    }
+    header[8] = 8; // Bit depth
+    header[9] = 2; // RGB
+    appendPngChunk(file, "IHDR", header, sizeof(header));
+    appendPngChunk(file, "IDAT", data.data(), data.size());
+    appendPngChunk(file, "IEND", nullptr, 0);
+    writeFile(path, file.data(), file.size());
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "AlignedAllocator.hpp"
+#include "FrameArena.hpp"
+#include "ParticleStorage.hpp"
+#include "RenderData.hpp"
+#include "StepStats.hpp"
+#include "ThreadPool.hpp"
+
+// CPU version of what Renderer draws, for runs without a window: velocity coloured
+// point sprites as in fragmentShaderSource (or the smokeLikeFragmentSource look),
+// alpha blended in particle order into a float framebuffer, then Renderer's bloom
+// chain and composite, with bilinear taps computed as GL_LINEAR samples them.
+//
+// Particles are binned to 64x64 pixel tiles in two parallel passes, a count and a
+// scatter, over fixed chunks of the particle array. Each tile's splats end up in
+// particle order, so tiles can be rasterized independently without changing the
+// blending order, and a tile's pixels stay in cache while its splats are drawn.
+// The bins and the bloom passes' sample positions come from an arena reset per frame.
+class SoftwareRenderer {
+public:
+    // threadCount includes the caller; 0 uses every hardware thread
+    SoftwareRenderer(int width, int height, unsigned threadCount = 0);
+
+    // stats must describe particles; the colour ramp is normalised by its maximum speed
+    void render(const ParticleView& particles, const StepStats& stats);
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    // Result of the last render as 8-bit RGB, top row first
+    const std::vector<uint8_t>& getImage() const { return image; }
+    // Writes the image as PNG if the path ends in .png, as binary PPM otherwise
+    void writeImage(const std::string& path);
+
+    float particleSize = 10.0f; // Sprite diameter in pixels, doubled by the smoke look
+    bool smoke = false;         // smokeLikeFragmentSource instead of fragmentShaderSource
+    BloomSettings bloom;
+    int pngCompressionLevel = 1;
+
+private:
+    struct BloomLevel {
+        int width = 0, height = 0;
+        AlignedVector<float> pixels; // RGBA, top row first
+    };
+
+    struct Splat {
+        float x, y; // Centre in pixels, y down
+        float ramp; // Colour ramp position in [0, 1]
+    };
+
+    static constexpr int tileSize = 64;
+    static constexpr size_t binGrain = 16384;
+    static constexpr int smokeTableSize = 1024;
+
+    int width, height;
+    int tilesX, tilesY;
+    ThreadPool pool;
+
+    FrameArena frameArena;
+    // In frameArena, reset at the end of render(). Per chunk and tile splat counts, turned
+    // into write offsets in place.
+    uint32_t* chunkTileOffsets = nullptr;
+    std::vector<uint32_t> tileStart; // Tile t owns splats [tileStart[t], tileStart[t + 1])
+    Splat* splats = nullptr;
+
+    AlignedVector<float> framebuffer; // RGBA, top row first
+    BloomLevel bloomLevels[maxBloomLevels];
+    AlignedVector<float> bloomScratch; // First direction of the separable blur
+    std::vector<uint8_t> image;
+    float smokeAlpha[smokeTableSize + 1]; // Sprite alpha by squared distance from the centre
+
+    void bin(const ParticleView& particles, float radius, float maxVelocity);
+    void rasterizeTile(int tile, float radius);
+    void composite(const BloomLevel* bloomSource);
+    void writePng(const std::string& path);
+    void writePpm(const std::string& path) const;
+};
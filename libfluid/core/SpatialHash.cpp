@@ -0,0 +1,158 @@
+#include "SpatialHash.hpp"
+
+namespace {
+
+// Fixed so that the sort is independent of the thread count
+constexpr size_t sortBlocks = 16;
+constexpr size_t minBlockSize = 4096;
+
+} // namespace
+
+void SpatialHash::build(const ParticleView& particles, float cellSize, int width, int height, ThreadPool& pool) {
+    float invCellSize = 1.0f / cellSize;
+    int cellsX = std::max(1, static_cast<int>(std::ceil(width * invCellSize)));
+    int cellsY = std::max(1, static_cast<int>(std::ceil(height * invCellSize)));
+    bool sameCells = cellSize == this->cellSize && cellsX == this->cellsX && cellsY == this->cellsY;
+    this->cellSize = cellSize;
+    this->invCellSize = invCellSize;
+    this->cellsX = cellsX;
+    this->cellsY = cellsY;
+
+    // A resting layer may be filed from any build on, and a growing population may
+    // split the sort into more blocks; room for both is made while the particles are
+    // first binned
+    size_t count = particles.size();
+    size_t cellCount = static_cast<size_t>(cellsX) * cellsY;
+    restingStart.reserve(cellCount + 1);
+    blockOffsets.reserve(sortBlocks * cellCount);
+
+    if (restingRequested || !sameCells || (restingBegin != noResting && count != restingEnd)) {
+        size_t begin = restingRequested ? requestedRestingBegin : noResting;
+        restingRequested = false;
+        releasedEntries.clear();
+        if (begin < count) {
+            restingFirst = restingBegin = begin;
+            restingEnd = count;
+            sortSlots(particles, begin, count, restingStart, restingIndex, restingX, restingY, pool);
+            restingEntry.resize(count - begin);
+            for (size_t k = 0; k < restingIndex.size(); ++k) {
+                restingEntry[restingIndex[k] - begin] = static_cast<uint32_t>(k);
+            }
+        } else {
+            restingBegin = noResting;
+        }
+    }
+    for (uint32_t entry : releasedEntries) {
+        restingX[entry] = std::numeric_limits<float>::infinity();
+        restingY[entry] = std::numeric_limits<float>::infinity();
+        restingIndex[entry] = UINT32_MAX;
+    }
+    releasedEntries.clear();
+
+    size_t moving = restingBegin == noResting ? count : restingBegin;
+    scatter = sortSlots(particles, 0, moving, cellStart, sortedIndex, sortedX, sortedY, pool);
+    filedCount = restingBegin == noResting ? count : moving + (restingEnd - restingBegin);
+}
+
+uint32_t SpatialHash::release(uint32_t slot) {
+    uint32_t first = static_cast<uint32_t>(restingBegin);
+    uint32_t released = restingEntry[slot - restingFirst];
+    if (slot != first) {
+        uint32_t moved = restingEntry[first - restingFirst];
+        restingIndex[moved] = slot;
+        restingEntry[slot - restingFirst] = moved;
+    }
+    restingIndex[released] = first;
+    releasedEntries.push_back(released);
+    ++restingBegin;
+    return first;
+}
+
+float SpatialHash::sortSlots(const ParticleView& particles, size_t first, size_t last, std::vector<uint32_t>& start,
+                             std::vector<uint32_t>& index, std::vector<float>& xs, std::vector<float>& ys,
+                             ThreadPool& pool) {
+    size_t count = last - first;
+    size_t cellCount = static_cast<size_t>(cellsX) * cellsY;
+    size_t blocks = std::clamp<size_t>(count / minBlockSize, 1, sortBlocks);
+    size_t blockSize = (count + blocks - 1) / blocks;
+
+    start.assign(cellCount + 1, 0);
+    blockOffsets.assign(blocks * cellCount, 0);
+    particleCell.resize(count);
+    index.resize(count);
+    xs.resize(count);
+    ys.resize(count);
+
+    // Count particles per cell within each block, and how often a particle's cell is
+    // not next to the previous particle's
+    size_t blockJumps[sortBlocks] = {};
+    pool.parallelFor(blocks, 1, [&](size_t block, size_t) {
+        uint32_t* histogram = blockOffsets.data() + block * cellCount;
+        size_t begin = block * blockSize, end = std::min(count, (block + 1) * blockSize);
+        size_t jumps = 0;
+        int previousX = 0, previousY = 0;
+        for (size_t i = begin; i < end; ++i) {
+            int cx = cellCoord(particles.x[first + i], cellsX), cy = cellCoord(particles.y[first + i], cellsY);
+            uint32_t cell = cy * cellsX + cx;
+            particleCell[i] = cell;
+            ++histogram[cell];
+            jumps += i > begin && (std::abs(cx - previousX) > 1 || std::abs(cy - previousY) > 1);
+            previousX = cx;
+            previousY = cy;
+        }
+        blockJumps[block] = jumps;
+    });
+    size_t jumps = 0;
+    for (size_t block = 0; block < blocks; ++block) {
+        jumps += blockJumps[block];
+    }
+
+    // Cell totals, then a prefix sum turns them into offsets
+    for (size_t block = 0; block < blocks; ++block) {
+        const uint32_t* histogram = blockOffsets.data() + block * cellCount;
+        for (size_t c = 0; c < cellCount; ++c) {
+            start[c + 1] += histogram[c];
+        }
+    }
+    for (size_t c = 0; c < cellCount; ++c) {
+        start[c + 1] += start[c];
+    }
+
+    // Within a cell, earlier blocks come first, which keeps the sort stable
+    pool.parallelFor(cellCount, 1024, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c) {
+            uint32_t offset = start[c];
+            for (size_t block = 0; block < blocks; ++block) {
+                uint32_t& entry = blockOffsets[block * cellCount + c];
+                uint32_t n = entry;
+                entry = offset;
+                offset += n;
+            }
+        }
+    });
+
+    // Scatter, each block using its own cursors
+    pool.parallelFor(blocks, 1, [&](size_t block, size_t) {
+        uint32_t* cursor = blockOffsets.data() + block * cellCount;
+        size_t end = std::min(count, (block + 1) * blockSize);
+        for (size_t i = block * blockSize; i < end; ++i) {
+            uint32_t slot = cursor[particleCell[i]]++;
+            index[slot] = static_cast<uint32_t>(first + i);
+            xs[slot] = particles.x[first + i];
+            ys[slot] = particles.y[first + i];
+        }
+    });
+    return count > blocks ? static_cast<float>(jumps) / static_cast<float>(count - blocks) : 0.0f;
+}
+
+void SpatialHash::reserve(size_t count) {
+    particleCell.reserve(count);
+    sortedIndex.reserve(count);
+    sortedX.reserve(count);
+    sortedY.reserve(count);
+    restingIndex.reserve(count);
+    restingX.reserve(count);
+    restingY.reserve(count);
+    restingEntry.reserve(count);
+    releasedEntries.reserve(count);
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "ParticleStorage.hpp"
+#include "ThreadPool.hpp"
+
+// Uniform grid over the simulation domain, rebuilt every step with a counting sort.
+// The sort runs over a fixed number of particle blocks in parallel and is stable,
+// so the cell order is the same for any thread count.
+// The particles of a cell are stored contiguously together with a copy of their
+// positions, so neighbour queries walk linear memory instead of the particle array.
+// Particles outside the domain are filed into the nearest border cell.
+// Particles at rest can be filed once into a resting layer that later builds keep, so
+// a build only sorts the others; queries see both layers.
+class SpatialHash {
+public:
+    // Bins the particles in slots below getRestingBegin(), all of them without a resting
+    // layer. A new cell size or domain, or another particle count than the layer was
+    // filed with, drops the layer first.
+    void build(const ParticleView& particles, float cellSize, int width, int height, ThreadPool& pool);
+
+    // The next build files the particles in slots from begin on into a new resting layer.
+    // They must not move, nor change slots other than through release(), until the
+    // layer is dropped.
+    void restFrom(size_t begin) {
+        restingRequested = true;
+        requestedRestingBegin = begin;
+    }
+    // The next build bins every particle again
+    void dropResting() {
+        restingRequested = true;
+        requestedRestingBegin = noResting;
+    }
+    // First slot of the resting layer, SIZE_MAX without one
+    size_t getRestingBegin() const { return restingBegin; }
+    // Particles released since the resting layer was filed
+    size_t getReleasedCount() const { return restingBegin == noResting ? 0 : restingBegin - restingFirst; }
+    // Takes the resting particle in slot out of the layer, which then starts one slot
+    // later. The particle in the old first slot, which is returned, takes over slot:
+    // the caller swaps the two. Until the next build the released particle is still
+    // found, in the returned slot.
+    uint32_t release(uint32_t slot);
+
+    // Grows the per-particle storage up front so builds of up to count particles never allocate
+    void reserve(size_t count);
+
+    // Calls fn(index, dx, dy, distanceSquared) for every particle strictly within
+    // radius of (x, y), with (dx, dy) pointing from (x, y) to the particle.
+    template <typename Fn>
+    void forEachNeighbor(float x, float y, float radius, Fn&& fn) const;
+
+    // Same query restricted to the rowCount cell rows starting at firstRow. Every
+    // particle lives in exactly one row, so rows can be handed to different threads.
+    template <typename Fn>
+    void forEachNeighborInRows(float x, float y, float radius, int firstRow, int rowCount, Fn&& fn) const;
+
+    // Variant reporting sorted slots instead of particle indices, for passes that keep
+    // their per-particle data in cell order (see getSortedIndex). Resting particles have
+    // no sorted slot and are left out.
+    template <typename Fn>
+    void forEachNeighborSlot(float x, float y, float radius, Fn&& fn) const;
+
+    // First cell row and number of rows a query of radius around y touches.
+    std::pair<int, int> rowSpan(float y, float radius) const {
+        int cy0 = cellCoord(y - radius, cellsY), cy1 = cellCoord(y + radius, cellsY);
+        return { cy0, cy1 - cy0 + 1 };
+    }
+
+    // First cell column and number of columns a query of radius around x touches.
+    std::pair<int, int> columnSpan(float x, float radius) const {
+        int cx0 = cellCoord(x - radius, cellsX), cx1 = cellCoord(x + radius, cellsX);
+        return { cx0, cx1 - cx0 + 1 };
+    }
+
+    // Row-major index of the cell (x, y) is filed into, below getCellCount()
+    uint32_t cellIndex(float x, float y) const {
+        return static_cast<uint32_t>(cellCoord(y, cellsY) * cellsX + cellCoord(x, cellsX));
+    }
+    // Calls fn(index) for every particle filed into cell
+    template <typename Fn>
+    void forEachInCell(uint32_t cell, Fn&& fn) const {
+        for (uint32_t k = cellStart[cell]; k < cellStart[cell + 1]; ++k) fn(sortedIndex[k]);
+        if (restingBegin == noResting) return;
+        for (uint32_t k = restingStart[cell]; k < restingStart[cell + 1]; ++k) {
+            if (restingIndex[k] != UINT32_MAX) fn(restingIndex[k]);
+        }
+    }
+
+    float getCellSize() const { return cellSize; }
+    int getRowCount() const { return cellsY; }
+    int getColumnCount() const { return cellsX; }
+    size_t getCellCount() const { return static_cast<size_t>(cellsX) * cellsY; }
+    // Fraction of consecutive particles in storage, as of the last build, whose cells
+    // are not neighbours: near 0 while storage order follows space, near 1 once the
+    // particles are shuffled. Resting particles are not counted.
+    float getScatter() const { return scatter; }
+
+    // Particles filed by the last build, resting ones included
+    size_t size() const { return filedCount; }
+    // Cell-ordered view of the particles the last build sorted, all but the resting
+    // ones: slot k holds particle getSortedIndex()[k] at (getSortedX()[k], getSortedY()[k]).
+    size_t getSortedCount() const { return sortedIndex.size(); }
+    const uint32_t* getSortedIndex() const { return sortedIndex.data(); }
+    const float* getSortedX() const { return sortedX.data(); }
+    const float* getSortedY() const { return sortedY.data(); }
+
+private:
+    static constexpr size_t noResting = std::numeric_limits<size_t>::max();
+
+    float cellSize = 1.0f, invCellSize = 1.0f;
+    int cellsX = 0, cellsY = 0;
+    float scatter = 0.0f;
+    size_t filedCount = 0;
+
+    std::vector<uint32_t> cellStart;   // cellsX * cellsY + 1 offsets into the sorted arrays
+    std::vector<uint32_t> particleCell; // cell of each particle, reused between builds
+    std::vector<uint32_t> blockOffsets; // per-block cell histograms, then scatter cursors
+    std::vector<uint32_t> sortedIndex;
+    std::vector<float> sortedX, sortedY;
+
+    // Resting layer over slots [restingFirst, restingEnd), laid out like the sorted
+    // arrays, of which [restingBegin, restingEnd) are still resting. The entries of
+    // released particles are moved out of reach by the next build.
+    size_t restingFirst = 0, restingBegin = noResting, restingEnd = 0;
+    bool restingRequested = false;
+    size_t requestedRestingBegin = noResting; // noResting drops the layer
+    std::vector<uint32_t> restingStart, restingIndex;
+    std::vector<float> restingX, restingY;
+    std::vector<uint32_t> restingEntry;    // Entry of each slot from restingFirst on
+    std::vector<uint32_t> releasedEntries; // Released since the last build
+
+    // Counting sort of slots [begin, end) into cell order, returning the scatter
+    float sortSlots(const ParticleView& particles, size_t begin, size_t end, std::vector<uint32_t>& start,
+                    std::vector<uint32_t>& index, std::vector<float>& xs, std::vector<float>& ys, ThreadPool& pool);
+
+    template <bool Slots, typename Fn>
+    void visitRows(float x, float y, float radius, int firstRow, int rowCount, Fn&& fn) const;
+
+    int cellCoord(float v, int cells) const {
+        return std::clamp(static_cast<int>(std::floor(v * invCellSize)), 0, cells - 1);
+    }
+};
+
+template <typename Fn>
+void SpatialHash::forEachNeighbor(float x, float y, float radius, Fn&& fn) const {
+    auto [firstRow, rowCount] = rowSpan(y, radius);
+    visitRows<false>(x, y, radius, firstRow, rowCount, fn);
+}
+
+template <typename Fn>
+void SpatialHash::forEachNeighborInRows(float x, float y, float radius, int firstRow, int rowCount, Fn&& fn) const {
+    visitRows<false>(x, y, radius, firstRow, rowCount, fn);
+}
+
+template <typename Fn>
+void SpatialHash::forEachNeighborSlot(float x, float y, float radius, Fn&& fn) const {
+    auto [firstRow, rowCount] = rowSpan(y, radius);
+    visitRows<true>(x, y, radius, firstRow, rowCount, fn);
+}
+
+template <bool Slots, typename Fn>
+void SpatialHash::visitRows(float x, float y, float radius, int firstRow, int rowCount, Fn&& fn) const {
+    if (filedCount == 0) return;
+
+    // Clamping the range (not each particle) keeps border cells reachable from outside.
+    int cx0 = cellCoord(x - radius, cellsX), cx1 = cellCoord(x + radius, cellsX);
+    float radiusSq = radius * radius;
+
+    for (int cy = firstRow; cy < firstRow + rowCount; ++cy) {
+        // Cells of a row are adjacent in the sorted arrays, so a row is one contiguous run.
+        uint32_t begin = cellStart[cy * cellsX + cx0];
+        uint32_t end = cellStart[cy * cellsX + cx1 + 1];
+        for (uint32_t k = begin; k < end; ++k) {
+            float dx = sortedX[k] - x;
+            float dy = sortedY[k] - y;
+            float distSq = dx * dx + dy * dy;
+            if (distSq < radiusSq) {
+                fn(Slots ? k : sortedIndex[k], dx, dy, distSq);
+            }
+        }
+        if constexpr (!Slots) {
+            // Entries released before the last build sit at infinity, out of reach
+            if (restingBegin == noResting) continue;
+            begin = restingStart[cy * cellsX + cx0];
+            end = restingStart[cy * cellsX + cx1 + 1];
+            for (uint32_t k = begin; k < end; ++k) {
+                float dx = restingX[k] - x;
+                float dy = restingY[k] - y;
+                float distSq = dx * dx + dy * dy;
+                if (distSq < radiusSq) {
+                    fn(restingIndex[k], dx, dy, distSq);
+                }
+            }
+        }
+    }
+}
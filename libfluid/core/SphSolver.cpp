@@ -0,0 +1,126 @@
+#include "SphSolver.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+namespace {
+
+constexpr size_t sphGrain = 512;
+
+} // namespace
+
+SphSolver::SphSolver(const SphParams& params) : params(params) {
+    float h = params.smoothingLength;
+    h2 = h * h;
+    tableScale = tableSize / h2;
+
+    // 2D normalisations of the Müller et al. kernels
+    float pi = std::numbers::pi_v<float>;
+    poly6Coefficient = 4.0f / (pi * std::pow(h, 8.0f));
+    float spikyCoefficient = -30.0f / (pi * std::pow(h, 5.0f));
+    float viscosityCoefficient = 40.0f / (pi * std::pow(h, 5.0f));
+
+    spikyGradientTable.resize(tableSize + 2);
+    viscosityLaplacianTable.resize(tableSize + 2);
+    for (int i = 0; i < tableSize + 2; ++i) {
+        // Keep r away from zero, where the spiky gradient over r diverges
+        float r = std::clamp(std::sqrt(i / tableScale), h * 1e-3f, h);
+        spikyGradientTable[i] = spikyCoefficient * (h - r) * (h - r) / r;
+        viscosityLaplacianTable[i] = viscosityCoefficient * (h - r);
+    }
+}
+
+void SphSolver::reserve(size_t count) {
+    velocityX.reserve(count);
+    velocityY.reserve(count);
+    density.reserve(count);
+    pressure.reserve(count);
+}
+
+float SphSolver::maxTimeStep() const {
+    return params.courant * params.smoothingLength / std::sqrt(params.stiffness);
+}
+
+float SphSolver::lookup(const std::vector<float>& table, float distSq) const {
+    float position = distSq * tableScale;
+    int i = static_cast<int>(position);
+    float t = position - i;
+    return table[i] + (table[i + 1] - table[i]) * t;
+}
+
+void SphSolver::computeDensities(const SpatialHash& grid, ThreadPool& pool) {
+    size_t count = grid.getSortedCount();
+    const float* sx = grid.getSortedX();
+    const float* sy = grid.getSortedY();
+    density.resize(count);
+    pressure.resize(count);
+
+    pool.parallelFor(count, sphGrain, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            float sum = 0.0f;
+            grid.forEachNeighborSlot(sx[k], sy[k], params.smoothingLength, [&](uint32_t, float, float, float distSq) {
+                sum += poly6(distSq);
+            });
+            density[k] = params.mass * sum;
+            // Clamping negative pressure avoids clumping at the free surface
+            pressure[k] = std::max(0.0f, params.stiffness * (density[k] - params.restDensity));
+        }
+    });
+}
+
+void SphSolver::calibrate(const SpatialHash& grid, ThreadPool& pool) {
+    if (params.restDensity > 0.0f || grid.size() == 0) return;
+    computeDensities(grid, pool);
+    std::vector<float> sorted(density.begin(), density.end());
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+    params.restDensity = sorted[sorted.size() / 2];
+}
+
+void SphSolver::computeAccelerations(const ParticleStorage& particles, const SpatialHash& grid, ThreadPool& pool,
+                                     AlignedVector<float>& accelX, AlignedVector<float>& accelY) {
+    size_t count = grid.getSortedCount();
+    const uint32_t* index = grid.getSortedIndex();
+    const float* sx = grid.getSortedX();
+    const float* sy = grid.getSortedY();
+
+    // Gather velocities into cell order
+    velocityX.resize(count);
+    velocityY.resize(count);
+    pool.parallelFor(count, 16384, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            velocityX[k] = particles.vx[index[k]];
+            velocityY[k] = particles.vy[index[k]];
+        }
+    });
+
+    computeDensities(grid, pool);
+
+    accelX.resize(particles.size());
+    accelY.resize(particles.size());
+    pool.parallelFor(count, sphGrain, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            float pressureX = 0.0f, pressureY = 0.0f; // Accumulated forces, before dividing by density
+            float viscosityX = 0.0f, viscosityY = 0.0f;
+            float pk = pressure[k];
+            float vxk = velocityX[k], vyk = velocityY[k];
+
+            grid.forEachNeighborSlot(sx[k], sy[k], params.smoothingLength, [&](uint32_t j, float dx, float dy, float distSq) {
+                if (j == k) return;
+                // The gradient with respect to k is table * -(dx, dy); with the table value
+                // negative, the resulting force pushes k away from j.
+                float shared = (pk + pressure[j]) / (2.0f * density[j]) * lookup(spikyGradientTable, distSq);
+                pressureX += shared * dx;
+                pressureY += shared * dy;
+
+                float laplacian = lookup(viscosityLaplacianTable, distSq) / density[j];
+                viscosityX += (velocityX[j] - vxk) * laplacian;
+                viscosityY += (velocityY[j] - vyk) * laplacian;
+            });
+
+            float scale = params.mass / density[k];
+            accelX[index[k]] = scale * (pressureX + params.viscosity * viscosityX);
+            accelY[index[k]] = scale * (pressureY + params.viscosity * viscosityY);
+        }
+    });
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+
+#include "AlignedAllocator.hpp"
+#include "ParticleStorage.hpp"
+#include "SpatialHash.hpp"
+#include "ThreadPool.hpp"
+
+struct SphParams {
+    float smoothingLength = 10.0f; // Kernel support h, also the grid cell size
+    float restDensity = 0.0f;      // 0 measures it from the initial particle lattice
+    float stiffness = 250000.0f;   // Equation of state p = stiffness * (density - restDensity)
+    float viscosity = 10.0f;
+    float courant = 0.4f;          // Substep limit as a fraction of h per speed-of-sound travel time
+    float mass = 1.0f;
+};
+
+// Smoothed Particle Hydrodynamics in 2D: poly6 density estimate, linear equation of
+// state, spiky-gradient pressure and Laplacian viscosity forces. Everything is
+// evaluated in the cell order of the spatial hash so neighbour reads are contiguous,
+// and the output is an acceleration per particle for the integration kernel.
+class SphSolver {
+public:
+    explicit SphSolver(const SphParams& params);
+
+    // Sets the rest density to the density of the current particle configuration
+    // (its median, which ignores the sparse border) unless it was given explicitly.
+    void calibrate(const SpatialHash& grid, ThreadPool& pool);
+
+    void computeAccelerations(const ParticleStorage& particles, const SpatialHash& grid, ThreadPool& pool,
+                              AlignedVector<float>& accelX, AlignedVector<float>& accelY);
+
+    // Grows the per-particle state up front for up to count particles
+    void reserve(size_t count);
+
+    // Largest stable step, from the speed of sound sqrt(stiffness) of the equation of state
+    float maxTimeStep() const;
+
+    float getSmoothingLength() const { return params.smoothingLength; }
+    float getRestDensity() const { return params.restDensity; }
+    const SphParams& getParams() const { return params; }
+
+private:
+    // Kernel values tabulated over r^2 in [0, h^2], so no square root is taken per pair
+    static constexpr int tableSize = 1024;
+
+    SphParams params;
+    float h2 = 0.0f;
+    float poly6Coefficient = 0.0f;
+    float tableScale = 0.0f; // tableSize / h^2
+    std::vector<float> spikyGradientTable;  // |grad W_spiky| / r
+    std::vector<float> viscosityLaplacianTable;
+
+    // Per-slot state in cell order
+    AlignedVector<float> velocityX, velocityY;
+    AlignedVector<float> density, pressure;
+
+    float poly6(float distSq) const {
+        float d = h2 - distSq;
+        return poly6Coefficient * d * d * d;
+    }
+    float lookup(const std::vector<float>& table, float distSq) const;
+    void computeDensities(const SpatialHash& grid, ThreadPool& pool);
+};
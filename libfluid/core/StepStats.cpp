@@ -0,0 +1,74 @@
+#include "StepStats.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+void StepStatsCollector::setHistogram(int bins, float maxSpeed) {
+    if (bins < 0 || (bins > 0 && !(maxSpeed > 0.0f))) {
+        throw std::invalid_argument("Speed histogram needs a positive bin count and maximum speed");
+    }
+    histogramBins = bins;
+    histogramMaxSpeed = maxSpeed;
+}
+
+void StepStatsCollector::begin(size_t count, size_t grain) {
+    this->grain = std::max<size_t>(grain, 1);
+    size_t chunks = (count + this->grain - 1) / this->grain;
+    partials.assign(chunks, StatsPartial{});
+    resting = StatsPartial{};
+    histograms.assign(chunks * static_cast<size_t>(histogramBins), 0);
+    for (size_t c = 0; c < chunks && histogramBins > 0; ++c) {
+        partials[c].histogram = histograms.data() + c * histogramBins;
+        partials[c].histogramBins = histogramBins;
+        partials[c].histogramScale = histogramBins / histogramMaxSpeed;
+    }
+}
+
+void StepStatsCollector::addResting(size_t count, float minX, float minY, float maxX, float maxY) {
+    if (count == 0) return;
+    resting.count += count;
+    resting.minX = std::min(resting.minX, minX);
+    resting.minY = std::min(resting.minY, minY);
+    resting.maxX = std::max(resting.maxX, maxX);
+    resting.maxY = std::max(resting.maxY, maxY);
+}
+
+void StepStatsCollector::reserve(size_t count, size_t grain) {
+    size_t chunks = (count + std::max<size_t>(grain, 1) - 1) / std::max<size_t>(grain, 1);
+    partials.reserve(chunks);
+    histograms.reserve(chunks * static_cast<size_t>(histogramBins));
+}
+
+void StepStatsCollector::finish(StepStats& stats) const {
+    StatsPartial total = resting; // Zero speed, so only the count and box
+    for (const StatsPartial& p : partials) {
+        total.count += p.count;
+        total.maxSpeedSq = std::max(total.maxSpeedSq, p.maxSpeedSq);
+        total.speedSum += p.speedSum;
+        total.speedSqSum += p.speedSqSum;
+        total.minX = std::min(total.minX, p.minX);
+        total.minY = std::min(total.minY, p.minY);
+        total.maxX = std::max(total.maxX, p.maxX);
+        total.maxY = std::max(total.maxY, p.maxY);
+    }
+
+    stats.count = total.count;
+    stats.maxSpeed = std::sqrt(total.maxSpeedSq);
+    stats.meanSpeed = total.count ? static_cast<float>(total.speedSum / total.count) : 0.0f;
+    stats.kineticEnergy = 0.5 * total.speedSqSum;
+    bool any = total.count > 0;
+    stats.minX = any ? total.minX : 0.0f;
+    stats.minY = any ? total.minY : 0.0f;
+    stats.maxX = any ? total.maxX : 0.0f;
+    stats.maxY = any ? total.maxY : 0.0f;
+
+    stats.histogramMaxSpeed = histogramMaxSpeed;
+    stats.speedHistogram.assign(static_cast<size_t>(histogramBins), 0);
+    for (size_t c = 0; c < partials.size() && histogramBins > 0; ++c) {
+        const uint32_t* counts = histograms.data() + c * histogramBins;
+        for (int b = 0; b < histogramBins; ++b) {
+            stats.speedHistogram[b] += counts[b];
+        }
+    }
+    if (histogramBins > 0) stats.speedHistogram[0] += static_cast<uint32_t>(resting.count);
+}
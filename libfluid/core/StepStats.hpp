@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Aggregates of the particle state after a step, gathered by the step itself
+struct StepStats {
+    size_t count = 0;
+    float maxSpeed = 0.0f;
+    float meanSpeed = 0.0f;
+    float minX = 0.0f, minY = 0.0f, maxX = 0.0f, maxY = 0.0f; // Bounding box, all zero without particles
+    double kineticEnergy = 0.0; // Sum of |v|^2 / 2, per unit particle mass
+    std::vector<uint32_t> speedHistogram; // Empty unless enabled; the last bin also takes faster particles
+    float histogramMaxSpeed = 0.0f;
+    int substeps = 0;       // Steps the last update split its frame into
+    float timeStep = 0.0f;  // Length of each of them
+    int neededSubsteps = 0; // Steps SPH's stability limit asked for; above substeps when maxSubsteps cut it
+};
+
+// Running aggregates of one chunk of particles
+struct StatsPartial {
+    size_t count = 0;
+    float maxSpeedSq = 0.0f;
+    double speedSum = 0.0, speedSqSum = 0.0;
+    float minX = std::numeric_limits<float>::infinity(), minY = std::numeric_limits<float>::infinity();
+    float maxX = -std::numeric_limits<float>::infinity(), maxY = -std::numeric_limits<float>::infinity();
+    uint32_t* histogram = nullptr; // histogramBins counters, or null
+    int histogramBins = 0;
+    float histogramScale = 0.0f;   // Bins per unit of speed
+
+    void addHistogram(float speed) {
+        // Clamped before the cast, which a huge speed would overflow; NaN counts as fastest
+        float last = static_cast<float>(histogramBins - 1);
+        float bin = speed * histogramScale;
+        bin = bin < last ? (bin > 0.0f ? bin : 0.0f) : last;
+        ++histogram[static_cast<int>(bin)];
+    }
+
+    void add(float x, float y, float vx, float vy) {
+        float speedSq = vx * vx + vy * vy;
+        float speed = std::sqrt(speedSq);
+        ++count;
+        maxSpeedSq = maxSpeedSq > speedSq ? maxSpeedSq : speedSq;
+        speedSum += speed;
+        speedSqSum += speedSq;
+        minX = minX < x ? minX : x;
+        minY = minY < y ? minY : y;
+        maxX = maxX > x ? maxX : x;
+        maxY = maxY > y ? maxY : y;
+        if (histogram) addHistogram(speed);
+    }
+};
+
+// One StatsPartial per fixed-size chunk of a parallel pass, combined in chunk order
+// afterwards. Like the chunks themselves, the result does not depend on which thread
+// ran which chunk.
+class StepStatsCollector {
+public:
+    // histogramBins = 0 turns the histogram off
+    void setHistogram(int bins, float maxSpeed);
+
+    // Starts a pass over count particles in chunks of grain; storage is reused
+    void begin(size_t count, size_t grain);
+    // Grows the storage up front for passes over up to count particles
+    void reserve(size_t count, size_t grain);
+    StatsPartial* partialFor(size_t chunkBegin) { return &partials[chunkBegin / grain]; }
+    // Adds count particles at rest within the given box, which the pass skipped
+    void addResting(size_t count, float minX, float minY, float maxX, float maxY);
+    void finish(StepStats& stats) const;
+
+private:
+    size_t grain = 1;
+    int histogramBins = 0;
+    float histogramMaxSpeed = 0.0f;
+    std::vector<StatsPartial> partials;
+    std::vector<uint32_t> histograms; // histogramBins counters per chunk
+    StatsPartial resting;
+};
@@ -0,0 +1,146 @@
+#include "ThreadPool.hpp"
+#include "AllocationAudit.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+constexpr uint64_t packRange(uint32_t lo, uint32_t hi) { return (static_cast<uint64_t>(lo) << 32) | hi; }
+constexpr uint32_t rangeLo(uint64_t range) { return static_cast<uint32_t>(range >> 32); }
+constexpr uint32_t rangeHi(uint64_t range) { return static_cast<uint32_t>(range); }
+
+constexpr int spinBeforeSleep = 4000;
+
+} // namespace
+
+ThreadPool::ThreadPool(unsigned threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    slots = std::vector<Slot>(threadCount);
+    workers.reserve(threadCount - 1);
+    for (unsigned i = 1; i < threadCount; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping.store(true, std::memory_order_relaxed);
+        generation.fetch_add(1, std::memory_order_release);
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::run(size_t count, size_t grain, ChunkFn fn, void* context) {
+    size_t chunks = chunkCount(count, grain);
+    if (chunks > UINT32_MAX) {
+        throw std::length_error("ThreadPool::parallelFor: too many chunks");
+    }
+
+    jobFn = fn;
+    jobContext = context;
+    jobCount = count;
+    jobGrain = grain;
+    jobForbidsAllocation = AllocationAudit::forbidden();
+
+    // Deal contiguous chunk ranges so that without stealing each thread walks its own
+    // slice of memory.
+    size_t participants = slots.size();
+    for (size_t i = 0; i < participants; ++i) {
+        slots[i].range.store(packRange(static_cast<uint32_t>(chunks * i / participants),
+                                       static_cast<uint32_t>(chunks * (i + 1) / participants)),
+                             std::memory_order_relaxed);
+    }
+
+    pendingWorkers.store(static_cast<unsigned>(workers.size()), std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation.fetch_add(1, std::memory_order_release);
+    }
+    wake.notify_all();
+
+    participate(0);
+
+    // Every worker has to check out before the job state may be reused
+    while (pendingWorkers.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+}
+
+void ThreadPool::workerLoop(unsigned index) {
+    Profiler::setThreadName("worker " + std::to_string(index));
+    uint64_t seen = 0;
+    while (true) {
+        uint64_t current = generation.load(std::memory_order_acquire);
+        for (int spin = 0; current == seen && spin < spinBeforeSleep; ++spin) {
+            std::this_thread::yield();
+            current = generation.load(std::memory_order_acquire);
+        }
+        if (current == seen) {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return generation.load(std::memory_order_acquire) != seen; });
+            current = generation.load(std::memory_order_acquire);
+        }
+        seen = current;
+        if (stopping.load(std::memory_order_relaxed)) return;
+
+        {
+            FLUID_PROFILE_SCOPE("parallel for");
+            NoAllocationScope audit(jobForbidsAllocation);
+            participate(index);
+        }
+        pendingWorkers.fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void ThreadPool::participate(unsigned index) {
+    while (true) {
+        uint32_t chunk;
+        if (popChunk(index, chunk)) {
+            size_t begin = static_cast<size_t>(chunk) * jobGrain;
+            size_t end = std::min(begin + jobGrain, jobCount);
+            jobFn(jobContext, begin, end);
+        } else if (!steal(index)) {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::popChunk(unsigned index, uint32_t& chunk) {
+    std::atomic<uint64_t>& range = slots[index].range;
+    uint64_t current = range.load(std::memory_order_acquire);
+    while (rangeLo(current) < rangeHi(current)) {
+        if (range.compare_exchange_weak(current, packRange(rangeLo(current) + 1, rangeHi(current)),
+                                        std::memory_order_acq_rel)) {
+            chunk = rangeLo(current);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::steal(unsigned index) {
+    size_t participants = slots.size();
+    for (size_t offset = 1; offset < participants; ++offset) {
+        std::atomic<uint64_t>& victim = slots[(index + offset) % participants].range;
+        uint64_t current = victim.load(std::memory_order_acquire);
+        while (rangeLo(current) < rangeHi(current)) {
+            uint32_t lo = rangeLo(current), hi = rangeHi(current);
+            uint32_t split = hi - (hi - lo + 1) / 2; // Take the back half, rounding up
+            if (victim.compare_exchange_weak(current, packRange(lo, split), std::memory_order_acq_rel)) {
+                // Our own range is empty, and thieves only touch non-empty ranges
+                slots[index].range.store(packRange(split, hi), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+    return false;
+}
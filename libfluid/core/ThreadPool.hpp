@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker pool for data-parallel loops. A loop is cut into fixed-size
+// chunks that are dealt out to the workers up front; a worker that runs dry steals
+// half of the remaining range of another. Chunk boundaries depend only on the loop
+// size and grain, never on the thread count, so per-chunk results are reproducible.
+class ThreadPool {
+public:
+    // threadCount includes the calling thread; 0 picks the hardware concurrency.
+    explicit ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned getThreadCount() const { return static_cast<unsigned>(slots.size()); }
+
+    // Runs fn(begin, end) over [0, count) in chunks of grain elements and returns
+    // once all of them are done. The calling thread takes part in the work.
+    template <typename Fn>
+    void parallelFor(size_t count, size_t grain, Fn&& fn);
+
+    static size_t chunkCount(size_t count, size_t grain) { return (count + grain - 1) / grain; }
+
+private:
+    // Remaining chunk range [lo, hi) of one participant, packed as (lo << 32) | hi so
+    // the owner popping from the front and thieves splitting off the back can both
+    // update it with a single compare-and-swap.
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> range{ 0 };
+    };
+
+    using ChunkFn = void (*)(void* context, size_t begin, size_t end);
+
+    std::vector<Slot> slots;
+    std::vector<std::thread> workers;
+
+    // Current job, published by incrementing generation
+    ChunkFn jobFn = nullptr;
+    void* jobContext = nullptr;
+    size_t jobCount = 0, jobGrain = 1;
+    bool jobForbidsAllocation = false; // The caller is inside a NoAllocationScope
+    std::atomic<uint64_t> generation{ 0 };
+    std::atomic<unsigned> pendingWorkers{ 0 };
+    std::atomic<bool> stopping{ false };
+
+    std::mutex mutex;
+    std::condition_variable wake;
+
+    void run(size_t count, size_t grain, ChunkFn fn, void* context);
+    void workerLoop(unsigned index);
+    void participate(unsigned index);
+    bool popChunk(unsigned index, uint32_t& chunk);
+    bool steal(unsigned index);
+};
+
+template <typename Fn>
+void ThreadPool::parallelFor(size_t count, size_t grain, Fn&& fn) {
+    if (count == 0) return;
+    if (grain == 0) grain = 1;
+    if (slots.size() == 1 || count <= grain) {
+        for (size_t begin = 0; begin < count; begin += grain) {
+            fn(begin, begin + grain < count ? begin + grain : count);
+        }
+        return;
+    }
+    using Callable = std::remove_reference_t<Fn>;
+    run(count, grain, [](void* context, size_t begin, size_t end) {
+        (*static_cast<Callable*>(context))(begin, end);
+    }, const_cast<void*>(static_cast<const void*>(std::addressof(fn))));
+}
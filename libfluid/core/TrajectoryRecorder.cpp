@@ -0,0 +1,593 @@
+#include "TrajectoryRecorder.hpp"
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#include <zlib.h>
+
+namespace {
+
+struct ChunkHeader {
+    char magic[4] = { 'T', 'C', 'H', 'K' };
+    uint32_t frameCount = 0;
+    uint64_t firstFrame = 0;
+    uint64_t rawBytes = 0;    // Inflated size
+    uint64_t storedBytes = 0; // Deflated size, following the header
+};
+
+struct FrameRecord {
+    uint64_t step = 0;
+    double time = 0.0;
+    uint64_t count = 0; // Followed by the low and high byte planes of each component
+};
+
+struct IndexEntry {
+    uint64_t firstFrame;
+    uint64_t offset;
+};
+
+struct IndexFooter {
+    uint64_t chunkCount = 0;
+    uint64_t frameCount = 0;
+    uint64_t indexOffset = 0; // Of the first IndexEntry
+    char magic[8] = { 'T', 'R', 'J', 'I', 'N', 'D', 'E', 'X' };
+};
+
+// Linear map of a component onto [0, 65535]: positions over the scene, velocities
+// centred on 32768
+struct Quantizer {
+    float scale, offset;
+
+    uint16_t encode(float value) const {
+        float t = value * scale + offset;
+        t = t > 0.0f ? (t < 65535.0f ? t : 65535.0f) : 0.0f; // Also maps NaN to 0
+        return static_cast<uint16_t>(t + 0.5f);
+    }
+    float decode(uint16_t q) const { return (static_cast<float>(q) - offset) / scale; }
+};
+
+void componentQuantizers(const TrajectoryHeader& header, Quantizer quantizers[4]) {
+    quantizers[0] = { 65535.0f / header.width, 0.0f };
+    quantizers[1] = { 65535.0f / header.height, 0.0f };
+    quantizers[2] = quantizers[3] = { 32767.0f / header.velocityRange, 32768.0f };
+}
+
+// Two's complement deltas folded so small magnitudes of either sign have a zero
+// high byte
+uint16_t zigzag(uint16_t delta) {
+    return static_cast<uint16_t>((delta << 1) ^ static_cast<uint16_t>(static_cast<int16_t>(delta) >> 15));
+}
+uint16_t unzigzag(uint16_t code) {
+    return static_cast<uint16_t>((code >> 1) ^ (0u - (code & 1u)));
+}
+
+// Chunks start from an all-zero state; a change of particle count keeps the
+// common prefix and starts new particles from zero
+void resizeState(std::vector<uint16_t>* state, size_t count, bool reset) {
+    for (int c = 0; c < 4; ++c) {
+        if (reset) state[c].assign(count, 0);
+        else state[c].resize(count, 0);
+    }
+}
+
+void seekTo(std::FILE* file, uint64_t offset) {
+#ifdef _WIN32
+    int result = _fseeki64(file, static_cast<long long>(offset), SEEK_SET);
+#else
+    int result = fseeko(file, static_cast<off_t>(offset), SEEK_SET);
+#endif
+    if (result != 0) {
+        throw std::runtime_error("Cannot seek in trajectory file");
+    }
+}
+
+bool readExactly(std::FILE* file, void* data, size_t bytes) {
+    return std::fread(data, 1, bytes, file) == bytes;
+}
+
+// assign() and resize() reuse the destination's storage once it has grown to the particle count
+void copyFrame(ParticleStorage& destination, const ParticleView& particles, const uint32_t* slotOfId, size_t idCount) {
+    if (slotOfId) {
+        const float* sources[4] = { particles.x, particles.y, particles.vx, particles.vy };
+        AlignedVector<float>* arrays[4] = { &destination.x, &destination.y, &destination.vx, &destination.vy };
+        for (int a = 0; a < 4; ++a) {
+            arrays[a]->resize(idCount);
+            float* array = arrays[a]->data();
+            for (size_t id = 0; id < idCount; ++id) {
+                array[id] = slotOfId[id] < particles.count ? sources[a][slotOfId[id]] : 0.0f;
+            }
+        }
+    } else {
+        destination.x.assign(particles.x, particles.x + particles.count);
+        destination.y.assign(particles.y, particles.y + particles.count);
+        destination.vx.assign(particles.vx, particles.vx + particles.count);
+        destination.vy.assign(particles.vy, particles.vy + particles.count);
+    }
+}
+
+} // namespace
+
+TrajectoryRecorder::TrajectoryRecorder(const std::string& path, float width, float height, const TrajectoryOptions& options)
+    : path(path), options(options) {
+    if (!(width > 0.0f) || !(height > 0.0f) || !(options.velocityRange > 0.0f)) {
+        throw std::invalid_argument("Trajectory scene size and velocity range must be positive");
+    }
+    if (options.framesPerChunk == 0 || options.queueFrames == 0) {
+        throw std::invalid_argument("Trajectory chunk and queue lengths must be positive");
+    }
+    header.framesPerChunk = options.framesPerChunk;
+    header.width = width;
+    header.height = height;
+    header.velocityRange = options.velocityRange;
+
+    stream = new z_stream{};
+    if (deflateInit(stream, options.compressionLevel) != Z_OK) {
+        delete stream;
+        throw std::invalid_argument("Invalid trajectory compression level");
+    }
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        deflateEnd(stream);
+        delete stream;
+        throw std::runtime_error("Cannot create trajectory " + path);
+    }
+    try {
+        write(&header, sizeof(header));
+    } catch (...) {
+        std::fclose(file);
+        deflateEnd(stream);
+        delete stream;
+        throw;
+    }
+
+    slots.resize(options.queueFrames);
+    writer = std::thread(&TrajectoryRecorder::run, this);
+    copier = std::thread(&TrajectoryRecorder::copyLoans, this);
+}
+
+TrajectoryRecorder::~TrajectoryRecorder() {
+    try {
+        close();
+    } catch (...) {
+    }
+    deflateEnd(stream);
+    delete stream;
+}
+
+uint64_t TrajectoryRecorder::getRecordedFrames() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return recordedFrames;
+}
+
+uint64_t TrajectoryRecorder::getDroppedFrames() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return droppedFrames;
+}
+
+TrajectoryRecorder::Slot* TrajectoryRecorder::reserveSlot(std::unique_lock<std::mutex>& lock) {
+    // The slot behind the pending ones may still be taken by a loan
+    loanReturned.wait(lock, [&] { return !lent; });
+    if (closing) {
+        throw std::logic_error("TrajectoryRecorder::record after close");
+    }
+    if (!failed && pending == slots.size()) {
+        if (options.backpressure == TrajectoryOptions::Backpressure::Drop) {
+            ++droppedFrames;
+            return nullptr;
+        }
+        slotFreed.wait(lock, [&] { return pending < slots.size() || failed; });
+    }
+    if (failed) std::rethrow_exception(failure);
+    return &slots[(front + pending) % slots.size()];
+}
+
+bool TrajectoryRecorder::record(const ParticleView& particles, uint64_t step, double time, const uint32_t* slotOfId,
+                                size_t idCount) {
+    FLUID_PROFILE_SCOPE("record");
+    Slot* slot;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        slot = reserveSlot(lock);
+        if (!slot) return false;
+    }
+
+    slot->step = step;
+    slot->time = time;
+    copyFrame(slot->particles, particles, slotOfId, idCount);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++pending;
+        ++recordedFrames;
+    }
+    frameQueued.notify_one();
+    return true;
+}
+
+bool TrajectoryRecorder::recordBorrowed(const ParticleView& particles, uint64_t step, double time,
+                                        const uint32_t* slotOfId, size_t idCount) {
+    FLUID_PROFILE_SCOPE("record");
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        Slot* slot = reserveSlot(lock);
+        if (!slot) return false;
+        slot->step = step;
+        slot->time = time;
+        loan = { particles, slotOfId, idCount, slot };
+        lent = true;
+    }
+    loanMade.notify_one();
+    return true;
+}
+
+void TrajectoryRecorder::waitForCopy() {
+    std::unique_lock<std::mutex> lock(mutex);
+    loanReturned.wait(lock, [&] { return !lent; });
+}
+
+void TrajectoryRecorder::reserve(size_t capacity) {
+    // The writer only touches slots holding pending frames, and there are none yet
+    for (Slot& slot : slots) {
+        slot.particles.reserve(capacity);
+    }
+}
+
+void TrajectoryRecorder::close() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (closing) return;
+        loanReturned.wait(lock, [&] { return !lent; });
+        closing = true;
+    }
+    loanMade.notify_one();
+    frameQueued.notify_one();
+    copier.join();
+    writer.join();
+
+    bool closed = std::fclose(file) == 0;
+    file = nullptr;
+    if (failed) std::rethrow_exception(failure);
+    if (!closed) {
+        throw std::runtime_error("Failed to write trajectory " + path);
+    }
+}
+
+void TrajectoryRecorder::copyLoans() {
+    Profiler::setThreadName("trajectory copier");
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        loanMade.wait(lock, [&] { return lent || closing; });
+        if (!lent) break; // Closing, which waits for the last loan first
+        Loan current = loan;
+        lock.unlock();
+        bool copied = true;
+        try {
+            FLUID_PROFILE_SCOPE("copy frame");
+            copyFrame(current.slot->particles, current.particles, current.slotOfId, current.idCount);
+        } catch (...) {
+            copied = false;
+            lock.lock();
+            failure = std::current_exception();
+            failed = true;
+            slotFreed.notify_all();
+        }
+        if (copied) {
+            lock.lock();
+            ++pending;
+            ++recordedFrames;
+            frameQueued.notify_one();
+        }
+        lent = false;
+        loanReturned.notify_all();
+    }
+}
+
+void TrajectoryRecorder::run() {
+    Profiler::setThreadName("trajectory writer");
+    try {
+        while (true) {
+            const Slot* slot;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                frameQueued.wait(lock, [&] { return pending > 0 || closing; });
+                if (pending == 0) break; // Closing, and everything queued is written
+                slot = &slots[front];
+            }
+            encode(*slot);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                front = (front + 1) % slots.size();
+                --pending;
+            }
+            slotFreed.notify_one();
+            if (chunkFrames == options.framesPerChunk) flushChunk();
+        }
+        finish();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        failure = std::current_exception();
+        failed = true;
+        slotFreed.notify_all();
+    }
+}
+
+void TrajectoryRecorder::encode(const Slot& slot) {
+    FLUID_PROFILE_SCOPE("encode frame");
+    size_t count = slot.particles.size();
+    resizeState(previous, count, chunkFrames == 0);
+
+    FrameRecord record;
+    record.step = slot.step;
+    record.time = slot.time;
+    record.count = count;
+    frameBytes.resize(sizeof(record) + count * 8);
+    std::memcpy(frameBytes.data(), &record, sizeof(record));
+
+    Quantizer quantizers[4];
+    componentQuantizers(header, quantizers);
+    const float* sources[4] = { slot.particles.x.data(), slot.particles.y.data(),
+                                slot.particles.vx.data(), slot.particles.vy.data() };
+    uint8_t* plane = frameBytes.data() + sizeof(record);
+    for (int c = 0; c < 4; ++c) {
+        const float* source = sources[c];
+        uint16_t* state = previous[c].data();
+        uint8_t* low = plane;
+        uint8_t* high = plane + count;
+        const Quantizer quantizer = quantizers[c];
+        for (size_t i = 0; i < count; ++i) {
+            uint16_t q = quantizer.encode(source[i]);
+            uint16_t code = zigzag(static_cast<uint16_t>(q - state[i]));
+            state[i] = q;
+            low[i] = static_cast<uint8_t>(code);
+            high[i] = static_cast<uint8_t>(code >> 8);
+        }
+        plane += 2 * count;
+    }
+
+    // Deflate into the open chunk, growing the output as needed
+    FLUID_PROFILE_SCOPE("compress frame");
+    stream->next_in = frameBytes.data();
+    stream->avail_in = static_cast<uInt>(frameBytes.size());
+    while (stream->avail_in > 0) {
+        if (stream->total_out == compressed.size()) {
+            compressed.resize(std::max<size_t>(compressed.size() * 2, deflateBound(stream, stream->avail_in)));
+        }
+        stream->next_out = compressed.data() + stream->total_out;
+        stream->avail_out = static_cast<uInt>(compressed.size() - stream->total_out);
+        if (deflate(stream, Z_NO_FLUSH) != Z_OK) {
+            throw std::runtime_error("Failed to compress trajectory frame");
+        }
+    }
+    ++chunkFrames;
+    ++writtenFrames;
+}
+
+void TrajectoryRecorder::flushChunk() {
+    FLUID_PROFILE_SCOPE("write chunk");
+    int result;
+    do {
+        if (stream->total_out == compressed.size()) {
+            compressed.resize(std::max<size_t>(compressed.size() * 2, 4096));
+        }
+        stream->next_out = compressed.data() + stream->total_out;
+        stream->avail_out = static_cast<uInt>(compressed.size() - stream->total_out);
+        result = deflate(stream, Z_FINISH);
+    } while (result == Z_OK || result == Z_BUF_ERROR);
+    if (result != Z_STREAM_END) {
+        throw std::runtime_error("Failed to compress trajectory chunk");
+    }
+
+    ChunkHeader chunkHeader;
+    chunkHeader.frameCount = chunkFrames;
+    chunkHeader.firstFrame = writtenFrames - chunkFrames;
+    chunkHeader.rawBytes = stream->total_in;
+    chunkHeader.storedBytes = stream->total_out;
+    index.push_back({ chunkHeader.firstFrame, fileOffset });
+    write(&chunkHeader, sizeof(chunkHeader));
+    write(compressed.data(), static_cast<size_t>(stream->total_out));
+    // Let a reader of the unfinished file see whole chunks
+    std::fflush(file);
+
+    deflateReset(stream);
+    chunkFrames = 0;
+}
+
+void TrajectoryRecorder::finish() {
+    if (chunkFrames > 0) flushChunk();
+
+    IndexFooter footer;
+    footer.chunkCount = index.size();
+    footer.frameCount = writtenFrames;
+    footer.indexOffset = fileOffset;
+    for (const ChunkEntry& entry : index) {
+        IndexEntry stored = { entry.firstFrame, entry.offset };
+        write(&stored, sizeof(stored));
+    }
+    write(&footer, sizeof(footer));
+    if (std::fflush(file) != 0) {
+        throw std::runtime_error("Failed to write trajectory " + path);
+    }
+}
+
+void TrajectoryRecorder::write(const void* data, size_t bytes) {
+    if (bytes && std::fwrite(data, 1, bytes, file) != bytes) {
+        throw std::runtime_error("Failed to write trajectory " + path);
+    }
+    fileOffset += bytes;
+}
+
+TrajectoryReader::TrajectoryReader(const std::string& path) : path(path) {
+    std::error_code error;
+    uint64_t fileBytes = std::filesystem::file_size(path, error);
+    file = error ? nullptr : std::fopen(path.c_str(), "rb");
+    if (!file) {
+        throw std::runtime_error("Cannot open trajectory " + path);
+    }
+    stream = new z_stream{};
+    if (inflateInit(stream) != Z_OK) {
+        delete stream;
+        std::fclose(file);
+        throw std::runtime_error("Cannot initialize zlib");
+    }
+
+    try {
+        const TrajectoryHeader reference;
+        if (!readExactly(file, &header, sizeof(header)) ||
+            std::memcmp(header.magic, reference.magic, sizeof(header.magic)) != 0) {
+            throw std::runtime_error(path + " is not a trajectory file");
+        }
+        if (header.byteOrder != reference.byteOrder) {
+            throw std::runtime_error("Trajectory " + path + " was written with a different byte order");
+        }
+        if (header.version != trajectoryVersion || header.headerBytes != sizeof(TrajectoryHeader)) {
+            throw std::runtime_error("Trajectory " + path + " has unsupported version " + std::to_string(header.version));
+        }
+        if (!readIndex(fileBytes)) scanChunks(fileBytes);
+    } catch (...) {
+        inflateEnd(stream);
+        delete stream;
+        std::fclose(file);
+        throw;
+    }
+}
+
+TrajectoryReader::~TrajectoryReader() {
+    inflateEnd(stream);
+    delete stream;
+    std::fclose(file);
+}
+
+bool TrajectoryReader::readIndex(uint64_t fileBytes) {
+    IndexFooter footer;
+    const IndexFooter reference;
+    if (fileBytes < sizeof(TrajectoryHeader) + sizeof(footer)) return false;
+    seekTo(file, fileBytes - sizeof(footer));
+    if (!readExactly(file, &footer, sizeof(footer)) ||
+        std::memcmp(footer.magic, reference.magic, sizeof(footer.magic)) != 0 ||
+        footer.indexOffset + footer.chunkCount * sizeof(IndexEntry) != fileBytes - sizeof(footer)) {
+        return false;
+    }
+
+    std::vector<IndexEntry> entries(static_cast<size_t>(footer.chunkCount));
+    seekTo(file, footer.indexOffset);
+    if (!entries.empty() && !readExactly(file, entries.data(), entries.size() * sizeof(IndexEntry))) {
+        return false;
+    }
+    chunks.clear();
+    for (size_t i = 0; i < entries.size(); ++i) {
+        uint64_t end = i + 1 < entries.size() ? entries[i + 1].firstFrame : footer.frameCount;
+        if (end <= entries[i].firstFrame || entries[i].offset >= footer.indexOffset) {
+            throw std::runtime_error("Trajectory " + path + " has a corrupt index");
+        }
+        chunks.push_back({ entries[i].firstFrame, entries[i].offset, static_cast<uint32_t>(end - entries[i].firstFrame) });
+    }
+    frameCount = footer.frameCount;
+    return true;
+}
+
+void TrajectoryReader::scanChunks(uint64_t fileBytes) {
+    // No index: the recording was cut short. Every whole chunk is still usable.
+    const ChunkHeader reference;
+    uint64_t offset = sizeof(TrajectoryHeader);
+    chunks.clear();
+    frameCount = 0;
+    while (offset + sizeof(ChunkHeader) <= fileBytes) {
+        ChunkHeader chunkHeader;
+        seekTo(file, offset);
+        if (!readExactly(file, &chunkHeader, sizeof(chunkHeader)) ||
+            std::memcmp(chunkHeader.magic, reference.magic, sizeof(chunkHeader.magic)) != 0 ||
+            chunkHeader.firstFrame != frameCount || chunkHeader.frameCount == 0 ||
+            chunkHeader.storedBytes > fileBytes - offset - sizeof(chunkHeader)) {
+            break;
+        }
+        chunks.push_back({ chunkHeader.firstFrame, offset, chunkHeader.frameCount });
+        frameCount += chunkHeader.frameCount;
+        offset += sizeof(chunkHeader) + chunkHeader.storedBytes;
+    }
+}
+
+void TrajectoryReader::loadChunk(size_t chunkIndex) {
+    const ChunkEntry& entry = chunks[chunkIndex];
+    ChunkHeader chunkHeader;
+    seekTo(file, entry.offset);
+    if (!readExactly(file, &chunkHeader, sizeof(chunkHeader)) || chunkHeader.firstFrame != entry.firstFrame) {
+        throw std::runtime_error("Trajectory " + path + " has a corrupt chunk");
+    }
+    compressed.resize(static_cast<size_t>(chunkHeader.storedBytes));
+    if (!readExactly(file, compressed.data(), compressed.size())) {
+        throw std::runtime_error("Trajectory " + path + " is truncated");
+    }
+    inflateReset(stream);
+    stream->next_in = compressed.data();
+    stream->avail_in = static_cast<uInt>(compressed.size());
+    currentChunk = chunkIndex;
+    nextFrame = entry.firstFrame;
+}
+
+void TrajectoryReader::inflateBytes(void* destination, size_t bytes) {
+    stream->next_out = static_cast<Bytef*>(destination);
+    stream->avail_out = static_cast<uInt>(bytes);
+    while (stream->avail_out > 0) {
+        int result = inflate(stream, Z_NO_FLUSH);
+        if (result != Z_OK && !(result == Z_STREAM_END && stream->avail_out == 0)) {
+            throw std::runtime_error("Trajectory " + path + " has a corrupt chunk");
+        }
+    }
+}
+
+void TrajectoryReader::readFrame(uint64_t frameIndex, TrajectoryFrame& frame) {
+    if (frameIndex >= frameCount) {
+        throw std::out_of_range("Trajectory frame " + std::to_string(frameIndex) + " out of range");
+    }
+    size_t chunkIndex = static_cast<size_t>(
+        std::upper_bound(chunks.begin(), chunks.end(), frameIndex,
+                         [](uint64_t value, const ChunkEntry& entry) { return value < entry.firstFrame; }) -
+        chunks.begin()) - 1;
+    // Frames only decode forward from the start of their chunk
+    if (chunkIndex != currentChunk || frameIndex < nextFrame) {
+        loadChunk(chunkIndex);
+    }
+
+    Quantizer quantizers[4];
+    componentQuantizers(header, quantizers);
+    while (nextFrame <= frameIndex) {
+        FrameRecord record;
+        inflateBytes(&record, sizeof(record));
+        size_t count = static_cast<size_t>(record.count);
+        resizeState(previous, count, nextFrame == chunks[chunkIndex].firstFrame);
+        frameBytes.resize(count * 8);
+        inflateBytes(frameBytes.data(), frameBytes.size());
+
+        bool target = nextFrame == frameIndex;
+        if (target) {
+            frame.step = record.step;
+            frame.time = record.time;
+            frame.particles.x.resize(count);
+            frame.particles.y.resize(count);
+            frame.particles.vx.resize(count);
+            frame.particles.vy.resize(count);
+        }
+        float* destinations[4] = { frame.particles.x.data(), frame.particles.y.data(),
+                                   frame.particles.vx.data(), frame.particles.vy.data() };
+        const uint8_t* plane = frameBytes.data();
+        for (int c = 0; c < 4; ++c) {
+            uint16_t* state = previous[c].data();
+            const uint8_t* low = plane;
+            const uint8_t* high = plane + count;
+            for (size_t i = 0; i < count; ++i) {
+                state[i] = static_cast<uint16_t>(state[i] + unzigzag(static_cast<uint16_t>(low[i] | (high[i] << 8))));
+            }
+            if (target) {
+                const Quantizer quantizer = quantizers[c];
+                for (size_t i = 0; i < count; ++i) {
+                    destinations[c][i] = quantizer.decode(state[i]);
+                }
+            }
+            plane += 2 * count;
+        }
+        ++nextFrame;
+    }
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ParticleStorage.hpp"
+
+struct z_stream_s;
+
+// Trajectory file: a header, then compressed chunks of consecutive frames, then an
+// index of the chunks. Positions are quantized to 16 bits over the scene and
+// velocities to 16 bits over [-velocityRange, velocityRange], clamping whatever
+// lies outside. Each frame is stored
+// as the difference to the previous one, zigzag coded and split into byte planes,
+// so slowly moving particles compress to almost nothing. The first frame of every
+// chunk is coded against zero, which makes chunks independently decodable and lets
+// a reader seek to any frame by decoding at most one chunk. A file that lacks the
+// index because the recording was cut short is still readable by walking the chunks.
+constexpr uint32_t trajectoryVersion = 1;
+
+struct TrajectoryHeader {
+    char magic[8] = { 'F', 'L', 'U', 'I', 'D', 'T', 'R', 'J' };
+    uint32_t version = trajectoryVersion;
+    uint32_t headerBytes = sizeof(TrajectoryHeader);
+    uint32_t byteOrder = 0x01020304;
+    uint32_t framesPerChunk = 0;
+    float width = 0.0f, height = 0.0f; // Position quantization range
+    float velocityRange = 0.0f;        // Velocity quantization range, either sign
+    uint32_t reserved = 0;
+};
+
+struct TrajectoryOptions {
+    enum class Backpressure {
+        Block, // record() waits for the writer, nothing is lost
+        Drop,  // record() discards the frame, the run is never slowed down
+    };
+
+    float velocityRange = 1000.0f; // Faster velocities are clamped
+    uint32_t framesPerChunk = 32;  // Longer chunks compress better but seek slower
+    size_t queueFrames = 4;        // Frames buffered between record() and the writer
+    int compressionLevel = 1;      // zlib level
+    Backpressure backpressure = Backpressure::Block;
+};
+
+struct TrajectoryFrame {
+    uint64_t step = 0;
+    double time = 0.0;
+    ParticleStorage particles;
+};
+
+// Streams frames to a trajectory file from a background writer thread. record()
+// only copies the particles into a queue slot, whose storage is reused once grown;
+// quantization, delta coding, compression and I/O all happen on the writer.
+// recordBorrowed() leaves even that copy to a copy thread, for producers that keep
+// a copy of the state anyway, like SimulationThread's published snapshots.
+class TrajectoryRecorder {
+public:
+    // Throws std::runtime_error if the file cannot be created
+    TrajectoryRecorder(const std::string& path, float width, float height, const TrajectoryOptions& options = {});
+    ~TrajectoryRecorder();
+
+    TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+    TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+    // Queues one frame, call from a single thread. Returns false if the frame was
+    // dropped under the Drop policy. Rethrows a failure of the writer thread.
+    // With slotOfId (FluidSimulator::getParticleSlots), the frame has idCount particles
+    // and particle k is the one in slot slotOfId[k], so particles keep their place when
+    // storage is reordered. IDs without a slot are recorded at rest at the origin.
+    bool record(const ParticleView& particles, uint64_t step, double time, const uint32_t* slotOfId = nullptr,
+                size_t idCount = 0);
+    // Same, but the particles and slotOfId are only lent: the copy thread takes the
+    // frame out of them, so the caller pays for the hand-over alone. Both must stay
+    // unchanged until waitForCopy() returns; the next record call waits as well.
+    bool recordBorrowed(const ParticleView& particles, uint64_t step, double time, const uint32_t* slotOfId = nullptr,
+                        size_t idCount = 0);
+    // Blocks until the frame lent by recordBorrowed(), if any, has been copied
+    void waitForCopy();
+    // Grows every queue slot to frames of up to capacity particles, so recording a
+    // growing population never allocates. Call before the first frame.
+    void reserve(size_t capacity);
+
+    // Writes the pending frames and the index and closes the file. Called by the
+    // destructor, which swallows errors; call it directly to see them.
+    void close();
+
+    uint64_t getRecordedFrames() const;
+    uint64_t getDroppedFrames() const;
+
+private:
+    struct Slot {
+        uint64_t step = 0;
+        double time = 0.0;
+        ParticleStorage particles;
+    };
+
+    struct ChunkEntry {
+        uint64_t firstFrame;
+        uint64_t offset;
+    };
+
+    // Frame handed to recordBorrowed(), on its way into a reserved slot
+    struct Loan {
+        ParticleView particles;
+        const uint32_t* slotOfId = nullptr;
+        size_t idCount = 0;
+        Slot* slot = nullptr;
+    };
+
+    std::string path;
+    TrajectoryHeader header;
+    TrajectoryOptions options;
+    std::FILE* file = nullptr;
+
+    // Queue of frames, guarded by mutex. Only the producer, or the copy thread for a
+    // loan, fills the slot behind the pending ones and only the writer reads the front
+    // one, so none of the copies holds the lock.
+    std::vector<Slot> slots;
+    size_t front = 0, pending = 0;
+    uint64_t recordedFrames = 0, droppedFrames = 0;
+    bool closing = false, failed = false;
+    Loan loan;
+    bool lent = false; // loan is waiting for or in the copy
+    std::exception_ptr failure;
+    mutable std::mutex mutex;
+    std::condition_variable frameQueued, slotFreed, loanMade, loanReturned;
+    std::thread writer, copier;
+
+    // Writer state. Frames are deflated one at a time into the open chunk, so only
+    // the compressed chunk is held in memory.
+    std::vector<uint16_t> previous[4]; // Quantized last frame, per component
+    std::vector<uint8_t> frameBytes, compressed;
+    uint32_t chunkFrames = 0;
+    uint64_t writtenFrames = 0, fileOffset = 0;
+    std::vector<ChunkEntry> index;
+    z_stream_s* stream = nullptr;
+
+    Slot* reserveSlot(std::unique_lock<std::mutex>& lock);
+    void run();
+    void copyLoans();
+    void encode(const Slot& slot);
+    void flushChunk();
+    void finish();
+    void write(const void* data, size_t bytes);
+};
+
+// Random access to the frames of a trajectory file. Reading frames in order decodes
+// each one once; a seek decodes the target's chunk from its start.
+class TrajectoryReader {
+public:
+    // Throws std::runtime_error if the file cannot be opened or is not a trajectory
+    explicit TrajectoryReader(const std::string& path);
+    ~TrajectoryReader();
+
+    TrajectoryReader(const TrajectoryReader&) = delete;
+    TrajectoryReader& operator=(const TrajectoryReader&) = delete;
+
+    const TrajectoryHeader& getHeader() const { return header; }
+    uint64_t getFrameCount() const { return frameCount; }
+
+    // Decodes frame index, counting from 0, into frame. Throws std::out_of_range past
+    // the last frame.
+    void readFrame(uint64_t frameIndex, TrajectoryFrame& frame);
+
+private:
+    struct ChunkEntry {
+        uint64_t firstFrame;
+        uint64_t offset;
+        uint32_t frameCount;
+    };
+
+    std::string path;
+    std::FILE* file = nullptr;
+    TrajectoryHeader header;
+    std::vector<ChunkEntry> chunks;
+    uint64_t frameCount = 0;
+
+    // Decoding position: the chunk being inflated, the frame it continues with and
+    // the quantized state of the frame before that
+    size_t currentChunk = SIZE_MAX;
+    uint64_t nextFrame = 0;
+    std::vector<uint8_t> compressed, frameBytes;
+    std::vector<uint16_t> previous[4];
+    z_stream_s* stream = nullptr;
+
+    bool readIndex(uint64_t fileBytes);
+    void scanChunks(uint64_t fileBytes);
+    void loadChunk(size_t chunkIndex);
+    void inflateBytes(void* destination, size_t bytes);
+};
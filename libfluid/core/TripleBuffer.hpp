@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free hand-over of whole values from one writer thread to one reader thread.
+// The writer fills its private buffer and publishes it by swapping it with the shared
+// middle slot; the reader swaps the middle slot with its own buffer when something
+// new has been published. Neither side ever waits, the reader simply keeps seeing the
+// last value it took until a newer one is available.
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() = default;
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Writer side: the buffer to fill, then publish() to hand it over
+    T& writeBuffer() { return buffers[backIndex]; }
+
+    void publish() {
+        uint8_t previous = middle.exchange(static_cast<uint8_t>(backIndex | dirtyBit), std::memory_order_acq_rel);
+        backIndex = previous & indexMask;
+    }
+
+    // Reader side: the most recently published value. It stays untouched by the
+    // writer until the next call.
+    const T& read() {
+        if (middle.load(std::memory_order_relaxed) & dirtyBit) {
+            uint8_t previous = middle.exchange(frontIndex, std::memory_order_acq_rel);
+            frontIndex = previous & indexMask;
+        }
+        return buffers[frontIndex];
+    }
+
+    bool hasUpdate() const { return (middle.load(std::memory_order_relaxed) & dirtyBit) != 0; }
+
+private:
+    static constexpr uint8_t indexMask = 0x3;
+    static constexpr uint8_t dirtyBit = 0x4;
+
+    T buffers[3];
+    alignas(64) uint8_t backIndex = 0;          // Owned by the writer
+    alignas(64) std::atomic<uint8_t> middle{ 1 }; // Shared: index plus "not yet read" bit
+    alignas(64) uint8_t frontIndex = 2;         // Owned by the reader
+};
@@ -2,9 +2,15 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include <cstring>
 #include <iostream>
+#include <optional>
+#include <string>
 
-#include "libfluid/FluidSimulator.hpp"
+#include "libfluid/core/FluidSimulator.hpp"
+#include "libfluid/core/Profiler.hpp"
+#include "libfluid/core/SimulationThread.hpp"
+#include "libfluid/core/TrajectoryRecorder.hpp"
 #include "libfluid/InputHandler.hpp"
 #include "libfluid/Renderer.hpp"
 
@@ -50,7 +56,52 @@ static void key_callback(GLFWwindow* window, const int key, const int scancode,
 }
 
 
-int main() {
+int main(int argc, char** argv) {
+    // --trace FILE writes a Chrome trace of the last frames on exit (profiling builds only)
+    // --vertex-format float|compact16|compact8 picks the particle upload format
+    // --checkpoint FILE resumes from a saved state, --save-checkpoint FILE saves one on exit
+    // --record FILE records every step to a trajectory, --record-policy block|drop sets
+    // what happens when its writer falls behind
+    // --bloom-levels N sets the bloom pyramid depth, 0 turns bloom off
+    // --obstacles FILE loads circles and polygons for the particles to collide with
+    // --shader-cache DIR keeps linked shader programs between launches, off disables it
+    std::string tracePath, checkpointPath, saveCheckpointPath, recordPath, obstaclePath;
+    std::string shaderCachePath = "shader-cache";
+    TrajectoryOptions recordOptions;
+    VertexFormat vertexFormat = VertexFormat::Float32;
+    BloomSettings bloom;
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (std::strcmp(argv[i], "--trace") == 0) tracePath = argv[++i];
+        else if (std::strcmp(argv[i], "--checkpoint") == 0) checkpointPath = argv[++i];
+        else if (std::strcmp(argv[i], "--save-checkpoint") == 0) saveCheckpointPath = argv[++i];
+        else if (std::strcmp(argv[i], "--record") == 0) recordPath = argv[++i];
+        else if (std::strcmp(argv[i], "--record-policy") == 0) {
+            std::string name = argv[++i];
+            if (name == "block") recordOptions.backpressure = TrajectoryOptions::Backpressure::Block;
+            else if (name == "drop") recordOptions.backpressure = TrajectoryOptions::Backpressure::Drop;
+            else {
+                std::cerr << "Unknown record policy: " << name << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (std::strcmp(argv[i], "--obstacles") == 0) obstaclePath = argv[++i];
+        else if (std::strcmp(argv[i], "--shader-cache") == 0) {
+            shaderCachePath = argv[++i];
+            if (shaderCachePath == "off") shaderCachePath.clear();
+        }
+        else if (std::strcmp(argv[i], "--bloom-levels") == 0) bloom.levels = std::atoi(argv[++i]);
+        else if (std::strcmp(argv[i], "--vertex-format") == 0) {
+            std::string name = argv[++i];
+            if (name == "float") vertexFormat = VertexFormat::Float32;
+            else if (name == "compact16") vertexFormat = VertexFormat::Compact16;
+            else if (name == "compact8") vertexFormat = VertexFormat::Compact8;
+            else {
+                std::cerr << "Unknown vertex format: " << name << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
     glfwSetErrorCallback(error_callback);
 
     if (!glfwInit()) return EXIT_FAILURE;
@@ -58,15 +109,48 @@ int main() {
     // int width = 960, height = 1080;
     int width = 1920, height = 1080;
     try {
-        FluidSimulator simulator(width, height);
-        Renderer renderer(width, height);
-        InputHandler inputHandler(renderer.getWindow(), simulator);
-
+        FluidSimulator simulator = checkpointPath.empty() ? FluidSimulator(width, height)
+                                                          : FluidSimulator::loadCheckpoint(checkpointPath);
+        width = simulator.getWidth();
+        height = simulator.getHeight();
+        if (!obstaclePath.empty()) simulator.setObstacles(loadObstacles(obstaclePath));
+        Renderer renderer(width, height, vertexFormat, shaderCachePath);
+        renderer.bloom = bloom;
+        std::optional<TrajectoryRecorder> recorder;
+        if (!recordPath.empty()) {
+            recorder.emplace(recordPath, static_cast<float>(width), static_cast<float>(height), recordOptions);
+            recorder->reserve(simulator.getParticleCapacity());
+        }
+        // The simulator steps on its own thread; this one only handles input and drawing
+        // Steps as long as the simulator's CFL condition allows, split into substeps when that is short
+        SimulationThread simulation(simulator, SimulationThread::adaptiveTimeStep, 4, recorder ? &*recorder : nullptr);
+        InputHandler inputHandler(renderer.getWindow(), simulation);
+        Profiler::setThreadName("main");
+
+        const uint64_t summaryInterval = 5000000000ull; // Nanoseconds between phase reports
+        uint64_t lastSummary = Profiler::now();
         while (!glfwWindowShouldClose(renderer.getWindow())) {
-            inputHandler.processInput();
-            simulator.update(0.016f); // Assuming 60 FPS
-            renderer.render(simulator);
-            glfwPollEvents();
+            {
+                FLUID_PROFILE_SCOPE("frame");
+                simulation.rethrowIfFailed();
+                inputHandler.processInput();
+                const ParticleSnapshot& snapshot = simulation.latestSnapshot();
+                renderer.render(snapshot.particles.view(), snapshot.stats);
+                glfwPollEvents();
+            }
+            if (profilingEnabled && Profiler::now() - lastSummary > summaryInterval) {
+                Profiler::printSummary(std::cout, summaryInterval * 1e-9);
+                lastSummary = Profiler::now();
+            }
+        }
+
+        simulation.stop();
+        if (recorder) recorder->close();
+        if (profilingEnabled && !tracePath.empty()) {
+            Profiler::writeChromeTrace(tracePath);
+        }
+        if (!saveCheckpointPath.empty()) {
+            simulator.saveCheckpoint(saveCheckpointPath);
         }
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;